@@ -4,12 +4,16 @@
 #include <Library/PrintLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
+#include <IndustryStandard/Pci.h>
 #include <Protocol/BlockIo.h>
+#include <Protocol/DevicePath.h>
 #include <Protocol/DiskIo2.h>
 #include <Protocol/LoadedImage.h>
+#include <Protocol/PciIo.h>
 #include <Protocol/SimpleFileSystem.h>
 #include <Uefi.h>
 
+#include "boot_volume.hpp"
 #include "elf.hpp"
 #include "frame_buffer_config.hpp"
 #include "memory_map.hpp"
@@ -213,7 +217,8 @@ EFI_STATUS ReadFile(EFI_FILE_PROTOCOL* file, VOID** buffer) {
 }
 
 EFI_STATUS OpenBlockIoProtocolForLoadedImage(EFI_HANDLE image_handle,
-                                             EFI_BLOCK_IO_PROTOCOL** block_io) {
+                                             EFI_BLOCK_IO_PROTOCOL** block_io,
+                                             EFI_HANDLE* device_handle) {
   EFI_STATUS status;
   EFI_LOADED_IMAGE_PROTOCOL* loaded_image;
 
@@ -224,6 +229,7 @@ EFI_STATUS OpenBlockIoProtocolForLoadedImage(EFI_HANDLE image_handle,
     return status;
   }
 
+  *device_handle = loaded_image->DeviceHandle;
   status = gBS->OpenProtocol(loaded_image->DeviceHandle,
                              &gEfiBlockIoProtocolGuid, (VOID**)block_io,
                              image_handle,  // agent handle
@@ -232,6 +238,65 @@ EFI_STATUS OpenBlockIoProtocolForLoadedImage(EFI_HANDLE image_handle,
   return status;
 }
 
+/* Returns TRUE if the block device is a whole virtio-blk disk. The kernel
+ * drives such a disk itself, so the loader need not copy its data clusters.
+ * A partition is rejected, as the kernel reads the volume from LBA 0 of the
+ * disk.
+ */
+BOOLEAN IsKernelReadableDevice(EFI_HANDLE image_handle,
+                               EFI_HANDLE device_handle,
+                               EFI_BLOCK_IO_MEDIA* media) {
+  EFI_STATUS status;
+  EFI_DEVICE_PATH_PROTOCOL* device_path;
+  EFI_HANDLE pci_handle;
+  EFI_PCI_IO_PROTOCOL* pci_io;
+  UINT16 ids[2];  // vendor ID, device ID
+
+  if (media->LogicalPartition) {
+    return FALSE;
+  }
+
+  status = gBS->OpenProtocol(device_handle, &gEfiDevicePathProtocolGuid,
+                             (VOID**)&device_path, image_handle, NULL,
+                             EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL);
+  if (EFI_ERROR(status)) {
+    return FALSE;
+  }
+
+  status = gBS->LocateDevicePath(&gEfiPciIoProtocolGuid, &device_path,
+                                 &pci_handle);
+  if (EFI_ERROR(status)) {
+    return FALSE;
+  }
+
+  status = gBS->OpenProtocol(pci_handle, &gEfiPciIoProtocolGuid,
+                             (VOID**)&pci_io, image_handle, NULL,
+                             EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL);
+  if (EFI_ERROR(status)) {
+    return FALSE;
+  }
+
+  status = pci_io->Pci.Read(pci_io, EfiPciIoWidthUint16, PCI_VENDOR_ID_OFFSET,
+                            2, ids);
+  if (EFI_ERROR(status)) {
+    return FALSE;
+  }
+  // transitional virtio-blk, the one the kernel driver supports
+  return ids[0] == 0x1af4 && ids[1] == 0x1001;
+}
+
+/* Returns the number of bytes from the start of a FAT volume to the end of
+ * its FAT region, computed from the boot sector.
+ */
+UINTN CalcFATMetadataBytes(const UINT8* boot_sector) {
+  UINT16 bytes_per_sector = *(UINT16*)&boot_sector[11];
+  UINT16 reserved_sector_count = *(UINT16*)&boot_sector[14];
+  UINT8 num_fats = boot_sector[16];
+  UINT32 fat_size_32 = *(UINT32*)&boot_sector[36];
+  return (UINTN)bytes_per_sector *
+         (reserved_sector_count + (UINTN)num_fats * fat_size_32);
+}
+
 EFI_STATUS ReadBlocks(EFI_BLOCK_IO_PROTOCOL* block_io, UINT32 media_id,
                       UINTN read_bytes, VOID** buffer) {
   EFI_STATUS status;
@@ -348,38 +413,67 @@ EFI_STATUS EFIAPI UefiMain(EFI_HANDLE image_handle,
     Halt();
   }
 
-  VOID* volume_image;
+  struct BootVolume boot_volume;
 
   EFI_FILE_PROTOCOL* volume_file;
   status = root_dir->Open(root_dir, &volume_file, L"\\fat_disk",
                           EFI_FILE_MODE_READ, 0);
   if (status == EFI_SUCCESS) {
-    status = ReadFile(volume_file, &volume_image);
+    status = ReadFile(volume_file, &boot_volume.image);
     if (EFI_ERROR(status)) {
       Print(L"failed to read volume file: %r", status);
       Halt();
     }
+    // the kernel has no way to reach the file, so it is read whole
+    UINTN total_sectors = *(UINT16*)((UINT8*)boot_volume.image + 19);
+    if (total_sectors == 0) {
+      total_sectors = *(UINT32*)((UINT8*)boot_volume.image + 32);
+    }
+    boot_volume.volume_bytes =
+        total_sectors * *(UINT16*)((UINT8*)boot_volume.image + 11);
+    boot_volume.image_bytes = boot_volume.volume_bytes;
   } else {
     EFI_BLOCK_IO_PROTOCOL* block_io;
-    status = OpenBlockIoProtocolForLoadedImage(image_handle, &block_io);
+    EFI_HANDLE device_handle;
+    status = OpenBlockIoProtocolForLoadedImage(image_handle, &block_io,
+                                               &device_handle);
     if (EFI_ERROR(status)) {
       Print(L"failed to open Block I/O Protocol: %r\n", status);
       Halt();
     }
 
     EFI_BLOCK_IO_MEDIA* media = block_io->Media;
-    UINTN volume_bytes = (UINTN)media->BlockSize * media->LastBlock + 1;
-    if (volume_bytes > 32 * 1024 * 1024) {
-      volume_bytes = 32 * 1024 * 1024;
+    UINTN volume_bytes = (UINTN)media->BlockSize * (media->LastBlock + 1);
+    UINTN read_bytes = volume_bytes;
+    if (IsKernelReadableDevice(image_handle, device_handle, media)) {
+      // Copy the reserved sectors and the FATs only. The kernel reads data
+      // clusters through its virtio-blk driver.
+      VOID* boot_sector;
+      status = ReadBlocks(block_io, media->MediaId, media->BlockSize,
+                          &boot_sector);
+      if (EFI_ERROR(status)) {
+        Print(L"failed to read the boot sector: %r\n", status);
+        Halt();
+      }
+      read_bytes = CalcFATMetadataBytes(boot_sector);
+      read_bytes = (read_bytes + media->BlockSize - 1) / media->BlockSize *
+                   media->BlockSize;
+      gBS->FreePool(boot_sector);
+    }
+    if (read_bytes > 32 * 1024 * 1024) {
+      read_bytes = 32 * 1024 * 1024;
     }
-    Print(L"Reading %lu bytes (Present %d, BlockSize %u, LastBlock %u)\n",
-          volume_bytes, media->MediaPresent, media->BlockSize,
+    Print(L"Reading %lu of %lu bytes (Present %d, BlockSize %u, LastBlock %u)\n",
+          read_bytes, volume_bytes, media->MediaPresent, media->BlockSize,
           media->LastBlock);
-    status = ReadBlocks(block_io, media->MediaId, volume_bytes, &volume_image);
+    status = ReadBlocks(block_io, media->MediaId, read_bytes,
+                        &boot_volume.image);
     if (EFI_ERROR(status)) {
       Print(L"failed to read blocks: %r\n", status);
       Halt();
     }
+    boot_volume.image_bytes = read_bytes;
+    boot_volume.volume_bytes = volume_bytes;
   }
 
   status = gBS->ExitBootServices(image_handle, memmap.map_key);
@@ -423,9 +517,10 @@ EFI_STATUS EFIAPI UefiMain(EFI_HANDLE image_handle,
     }
   }
   typedef void EntryPointType(const struct FrameBufferConfig*,
-                              const struct MemoryMap*, const VOID*, VOID*);
+                              const struct MemoryMap*, const VOID*,
+                              const struct BootVolume*);
   EntryPointType* entry_point = (EntryPointType*)entry_addr;
-  entry_point(&config, &memmap, acpi_table, volume_image);
+  entry_point(&config, &memmap, acpi_table, &boot_volume);
 
   Print(L"All done\n");
 
@@ -0,0 +1 @@
+../kernel/boot_volume.hpp
\ No newline at end of file
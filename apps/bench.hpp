@@ -0,0 +1,85 @@
+#pragma once
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "syscall.h"
+
+// Stopwatch measures the time since its construction.
+struct Stopwatch {
+  unsigned long start_tick, timer_freq;
+
+  Stopwatch() {
+    auto res = SyscallGetCurrentTick();
+    start_tick = res.value;
+    timer_freq = res.error;
+  }
+
+  unsigned long ElapsedMs() const {
+    auto now = SyscallGetCurrentTick().value;
+    return (now - start_tick) * 1000 / timer_freq;
+  }
+};
+
+// DevStat reads a statistics file of /dev, such as /dev/layerstat, whose lines
+// are "key value". The values are those at the time of Read.
+class DevStat {
+ public:
+  explicit DevStat(const char* path) : path_{path} {}
+
+  // Reads the file again. Returns false if it cannot be read.
+  bool Read() {
+    size_t len = 0;
+    auto [fd, err] = SyscallOpenFile(path_, O_RDONLY);
+    while (!err && len < sizeof(text_) - 1) {
+      auto [n, err_read] = SyscallReadFile(fd, &text_[len],
+                                           sizeof(text_) - 1 - len);
+      if (err_read || n == 0) {
+        break;
+      }
+      len += n;
+    }
+    text_[len] = '\0';
+    return len > 0;
+  }
+
+  // Returns the value of key as a number, or 0 if there is no such key.
+  unsigned long Get(const char* key) const {
+    const char* value = Find(key);
+    return value ? strtoul(value, nullptr, 10) : 0;
+  }
+
+  // Returns the value of key as a string, or "" if there is no such key. The
+  // result is valid until the next call.
+  const char* GetString(const char* key) {
+    const char* value = Find(key);
+    const size_t n =
+        value ? std::min(strcspn(value, "\n"), sizeof(string_) - 1) : 0;
+    strncpy(string_, value ? value : "", n);
+    string_[n] = '\0';
+    return string_;
+  }
+
+ private:
+  const char* Find(const char* key) const {
+    const size_t key_len = strlen(key);
+    for (const char* line = text_; *line;) {
+      if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ') {
+        return line + key_len + 1;
+      }
+      const char* end = strchr(line, '\n');
+      if (end == nullptr) {
+        break;
+      }
+      line = end + 1;
+    }
+    return nullptr;
+  }
+
+  const char* path_;
+  char text_[1024] = "";
+  char string_[64];
+};
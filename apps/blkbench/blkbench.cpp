@@ -0,0 +1,89 @@
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../bench.hpp"
+#include "../syscall.h"
+
+namespace {
+
+const size_t kRequestBytes = 4096;
+const size_t kTotalBytes = 16 * 1024 * 1024;
+
+// Writes a command such as "depth 32" to /dev/blkctl.
+bool SetBlk(const char* key, size_t value) {
+  auto [fd, err] = SyscallOpenFile("/dev/blkctl", O_WRONLY);
+  if (err) {
+    return false;
+  }
+  char command[32];
+  sprintf(command, "%s %lu", key, value);
+  return SyscallPutString(fd, command, strlen(command)).value > 0;
+}
+
+// Reads up to 16 MiB from the start of /dev/blk in 4 KiB requests, with up to
+// depth of them in flight, and prints the throughput and how many requests,
+// notifications and interrupts the driver needed.
+int BenchDepth(size_t depth) {
+  if (!SetBlk("request_bytes", kRequestBytes) || !SetBlk("depth", depth)) {
+    printf("blkbench: cannot configure /dev/blkctl\n");
+    return 1;
+  }
+  auto [fd, err] = SyscallOpenFile("/dev/blk", O_RDONLY);
+  if (err) {
+    printf("blkbench: cannot open /dev/blk: %d\n", err);
+    return 1;
+  }
+  // as large as the buffer /dev/blk reads the device into
+  std::vector<char> buf(256 * 1024);
+  DevStat stat_start{"/dev/blkstat"}, stat_end{"/dev/blkstat"};
+  stat_start.Read();
+
+  Stopwatch sw;
+  size_t total = 0;
+  while (total < kTotalBytes) {
+    auto [n, err_read] = SyscallReadFile(fd, buf.data(), buf.size());
+    if (err_read || n == 0) {
+      break;
+    }
+    total += n;
+  }
+  const unsigned long ms = std::max(1ul, sw.ElapsedMs());
+  stat_end.Read();
+
+  auto delta = [&](const char* key) {
+    return stat_end.Get(key) - stat_start.Get(key);
+  };
+  const unsigned long kib = total / 1024;
+  printf("depth %2lu: %lu KiB in %lu ms, %lu KiB/s\n", depth, kib, ms,
+         kib * 1000 / ms);
+  printf("  %lu requests, %lu notifications, %lu interrupts\n",
+         delta("requests"), delta("notifications"), delta("interrupts"));
+  return 0;
+}
+
+}  // namespace
+
+// usage: blkbench [depth]
+//
+// Without a depth, compares reading with one request in flight to reading
+// with 32.
+extern "C" void main(int argc, char** argv) {
+  int ret;
+  if (argc > 1) {
+    ret = BenchDepth(std::max(atoi(argv[1]), 1));
+  } else {
+    ret = BenchDepth(1);
+    if (ret == 0) {
+      ret = BenchDepth(32);
+    }
+  }
+  // leave the request shape to the driver again
+  SetBlk("request_bytes", 0);
+  SetBlk("depth", 0);
+  exit(ret);
+}
@@ -0,0 +1,38 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../bench.hpp"
+#include "../syscall.h"
+
+// Redraws a window covering the whole screen frames times and prints the time
+// per frame, which is dominated by the copy to the frame buffer.
+extern "C" void main(int argc, char** argv) {
+  const int frames = argc > 1 ? std::max(atoi(argv[1]), 1) : 100;
+
+  DevStat layerstat{"/dev/layerstat"};
+  if (!layerstat.Read()) {
+    printf("compbench: cannot read /dev/layerstat\n");
+    exit(1);
+  }
+  const int width = layerstat.Get("screen_width");
+  const int height = layerstat.Get("screen_height");
+
+  auto [layer_id, err_openwin] =
+      SyscallOpenWindow(width, height, 0, 0, "compbench");
+  if (err_openwin) {
+    exit(err_openwin);
+  }
+
+  Stopwatch sw;
+  for (int i = 0; i < frames; ++i) {
+    SyscallWinRedraw(layer_id | LAYER_PRESENT);
+  }
+  const unsigned long us = std::max(1ul, sw.ElapsedMs() * 1000);
+  SyscallCloseWindow(layer_id);
+
+  const unsigned long mib = 4ul * width * height * frames / (1024 * 1024);
+  printf("%d frames of %dx%d in %lu ms: %lu us/frame, %lu MiB/s\n", frames,
+         width, height, us / 1000, us / frames, mib * 1000000 / us);
+  exit(0);
+}
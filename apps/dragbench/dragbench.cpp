@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../bench.hpp"
+#include "../syscall.h"
+
+// Drags a window right and back by one pixel per frame and prints how many
+// pixels the compositor redrew per frame. A window with an opacity below 255
+// is blended with the layers below it.
+//
+// usage: dragbench [steps] [opacity]
+extern "C" void main(int argc, char** argv) {
+  const int steps = argc > 1 ? std::max(atoi(argv[1]), 2) : 200;
+  const int opacity = argc > 2 ? std::clamp(atoi(argv[2]), 0, 255) : 255;
+  const int x0 = 100, y0 = 100;
+
+  auto [layer_id, err_openwin] =
+      SyscallOpenWindow(200, 150, x0, y0, "dragbench");
+  if (err_openwin) {
+    exit(err_openwin);
+  }
+  SyscallWinFillRectangle(layer_id, 4, 24, 192, 122, 0x3080c0);
+  SyscallWinSetOpacity(layer_id, opacity);
+
+  DevStat stat_start{"/dev/layerstat"}, stat_end{"/dev/layerstat"};
+  if (!stat_start.Read()) {
+    printf("dragbench: cannot read /dev/layerstat\n");
+    SyscallCloseWindow(layer_id);
+    exit(1);
+  }
+
+  Stopwatch sw;
+  int x = x0;
+  for (int i = 0; i < steps; ++i) {
+    x += i < steps / 2 ? 1 : -1;
+    SyscallWinMove(layer_id | LAYER_PRESENT, x, y0);
+  }
+  const unsigned long ms = std::max(1ul, sw.ElapsedMs());
+  stat_end.Read();
+  SyscallCloseWindow(layer_id);
+
+  auto delta = [&](const char* key) {
+    return stat_end.Get(key) - stat_start.Get(key);
+  };
+  const unsigned long frames = std::max(1ul, delta("frames"));
+  printf("%d moves in %lu ms, %lu frames/s\n", steps, ms, frames * 1000 / ms);
+  printf("  %lu rects, %lu composed px, %lu layer px per frame\n",
+         delta("damage_rects") / frames, delta("composed_pixels") / frames,
+         delta("layer_pixels") / frames);
+  printf("  window 200x150, opacity %d, %s blit kernels\n", opacity,
+         stat_end.GetString("blit"));
+  exit(0);
+}
@@ -0,0 +1,115 @@
+#include <fcntl.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "../syscall.h"
+
+namespace {
+
+const char* name_pattern = nullptr;
+bool long_format = false;
+
+void PrintEntry(const std::string& path, const AppDirEntry& entry) {
+  if (name_pattern && strstr(entry.name, name_pattern) == nullptr) {
+    return;
+  }
+  if (!long_format) {
+    printf("%s\n", path.c_str());
+    return;
+  }
+
+  AppFileStat stat{};
+  SyscallStat(path.c_str(), &stat);
+  // FAT dates count years from 1980
+  printf("%c %10lu %04d-%02d-%02d %02d:%02d %s\n",
+         entry.type == kAppFileDirectory ? 'd'
+         : entry.type == kAppFileDevice  ? 'c'
+                                         : '-',
+         static_cast<unsigned long>(entry.size),
+         stat.write_date ? 1980 + (stat.write_date >> 9) : 0,
+         (stat.write_date >> 5) & 0xf, stat.write_date & 0x1f,
+         stat.write_time >> 11, (stat.write_time >> 5) & 0x3f, path.c_str());
+}
+
+// Prints the entries under dir, reading many entries per system call.
+void Walk(const std::string& dir) {
+  auto res = SyscallOpenFile(dir.c_str(), O_RDONLY);
+  if (res.error) {
+    fprintf(stderr, "failed to open %s: %d\n", dir.c_str(), res.error);
+    return;
+  }
+  const int fd = res.value;
+
+  alignas(8) static char buf[4096];
+  while (true) {
+    auto n = SyscallReadDirectory(fd, buf, sizeof(buf));
+    if (n.error) {
+      fprintf(stderr, "failed to read %s: %d\n", dir.c_str(), n.error);
+      return;
+    } else if (n.value == 0) {
+      return;
+    }
+
+    // buf is reused by the recursive calls, so subdirectories are visited
+    // after the whole batch is printed
+    std::string subdirs;
+    for (size_t off = 0; off < n.value;) {
+      auto& entry = *reinterpret_cast<AppDirEntry*>(&buf[off]);
+      off += entry.reclen;
+      if (strcmp(entry.name, ".") == 0 || strcmp(entry.name, "..") == 0) {
+        continue;
+      }
+
+      auto path = dir == "/" ? dir + entry.name : dir + "/" + entry.name;
+      PrintEntry(path, entry);
+      if (entry.type == kAppFileDirectory) {
+        subdirs.append(path);
+        subdirs.push_back('\0');
+      }
+    }
+
+    for (size_t off = 0; off < subdirs.size();) {
+      std::string path{&subdirs[off]};
+      off += path.size() + 1;
+      Walk(path);
+    }
+  }
+}
+
+}  // namespace
+
+extern "C" void main(int argc, char** argv) {
+  const char* dir = "/";
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-name") == 0 && i + 1 < argc) {
+      name_pattern = argv[++i];
+    } else if (strcmp(argv[i], "-l") == 0) {
+      long_format = true;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Usage: %s [<dir>] [-name <substring>] [-l]\n",
+              argv[0]);
+      exit(1);
+    } else {
+      dir = argv[i];
+    }
+  }
+
+  AppFileStat stat;
+  if (auto res = SyscallStat(dir, &stat); res.error) {
+    fprintf(stderr, "no such directory: %s\n", dir);
+    exit(1);
+  } else if (stat.type != kAppFileDirectory) {
+    fprintf(stderr, "%s is not a directory\n", dir);
+    exit(1);
+  }
+
+  std::string root{dir};
+  while (root.size() > 1 && root.back() == '/') {
+    root.pop_back();
+  }
+  Walk(root);
+  exit(0);
+}
@@ -0,0 +1,312 @@
+#include <fcntl.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../syscall.h"
+
+namespace {
+
+struct Stopwatch {
+  unsigned long start_tick, timer_freq;
+
+  Stopwatch() {
+    auto res = SyscallGetCurrentTick();
+    start_tick = res.value;
+    timer_freq = res.error;
+  }
+
+  unsigned long ElapsedMs() const {
+    auto now = SyscallGetCurrentTick().value;
+    return (now - start_tick) * 1000 / timer_freq;
+  }
+};
+
+void PrintResult(const char* label, int ops, unsigned long ms) {
+  if (ms == 0) {
+    printf("%-24s %6d ops in <%lu ms\n", label, ops,
+           1000 / SyscallGetCurrentTick().error);
+  } else {
+    printf("%-24s %6d ops in %4lu ms (%lu ops/s)\n", label, ops, ms,
+           ops * 1000 / ms);
+  }
+}
+
+// Creates <num_files> entries in the root directory, then measures the cost
+// of looking them up and of looking up names which do not exist. With
+// long_names, the names need long name entries.
+int BenchLookup(int num_files, bool long_names) {
+  const char* hit_format =
+      long_names ? "lookup-benchmark-%06d.data" : "LK%06d.DAT";
+  const char* miss_format =
+      long_names ? "missing-benchmark-%06d.data" : "MS%06d.DAT";
+  char name[32];
+
+  Stopwatch sw_create;
+  for (int i = 0; i < num_files; ++i) {
+    sprintf(name, hit_format, i);
+    if (auto res = SyscallOpenFile(name, O_RDONLY); res.error == 0) {
+      continue;
+    }
+    if (auto res = SyscallOpenFile(name, O_CREAT | O_WRONLY); res.error) {
+      printf("failed to create %s: %d\n", name, res.error);
+      return 1;
+    }
+  }
+  PrintResult("create", num_files, sw_create.ElapsedMs());
+
+  Stopwatch sw_hit;
+  for (int i = 0; i < num_files; ++i) {
+    sprintf(name, hit_format, i);
+    if (SyscallOpenFile(name, O_RDONLY).error) {
+      printf("failed to find %s\n", name);
+      return 1;
+    }
+  }
+  PrintResult("lookup (hit)", num_files, sw_hit.ElapsedMs());
+
+  for (int round = 0; round < 3; ++round) {
+    Stopwatch sw_miss;
+    for (int i = 0; i < num_files; ++i) {
+      sprintf(name, miss_format, i);
+      if (SyscallOpenFile(name, O_RDONLY).error == 0) {
+        printf("unexpectedly found %s\n", name);
+        return 1;
+      }
+    }
+    PrintResult(round == 0 ? "lookup (miss, cold)" : "lookup (miss, warm)",
+                num_files, sw_miss.ElapsedMs());
+  }
+  return 0;
+}
+
+// Creates a file of <mib> MiB filled with a byte pattern, writing
+// <chunk_kib> KiB per system call, and prints the write throughput.
+int MakeFile(const char* path, int mib, int chunk_kib) {
+  auto res = SyscallOpenFile(path, O_CREAT | O_WRONLY | O_TRUNC);
+  if (res.error) {
+    printf("failed to open %s: %d\n", path, res.error);
+    return 1;
+  }
+  const int fd = res.value;
+
+  chunk_kib = chunk_kib > 0 ? chunk_kib : 4;
+  const size_t chunk_bytes = static_cast<size_t>(chunk_kib) * 1024;
+  char* buf = reinterpret_cast<char*>(malloc(chunk_bytes));
+  if (buf == nullptr) {
+    printf("failed to allocate %d KiB\n", chunk_kib);
+    return 1;
+  }
+  const int num_chunks = mib * 1024 / chunk_kib;
+  Stopwatch sw;
+  for (int i = 0; i < num_chunks; ++i) {
+    memset(buf, 'a' + i % 26, chunk_bytes);
+    if (SyscallPutString(fd, buf, chunk_bytes).error) {
+      printf("failed to write %s\n", path);
+      return 1;
+    }
+  }
+  const auto ms = sw.ElapsedMs();
+  char label[32];
+  sprintf(label, "write %dKiB", chunk_kib);
+  PrintResult(label, num_chunks, ms);
+  if (ms > 0) {
+    printf("%lu KiB/s\n", static_cast<unsigned long>(num_chunks) *
+                               chunk_kib * 1000 / ms);
+  }
+  free(buf);
+  return 0;
+}
+
+// Maps <path> and touches every page from the end of the file to the head,
+// which forces one page fault (and one offset->cluster translation) per page.
+int BenchMapReverse(const char* path) {
+  auto res = SyscallOpenFile(path, O_RDONLY);
+  if (res.error) {
+    printf("failed to open %s: %d\n", path, res.error);
+    return 1;
+  }
+  size_t file_size;
+  res = SyscallMapFile(res.value, &file_size, 0);
+  if (res.error) {
+    printf("failed to map %s: %d\n", path, res.error);
+    return 1;
+  }
+  const char* p = reinterpret_cast<const char*>(res.value);
+
+  const int num_pages = (file_size + 4095) / 4096;
+  unsigned long sum = 0;
+  Stopwatch sw;
+  for (int i = num_pages - 1; i >= 0; --i) {
+    sum += p[static_cast<size_t>(i) * 4096];
+  }
+  PrintResult("mmap touch (reverse)", num_pages, sw.ElapsedMs());
+  printf("checksum %lu\n", sum);
+  return 0;
+}
+
+void PrintThroughput(const char* label, size_t bytes, unsigned long ms) {
+  printf("%-24s %6lu KiB in %4lu ms", label,
+         static_cast<unsigned long>(bytes / 1024), ms);
+  if (ms > 0) {
+    printf(" (%lu KiB/s)",
+           static_cast<unsigned long>(bytes / 1024 * 1000 / ms));
+  }
+  printf("\n");
+}
+
+// Updates every 64th byte of <path> in place twice: once by reading and
+// writing the file back chunk by chunk, and once through a shared mapping
+// which is written back by SyscallSyncMappedFile.
+int BenchUpdateInPlace(const char* path) {
+  auto res = SyscallOpenFile(path, O_RDWR);
+  if (res.error) {
+    printf("failed to open %s: %d\n", path, res.error);
+    return 1;
+  }
+  const int rw_fd = res.value;
+
+  // SyscallPutString writes at most 1 KiB at a time
+  static char buf[1024];
+  size_t rw_bytes = 0;
+  char first_byte = 0;
+  Stopwatch sw_rw;
+  while (true) {
+    auto n = SyscallReadFile(rw_fd, buf, sizeof(buf));
+    if (n.error || n.value == 0) {
+      break;
+    }
+    if (rw_bytes == 0) {
+      first_byte = buf[0];
+    }
+    for (size_t i = 0; i < n.value; i += 64) {
+      ++buf[i];
+    }
+    if (SyscallPutString(rw_fd, buf, n.value).error) {
+      printf("failed to write %s\n", path);
+      return 1;
+    }
+    rw_bytes += n.value;
+  }
+  PrintThroughput("update (read+write)", rw_bytes, sw_rw.ElapsedMs());
+
+  res = SyscallOpenFile(path, O_RDWR);
+  if (res.error) {
+    printf("failed to open %s: %d\n", path, res.error);
+    return 1;
+  }
+  size_t file_size;
+  res = SyscallMapFile(res.value, &file_size, kAppMapShared);
+  if (res.error) {
+    printf("failed to map %s: %d\n", path, res.error);
+    return 1;
+  }
+  char* p = reinterpret_cast<char*>(res.value);
+
+  Stopwatch sw_map;
+  for (size_t i = 0; i < file_size; i += 64) {
+    ++p[i];
+  }
+  if (auto sync = SyscallSyncMappedFile(p, file_size); sync.error) {
+    printf("failed to sync %s: %d\n", path, sync.error);
+    return 1;
+  }
+  PrintThroughput("update (mmap+sync)", file_size, sw_map.ElapsedMs());
+
+  // a fresh descriptor sees both updates
+  res = SyscallOpenFile(path, O_RDONLY);
+  if (res.error || SyscallReadFile(res.value, buf, 1).value != 1) {
+    printf("failed to read back %s\n", path);
+    return 1;
+  }
+  if (buf[0] != static_cast<char>(first_byte + 2)) {
+    printf("first byte is %d, expected %d\n", buf[0], first_byte + 2);
+    return 1;
+  }
+  return 0;
+}
+
+// Mimics a script of <num_files> redirected commands: each one creates a file
+// in <dir>, writes it a line at a time, and the file is read back as a later
+// command's input would be. Run it on / and on /tmp to compare FAT and tmpfs.
+int BenchRedirect(const char* dir, int num_files, int num_lines) {
+  char path[64];
+  char line[80];
+  int num_bytes = 0;
+
+  Stopwatch sw_write;
+  for (int i = 0; i < num_files; ++i) {
+    sprintf(path, "%s/RD%06d.TXT", dir, i);
+    auto res = SyscallOpenFile(path, O_CREAT | O_WRONLY);
+    if (res.error) {
+      printf("failed to create %s: %d\n", path, res.error);
+      return 1;
+    }
+    for (int j = 0; j < num_lines; ++j) {
+      const int len = sprintf(line, "line %06d of output %06d\n", j, i);
+      if (SyscallPutString(res.value, line, len).error) {
+        printf("failed to write %s\n", path);
+        return 1;
+      }
+      num_bytes += len;
+    }
+  }
+  PrintResult("redirect (create+write)", num_files, sw_write.ElapsedMs());
+
+  static char buf[4096];
+  int num_read = 0;
+  Stopwatch sw_read;
+  for (int i = 0; i < num_files; ++i) {
+    sprintf(path, "%s/RD%06d.TXT", dir, i);
+    auto res = SyscallOpenFile(path, O_RDONLY);
+    if (res.error) {
+      printf("failed to open %s: %d\n", path, res.error);
+      return 1;
+    }
+    while (true) {
+      auto n = SyscallReadFile(res.value, buf, sizeof(buf));
+      if (n.error || n.value == 0) {
+        break;
+      }
+      num_read += n.value;
+    }
+  }
+  PrintResult("redirect (read back)", num_files, sw_read.ElapsedMs());
+
+  if (num_read != num_bytes) {
+    printf("read %d bytes, expected %d\n", num_read, num_bytes);
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+extern "C" void main(int argc, char** argv) {
+  if (argc < 2) {
+    printf("Usage: %s lookup [num_files] [long]\n", argv[0]);
+    printf("       %s mkfile <path> <mib> [chunk_kib]\n", argv[0]);
+    printf("       %s mmaprev <path>\n", argv[0]);
+    printf("       %s update <path>\n", argv[0]);
+    printf("       %s redirect <dir> [num_files] [num_lines]\n", argv[0]);
+    exit(1);
+  }
+
+  if (strcmp(argv[1], "lookup") == 0) {
+    exit(BenchLookup(argc >= 3 ? atoi(argv[2]) : 2000,
+                     argc >= 4 && strcmp(argv[3], "long") == 0));
+  } else if (strcmp(argv[1], "mkfile") == 0 && argc >= 4) {
+    exit(MakeFile(argv[2], atoi(argv[3]), argc >= 5 ? atoi(argv[4]) : 4));
+  } else if (strcmp(argv[1], "mmaprev") == 0 && argc >= 3) {
+    exit(BenchMapReverse(argv[2]));
+  } else if (strcmp(argv[1], "update") == 0 && argc >= 3) {
+    exit(BenchUpdateInPlace(argv[2]));
+  } else if (strcmp(argv[1], "redirect") == 0 && argc >= 3) {
+    exit(BenchRedirect(argv[2], argc >= 4 ? atoi(argv[3]) : 200,
+                       argc >= 5 ? atoi(argv[4]) : 64));
+  }
+
+  printf("unknown benchmark: %s\n", argv[1]);
+  exit(1);
+}
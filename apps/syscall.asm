@@ -25,4 +25,11 @@ define_syscall CreateTimer,      0x8000000b
 define_syscall OpenFile,         0x8000000c
 define_syscall ReadFile,         0x8000000d
 define_syscall DemandPages,      0x8000000e
-define_syscall MapFile,          0x8000000f
\ No newline at end of file
+define_syscall MapFile,          0x8000000f
+define_syscall ReadDirectory,    0x80000010
+define_syscall Stat,             0x80000011
+define_syscall FStat,            0x80000012
+define_syscall SyncMappedFile,   0x80000013
+define_syscall UnmapFile,        0x80000014
+define_syscall WinMove,          0x80000015
+define_syscall WinSetOpacity,    0x80000016
@@ -1,3 +1,5 @@
+#pragma once
+
 #ifdef __cplusplus
 #include <cstddef>
 #include <cstdint>
@@ -9,6 +11,7 @@ extern "C" {
 #endif
 
 #include "../kernel/app_event.hpp"
+#include "../kernel/app_file.hpp"
 #include "../kernel/logger.hpp"
 
 struct SyscallResult {
@@ -22,6 +25,9 @@ void SyscallExit(int exit_code);
 struct SyscallResult SyscallOpenWindow(int w, int h, int x, int y,
                                        const char* title);
 #define LAYER_NO_REDRAW (0x00000001ull << 32)
+// Composes the screen before a window function or SyscallWinMove returns,
+// instead of at the next frame.
+#define LAYER_PRESENT (0x00000002ull << 32)
 struct SyscallResult SyscallWinWriteString(uint64_t layer_id_flags, int x,
                                            int y, uint32_t color,
                                            const char* s);
@@ -42,6 +48,21 @@ struct SyscallResult SyscallOpenFile(const char* path, int flags);
 struct SyscallResult SyscallReadFile(int fd, void* buf, size_t count);
 struct SyscallResult SyscallDemandPages(size_t num_pages, int flags);
 struct SyscallResult SyscallMapFile(int fd, size_t* file_size, int flags);
+// Fills buf with AppDirEntry records of a directory opened by SyscallOpenFile
+// and returns the number of bytes filled, 0 at the end of the directory.
+struct SyscallResult SyscallReadDirectory(int fd, void* buf, size_t len);
+struct SyscallResult SyscallStat(const char* path, struct AppFileStat* stat);
+struct SyscallResult SyscallFStat(int fd, struct AppFileStat* stat);
+// Writes the modified pages of a shared mapping in [addr, addr + len) to the
+// file.
+struct SyscallResult SyscallSyncMappedFile(void* addr, size_t len);
+// Writes back the mapping which contains addr and unmaps it.
+struct SyscallResult SyscallUnmapFile(void* addr);
+// Moves the window so that its top left corner is at (x, y) of the screen.
+struct SyscallResult SyscallWinMove(uint64_t layer_id_flags, int x, int y);
+// Sets the opacity of the window from 0 (transparent) to 255 (opaque).
+struct SyscallResult SyscallWinSetOpacity(uint64_t layer_id_flags,
+                                          int opacity);
 
 #ifdef __cplusplus
 }  // extern "C"
@@ -0,0 +1,47 @@
+#pragma once
+
+#ifdef __cplusplus
+#include <cstdint>
+
+extern "C" {
+#else
+#include <stdint.h>
+#endif
+
+enum AppFileType {
+  kAppFileRegular,
+  kAppFileDirectory,
+  kAppFileDevice,
+};
+
+struct AppFileStat {
+  uint64_t size;
+  enum AppFileType type;
+  uint8_t attr;  // FAT attribute bits, 0 on other file systems
+  // FAT encoded dates and times, 0 if the file system does not record them
+  uint16_t create_date, create_time;
+  uint16_t write_date, write_time;
+  uint16_t access_date;
+};
+
+// Flags of SyscallMapFile. Stores to a shared mapping are written to the file
+// by SyscallSyncMappedFile, SyscallUnmapFile and on exit, while those to a
+// private mapping stay in memory.
+enum AppMapFlags {
+  kAppMapPrivate = 0,
+  kAppMapShared = 1,
+};
+
+// A record filled by SyscallReadDirectory. Records are packed one after
+// another, each starting at a multiple of 8 bytes.
+struct AppDirEntry {
+  uint16_t reclen;   // bytes to the next record
+  uint16_t namelen;  // length of name, excluding the null character
+  enum AppFileType type;
+  uint64_t size;
+  char name[];  // null-terminated
+};
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
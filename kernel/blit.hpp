@@ -0,0 +1,58 @@
+/**
+ * @file blit.hpp
+ *
+ * Row kernels which copy and fill 32 bit pixels, chosen for the CPU at boot.
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace blit {
+
+enum class ISA {
+  kScalar,
+  kSSE2,
+  kAVX2,
+};
+
+/** @brief Selects the fastest kernels the CPU and the OS state allow.
+ *
+ * SSE2 is part of x86-64. AVX2 is used only if the firmware left the YMM
+ * state enabled in XCR0. Task switches save the XMM state with fxsave, so the
+ * AVX2 kernels mask interrupts for each row and leave no YMM state behind.
+ */
+void Initialize();
+/** @brief Returns true if the kernels of isa can run on this CPU. */
+bool Supported(ISA isa);
+/** @brief Selects the kernels of isa, which must be supported. */
+void Select(ISA isa);
+ISA Selected();
+const char* Name(ISA isa);
+
+/** @brief Copies n pixels. The rows must not overlap.
+ *
+ * With non_temporal, the stores bypass the cache, which suits the hardware
+ * frame buffer: it is written once and never read back. Call Fence after the
+ * last non-temporal row.
+ */
+void CopyRow(uint32_t* dst, const uint32_t* src, int n, bool non_temporal);
+/** @brief Stores pixel to n pixels. */
+void FillRow(uint32_t* dst, uint32_t pixel, int n, bool non_temporal);
+/** @brief Copies the pixels of src whose color, the low 24 bits, is not key.
+ */
+void CopyKeyedRow(uint32_t* dst, const uint32_t* src, int n, uint32_t key);
+/** @brief Key of CopyKeyedRow and BlendRow which no color matches. */
+const uint32_t kNoKey = 0xffffffffu;
+
+/** @brief Blends n pixels of src over dst and scales src by opacity first.
+ *
+ * The reserved byte of a src pixel holds 255 - alpha, and its color is
+ * premultiplied by alpha. Pixels written without alpha are thus opaque. The
+ * result is opaque. Pixels whose color is key are skipped as in CopyKeyedRow.
+ */
+void BlendRow(uint32_t* dst, const uint32_t* src, int n, uint8_t opacity,
+              uint32_t key);
+/** @brief Orders the non-temporal stores before any later store. */
+void Fence();
+
+}  // namespace blit
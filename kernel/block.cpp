@@ -0,0 +1,271 @@
+#include "block.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "logger.hpp"
+
+RAMDisk::RAMDisk(void* base, uint64_t num_blocks, size_t block_size)
+    : base_{reinterpret_cast<uint8_t*>(base)},
+      num_blocks_{num_blocks},
+      block_size_{block_size} {}
+
+Error RAMDisk::Read(uint64_t lba, void* buf, size_t num_blocks) {
+  if (lba + num_blocks > num_blocks_) {
+    return MAKE_ERROR(Error::kIndexOutOfRange);
+  }
+  memcpy(buf, &base_[lba * block_size_], num_blocks * block_size_);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error RAMDisk::Write(uint64_t lba, const void* buf, size_t num_blocks) {
+  if (lba + num_blocks > num_blocks_) {
+    return MAKE_ERROR(Error::kIndexOutOfRange);
+  }
+  memcpy(&base_[lba * block_size_], buf, num_blocks * block_size_);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+BufferCache::BufferCache(BlockDevice& dev, uint64_t base_lba,
+                         size_t blocks_per_buffer, size_t max_buffers)
+    : dev_{dev},
+      base_lba_{base_lba},
+      blocks_per_buffer_{blocks_per_buffer},
+      buffer_bytes_{blocks_per_buffer * dev.BlockSize()},
+      max_buffers_{max_buffers} {}
+
+BufferCache::~BufferCache() {
+  if (auto err = Flush()) {
+    Log(kError, "failed to flush buffer cache: %s\n", err.Name());
+  }
+}
+
+WithError<uint8_t*> BufferCache::Get(uint64_t index, bool metadata) {
+  auto [it, err] = Lookup(index, true);
+  if (err) {
+    return {nullptr, err};
+  }
+  it->metadata |= metadata;
+  return {it->data.get(), MAKE_ERROR(Error::kSuccess)};
+}
+
+WithError<uint8_t*> BufferCache::GetForOverwrite(uint64_t index,
+                                                 bool metadata) {
+  auto [it, err] = Lookup(index, false);
+  if (err) {
+    return {nullptr, err};
+  }
+  it->metadata |= metadata;
+  return {it->data.get(), MAKE_ERROR(Error::kSuccess)};
+}
+
+void BufferCache::Pin(const void* addr) {
+  auto it = FindByAddr(addr);
+  if (it == lru_.end()) {
+    return;
+  }
+  if (it->pins++ == 0) {
+    --num_unpinned_;
+  }
+}
+
+void BufferCache::Unpin(const void* addr) {
+  auto it = FindByAddr(addr);
+  if (it == lru_.end() || it->pins == 0) {
+    return;
+  }
+  if (--it->pins == 0) {
+    ++num_unpinned_;
+  }
+}
+
+WithError<std::pair<uint64_t, size_t>> BufferCache::Locate(
+    const void* addr) {
+  auto it = FindByAddr(addr);
+  if (it == lru_.end()) {
+    return {{0, 0}, MAKE_ERROR(Error::kNoSuchEntry)};
+  }
+  const auto offset = reinterpret_cast<const uint8_t*>(addr) - it->data.get();
+  return {{it->index, static_cast<size_t>(offset)},
+          MAKE_ERROR(Error::kSuccess)};
+}
+
+Error BufferCache::Prefetch(uint64_t first, size_t count) {
+  // leave most of the cache to buffers which are in use
+  count = std::min(count, max_buffers_ / 2);
+
+  const uint64_t end = first + count;
+  for (uint64_t i = first; i < end;) {
+    if (index_map_.count(i)) {
+      ++i;
+      continue;
+    }
+    uint64_t run_end = i + 1;
+    while (run_end < end && index_map_.count(run_end) == 0) {
+      ++run_end;
+    }
+
+    const size_t n = run_end - i;
+    auto run = std::make_unique<uint8_t[]>(n * buffer_bytes_);
+    if (auto err = dev_.Read(base_lba_ + i * blocks_per_buffer_, run.get(),
+                             n * blocks_per_buffer_)) {
+      return err;
+    }
+    for (size_t k = 0; k < n; ++k) {
+      if (auto err = EvictIfFull()) {
+        return err;
+      }
+      Buffer buf{i + k, std::make_unique<uint8_t[]>(buffer_bytes_), false,
+                 false, 0, true};
+      memcpy(buf.data.get(), &run[k * buffer_bytes_], buffer_bytes_);
+      Insert(std::move(buf));
+      ++stat_.readahead;
+    }
+    i = run_end;
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error BufferCache::WriteThrough(uint64_t first, size_t count,
+                                const void* buf) {
+  if (!dev_.CanTransfer(buf, count * buffer_bytes_)) {
+    return MAKE_ERROR(Error::kNotIdentityMapped);
+  }
+  if (auto err = dev_.Write(base_lba_ + first * blocks_per_buffer_, buf,
+                            count * blocks_per_buffer_)) {
+    return err;
+  }
+
+  auto src = reinterpret_cast<const uint8_t*>(buf);
+  for (auto it = index_map_.lower_bound(first);
+       it != index_map_.end() && it->first < first + count; ++it) {
+    auto& cached = *it->second;
+    memcpy(cached.data.get(), &src[(it->first - first) * buffer_bytes_],
+           buffer_bytes_);
+    cached.dirty = false;
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+void BufferCache::MarkDirty(const void* addr) {
+  if (auto it = FindByAddr(addr); it != lru_.end()) {
+    it->dirty = true;
+  }
+}
+
+Error BufferCache::Flush() {
+  for (auto& buf : lru_) {
+    if (auto err = WriteBack(buf)) {
+      return err;
+    }
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error BufferCache::FlushData() {
+  for (auto& buf : lru_) {
+    if (buf.metadata) {
+      continue;
+    }
+    if (auto err = WriteBack(buf)) {
+      return err;
+    }
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+std::vector<std::pair<uint64_t, const uint8_t*>>
+BufferCache::DirtyMetadata() const {
+  std::vector<std::pair<uint64_t, const uint8_t*>> bufs;
+  for (auto& [index, it] : index_map_) {
+    if (it->metadata && it->dirty) {
+      bufs.emplace_back(index, it->data.get());
+    }
+  }
+  return bufs;
+}
+
+WithError<std::list<BufferCache::Buffer>::iterator> BufferCache::Lookup(
+    uint64_t index, bool read) {
+  if (auto it = index_map_.find(index); it != index_map_.end()) {
+    ++stat_.hits;
+    if (it->second->readahead) {
+      it->second->readahead = false;
+      ++stat_.readahead_hits;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return {it->second, MAKE_ERROR(Error::kSuccess)};
+  }
+  ++stat_.misses;
+
+  if (auto err = EvictIfFull()) {
+    return {lru_.end(), err};
+  }
+
+  Buffer buf{index, std::make_unique<uint8_t[]>(buffer_bytes_), false, false,
+             0, false};
+  if (read) {
+    const auto lba = base_lba_ + index * blocks_per_buffer_;
+    if (auto err = dev_.Read(lba, buf.data.get(), blocks_per_buffer_)) {
+      return {lru_.end(), err};
+    }
+  }
+  return {Insert(std::move(buf)), MAKE_ERROR(Error::kSuccess)};
+}
+
+std::list<BufferCache::Buffer>::iterator BufferCache::FindByAddr(
+    const void* addr) {
+  const auto a = reinterpret_cast<uintptr_t>(addr);
+  auto it = addr_map_.upper_bound(a);
+  if (it == addr_map_.begin()) {
+    return lru_.end();
+  }
+  --it;
+  return a < it->first + buffer_bytes_ ? it->second : lru_.end();
+}
+
+std::list<BufferCache::Buffer>::iterator BufferCache::Insert(Buffer&& buf) {
+  const auto index = buf.index;
+  lru_.push_front(std::move(buf));
+  index_map_[index] = lru_.begin();
+  addr_map_[reinterpret_cast<uintptr_t>(lru_.front().data.get())] =
+      lru_.begin();
+  ++num_unpinned_;
+  return lru_.begin();
+}
+
+Error BufferCache::WriteBack(Buffer& buf) {
+  if (!buf.dirty) {
+    return MAKE_ERROR(Error::kSuccess);
+  }
+  const auto lba = base_lba_ + buf.index * blocks_per_buffer_;
+  if (auto err = dev_.Write(lba, buf.data.get(), blocks_per_buffer_)) {
+    return err;
+  }
+  buf.dirty = false;
+  ++stat_.writebacks;
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error BufferCache::EvictIfFull() {
+  auto it = lru_.end();
+  while (num_unpinned_ >= max_buffers_ && it != lru_.begin()) {
+    --it;
+    // dirty metadata has to wait for Flush, which orders it after the data
+    if (it->pins > 0 || (it->metadata && it->dirty)) {
+      continue;
+    }
+    if (auto err = WriteBack(*it)) {
+      return err;
+    }
+    if (it->readahead) {
+      ++stat_.readahead_wasted;
+    }
+    index_map_.erase(it->index);
+    addr_map_.erase(reinterpret_cast<uintptr_t>(it->data.get()));
+    it = lru_.erase(it);
+    --num_unpinned_;
+    ++stat_.evictions;
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
@@ -0,0 +1,176 @@
+/**
+ * @file block.hpp
+ *
+ * Block device abstraction and the buffer cache which sits on top of it.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "error.hpp"
+
+/** @brief BlockDevice is a storage which is read and written in fixed size
+ * blocks.
+ */
+class BlockDevice {
+ public:
+  virtual ~BlockDevice() = default;
+  /** @brief Reads num_blocks blocks starting at lba into buf. */
+  virtual Error Read(uint64_t lba, void* buf, size_t num_blocks) = 0;
+  /** @brief Writes num_blocks blocks from buf starting at lba. */
+  virtual Error Write(uint64_t lba, const void* buf, size_t num_blocks) = 0;
+  /** @brief Makes completed writes durable. Devices without a volatile
+   * write cache need not override this.
+   */
+  virtual Error Flush() { return MAKE_ERROR(Error::kSuccess); }
+  /** @brief Returns the size of one block in bytes. */
+  virtual size_t BlockSize() const = 0;
+  /** @brief Returns the number of blocks of the device. */
+  virtual uint64_t NumBlocks() const = 0;
+  /** @brief Returns true if Read and Write can transfer to and from
+   * [buf, buf + bytes) directly. A device which uses DMA needs memory whose
+   * addresses are physical.
+   */
+  virtual bool CanTransfer(const void* buf, size_t bytes) const {
+    return true;
+  }
+};
+
+/** @brief RAMDisk is a block device backed by a memory region, such as the
+ * volume image the loader copies into memory.
+ */
+class RAMDisk : public BlockDevice {
+ public:
+  RAMDisk(void* base, uint64_t num_blocks, size_t block_size = 512);
+  Error Read(uint64_t lba, void* buf, size_t num_blocks) override;
+  Error Write(uint64_t lba, const void* buf, size_t num_blocks) override;
+  size_t BlockSize() const override { return block_size_; }
+  uint64_t NumBlocks() const override { return num_blocks_; }
+
+ private:
+  uint8_t* base_;
+  uint64_t num_blocks_;
+  size_t block_size_;
+};
+
+struct BufferCacheStat {
+  unsigned long hits, misses, evictions, writebacks;
+  // buffers read by Prefetch, those used later, and those evicted unused
+  unsigned long readahead, readahead_hits, readahead_wasted;
+};
+
+/** @brief BufferCache caches fixed size buffers of a block device region in
+ * memory and writes modified buffers back lazily.
+ *
+ * Buffer n covers blocks [base_lba + n * blocks_per_buffer,
+ * base_lba + (n + 1) * blocks_per_buffer). Unpinned buffers are evicted in
+ * least recently used order once more than max_buffers are cached. A buffer
+ * stays at the same address while it is pinned, so callers may keep pointers
+ * into it until they unpin it.
+ *
+ * Metadata buffers are written only by Flush, after FlushData has written
+ * the others, so that metadata never refers to data which is only in memory.
+ * They are evicted only when clean.
+ *
+ * The cache is not synchronized. A user shared by several tasks serializes
+ * its calls, e.g. with a Mutex.
+ */
+class BufferCache {
+ public:
+  BufferCache(BlockDevice& dev, uint64_t base_lba, size_t blocks_per_buffer,
+              size_t max_buffers);
+  ~BufferCache();
+
+  /** @brief Returns the buffer with the specified index, reading it from the
+   * device on a miss.
+   *
+   * @param index Buffer index
+   * @param metadata true if the buffer holds metadata
+   * @return Pointer to the buffer. The pointer of an unpinned buffer is valid
+   * until the next call to Get, GetForOverwrite or Prefetch.
+   */
+  WithError<uint8_t*> Get(uint64_t index, bool metadata = false);
+  /** @brief Returns the buffer without reading the device. The content of a
+   * newly cached buffer is zero-filled. Use this when the caller overwrites
+   * the whole buffer.
+   */
+  WithError<uint8_t*> GetForOverwrite(uint64_t index, bool metadata = false);
+  /** @brief Keeps the buffer containing the address in memory until a
+   * matching call to Unpin. Pins are counted.
+   */
+  void Pin(const void* addr);
+  /** @brief Releases a pin taken by Pin. */
+  void Unpin(const void* addr);
+  /** @brief Returns the index of the buffer containing the address and the
+   * offset of the address within it.
+   */
+  WithError<std::pair<uint64_t, size_t>> Locate(const void* addr);
+  /** @brief Reads buffers [first, first + count) ahead of their use.
+   *
+   * Buffers already cached are skipped. Each run of missing buffers is read
+   * with a single device request, so the device can work on the whole run
+   * at once.
+   */
+  Error Prefetch(uint64_t first, size_t count);
+  /** @brief Writes buffers [first, first + count) from buf to the device
+   * with a single request, bypassing the cache.
+   *
+   * Cached copies of the buffers are updated and become clean, so that later
+   * reads see the new content. Fails with kNotIdentityMapped if the device
+   * cannot transfer from buf.
+   */
+  Error WriteThrough(uint64_t first, size_t count, const void* buf);
+  /** @brief Marks the buffer containing the address as modified. */
+  void MarkDirty(const void* addr);
+  /** @brief Writes all modified buffers back to the device. */
+  Error Flush();
+  /** @brief Writes the modified buffers other than metadata back to the
+   * device, leaving metadata modified.
+   */
+  Error FlushData();
+  /** @brief Returns the indexes and the contents of the modified metadata
+   * buffers, in ascending order of index.
+   */
+  std::vector<std::pair<uint64_t, const uint8_t*>> DirtyMetadata() const;
+
+  size_t BufferBytes() const { return buffer_bytes_; }
+  BufferCacheStat Stat() const { return stat_; }
+
+ private:
+  struct Buffer {
+    uint64_t index;
+    std::unique_ptr<uint8_t[]> data;
+    bool dirty;
+    bool metadata;
+    unsigned int pins;
+    bool readahead;  // read by Prefetch and not used yet
+  };
+
+  BlockDevice& dev_;
+  uint64_t base_lba_;
+  size_t blocks_per_buffer_;
+  size_t buffer_bytes_;
+  size_t max_buffers_;
+  // front is the most recently used buffer
+  std::list<Buffer> lru_{};
+  size_t num_unpinned_{0};
+  std::map<uint64_t, std::list<Buffer>::iterator> index_map_{};
+  // key: address of the buffer data
+  std::map<uintptr_t, std::list<Buffer>::iterator> addr_map_{};
+  BufferCacheStat stat_{};
+
+  WithError<std::list<Buffer>::iterator> Lookup(uint64_t index, bool read);
+  /** @brief Returns the buffer containing the address, lru_.end() if none.
+   */
+  std::list<Buffer>::iterator FindByAddr(const void* addr);
+  std::list<Buffer>::iterator Insert(Buffer&& buf);
+  Error WriteBack(Buffer& buf);
+  Error EvictIfFull();
+};
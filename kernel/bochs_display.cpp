@@ -0,0 +1,162 @@
+#include "bochs_display.hpp"
+
+#include <algorithm>
+
+#include "asmfunc.h"
+#include "logger.hpp"
+#include "paging.hpp"
+
+namespace {
+const uint16_t kIOPortIndex = 0x1ce;
+const uint16_t kIOPortData = 0x1cf;
+// VGA input status #1 and its vertical retrace bit
+const uint16_t kIOPortInputStatus1 = 0x3da;
+const uint8_t kVerticalRetrace = 1u << 3;
+// a frame at 60 Hz is far shorter than this many port reads
+const int kMaxRetracePolls = 100000;
+// the DISPI registers in the MMIO BAR, 16 bits each
+const uint64_t kMMIOOffset = 0x500;
+
+const uint16_t kMinID = 0xb0c0;
+const uint16_t kMaxID = 0xb0cf;
+// double buffering needs no more
+const uint64_t kMaxPages = 2;
+
+uint64_t PageBytes(const FrameBufferConfig& config) {
+  return 4ul * config.pixels_per_scan_line * config.vertical_resolution;
+}
+}  // namespace
+
+namespace bochs {
+
+Device* device;
+
+Device::Device(uint64_t mmio_base, bool vga, const FrameBufferConfig& config)
+    : mmio_base_{mmio_base}, vga_{vga}, config_{config} {}
+
+Error Device::Initialize() {
+  const auto id = Read(kIndexID);
+  if (id < kMinID || id > kMaxID) {
+    return MAKE_ERROR(Error::kUnknownDevice);
+  }
+  if (Read(kIndexXRes) != config_.horizontal_resolution ||
+      Read(kIndexYRes) != config_.vertical_resolution ||
+      Read(kIndexBPP) != 32 ||
+      Read(kIndexVirtWidth) != config_.pixels_per_scan_line) {
+    return MAKE_ERROR(Error::kUnknownDevice);
+  }
+
+  // bochs-display takes the virtual height as written, std VGA derives it
+  // from the size of video memory
+  Write(kIndexVirtHeight, kMaxPages * config_.vertical_resolution);
+  const uint64_t vram_bytes = Read(kIndexVideoMemory64K) * 65536ul;
+  const uint64_t pages =
+      std::min({kMaxPages, vram_bytes / PageBytes(config_),
+                uint64_t{Read(kIndexVirtHeight)} /
+                    config_.vertical_resolution});
+  if (pages < 2) {
+    return MAKE_ERROR(Error::kBufferTooSmall);
+  }
+  num_pages_ = pages;
+
+  Write(kIndexXOffset, 0);
+  Show(0);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+FrameBufferConfig Device::PageConfig(int page) const {
+  FrameBufferConfig config = config_;
+  config.frame_buffer += page * PageBytes(config_);
+  return config;
+}
+
+void Device::Show(int page) {
+  WaitForRetrace();
+  Write(kIndexYOffset, page * config_.vertical_resolution);
+}
+
+void Device::WaitForRetrace() const {
+  if (!vga_) {
+    return;
+  }
+  // finish a retrace in progress first, as it may be about to end
+  int polls = 0;
+  while ((IoIn8(kIOPortInputStatus1) & kVerticalRetrace) &&
+         ++polls < kMaxRetracePolls) {
+  }
+  while (!(IoIn8(kIOPortInputStatus1) & kVerticalRetrace) &&
+         ++polls < kMaxRetracePolls) {
+  }
+}
+
+uint16_t Device::Read(uint16_t index) const {
+  if (mmio_base_) {
+    return *reinterpret_cast<volatile uint16_t*>(mmio_base_ + 2 * index);
+  }
+  IoOut16(kIOPortIndex, index);
+  return IoIn16(kIOPortData);
+}
+
+void Device::Write(uint16_t index, uint16_t value) {
+  if (mmio_base_) {
+    *reinterpret_cast<volatile uint16_t*>(mmio_base_ + 2 * index) = value;
+    return;
+  }
+  IoOut16(kIOPortIndex, index);
+  IoOut16(kIOPortData, value);
+}
+
+void Initialize(const FrameBufferConfig& config) {
+  pci::Device* vga_dev = nullptr;
+  for (int i = 0; i < pci::num_device; ++i) {
+    auto& dev = pci::devices[i];
+    if (pci::ReadVendorId(dev) == kVendorID &&
+        pci::ReadDeviceId(dev.bus, dev.device, dev.function) == kDeviceID) {
+      vga_dev = &dev;
+      break;
+    }
+  }
+  if (vga_dev == nullptr) {
+    return;
+  }
+
+  // the firmware's frame buffer must be the video memory of this device
+  const auto vram_bar = pci::ReadBar(*vga_dev, 0);
+  if (vram_bar.error ||
+      (vram_bar.value & ~0xfull) !=
+          reinterpret_cast<uint64_t>(config.frame_buffer)) {
+    return;
+  }
+
+  // enable memory space access
+  pci::WriteConfReg(*vga_dev, 0x04, pci::ReadConfReg(*vga_dev, 0x04) | 0x2u);
+
+  uint64_t mmio_base = 0;
+  const auto mmio_bar = pci::ReadBar(*vga_dev, 2);
+  if (!mmio_bar.error && (mmio_bar.value & 1u) == 0 &&
+      (mmio_bar.value & ~0xfull) != 0) {
+    mmio_base = (mmio_bar.value & ~0xfull) + kMMIOOffset;
+  }
+
+  // std VGA is a VGA compatible controller, bochs-display is not
+  const bool vga = vga_dev->class_code.Match(0x03u, 0x00u);
+  auto dev = new Device{mmio_base, vga, config};
+  if (auto err = dev->Initialize()) {
+    Log(kWarn, "bochs: no page flipping: %s at %s:%d\n", err.Name(),
+        err.File(), err.Line());
+    delete dev;
+    return;
+  }
+
+  // the first page is mapped with the rest of the firmware's frame buffer
+  const auto page_bytes = PageBytes(config);
+  if (auto err = MapWriteCombining(
+          reinterpret_cast<uint64_t>(config.frame_buffer) + page_bytes,
+          (dev->NumPages() - 1) * page_bytes)) {
+    Log(kWarn, "bochs: failed to map the pages write-combining: %s\n",
+        err.Name());
+  }
+  device = dev;
+}
+
+}  // namespace bochs
@@ -0,0 +1,74 @@
+/**
+ * @file bochs_display.hpp
+ *
+ * Driver of the Bochs VBE display interface of QEMU's std VGA and
+ * bochs-display devices.
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "display.hpp"
+#include "error.hpp"
+#include "pci.hpp"
+
+namespace bochs {
+
+const uint16_t kVendorID = 0x1234;
+const uint16_t kDeviceID = 0x1111;
+
+// indices of the DISPI registers
+const uint16_t kIndexID = 0x0;
+const uint16_t kIndexXRes = 0x1;
+const uint16_t kIndexYRes = 0x2;
+const uint16_t kIndexBPP = 0x3;
+const uint16_t kIndexVirtWidth = 0x6;
+const uint16_t kIndexVirtHeight = 0x7;
+const uint16_t kIndexXOffset = 0x8;
+const uint16_t kIndexYOffset = 0x9;
+const uint16_t kIndexVideoMemory64K = 0xa;
+
+/** @brief Device is the display the firmware set up, with its virtual screen
+ * stacked into pages.
+ *
+ * The pages lie one after another in video memory, and Show selects one by
+ * its Y offset. The registers are accessed through the MMIO BAR where the
+ * device has one, and through the I/O ports otherwise.
+ *
+ * Show waits for the vertical retrace on std VGA, so that the new page is
+ * scanned out from its top. bochs-display has no VGA registers to tell the
+ * retrace, and its flips may tear.
+ */
+class Device : public Display {
+ public:
+  /** @param mmio_base  address of the DISPI registers, or 0 to use the I/O
+   *    ports.
+   *  @param vga  true if the device decodes the legacy VGA registers. */
+  Device(uint64_t mmio_base, bool vga, const FrameBufferConfig& config);
+  /** @brief Checks that the firmware's frame buffer is the current mode of
+   * this device and finds how many pages fit in video memory. */
+  Error Initialize();
+
+  int NumPages() const override { return num_pages_; }
+  FrameBufferConfig PageConfig(int page) const override;
+  void Show(int page) override;
+
+ private:
+  uint64_t mmio_base_;
+  bool vga_;
+  FrameBufferConfig config_;
+  int num_pages_{1};
+
+  uint16_t Read(uint16_t index) const;
+  void Write(uint16_t index, uint16_t value);
+  /** @brief Polls the VGA input status until a vertical retrace begins. */
+  void WaitForRetrace() const;
+};
+
+extern Device* device;
+
+/** @brief Sets up device if the frame buffer is the one of a Bochs display
+ * with room for two pages. device stays null otherwise. */
+void Initialize(const FrameBufferConfig& config);
+
+}  // namespace bochs
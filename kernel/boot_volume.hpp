@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+/* The part of the boot volume the loader copied into memory. The loader
+ * copies only the reserved sectors and the FATs of a volume the kernel can
+ * read through its own driver; data clusters are then read on demand.
+ */
+struct BootVolume {
+  void* image;
+  unsigned long long image_bytes;  /* bytes copied into image */
+  unsigned long long volume_bytes; /* size of the whole volume */
+};
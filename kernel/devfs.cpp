@@ -0,0 +1,333 @@
+#include "devfs.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "blit.hpp"
+#include "fat.hpp"
+#include "graphics.hpp"
+#include "layer.hpp"
+#include "logger.hpp"
+#include "memory_manager.hpp"
+#include "virtio/blk.hpp"
+
+namespace {
+// both supported pixel formats use 4 bytes per pixel
+const size_t kBytesPerPixel = 4;
+
+/** @brief StatDescriptor reads a text generated when it is opened. Writes go
+ * to the handler of the file, if it has one.
+ */
+class StatDescriptor : public ::FileDescriptor {
+ public:
+  StatDescriptor(std::string text, devfs::StatVnode::Handler handle)
+      : text_{std::move(text)}, handle_{handle} {}
+  size_t Read(void* buf, size_t len) override {
+    const size_t n = Load(buf, len, rd_off_);
+    rd_off_ += n;
+    return n;
+  }
+  size_t Write(const void* buf, size_t len) override {
+    if (handle_ == nullptr) {
+      return 0;
+    }
+    auto p = reinterpret_cast<const char*>(buf);
+    const char* end = p + len;
+    while (p < end && isspace(*p)) {
+      ++p;
+    }
+    while (p < end && isspace(end[-1])) {
+      --end;
+    }
+    if (p == end) {
+      return len;
+    }
+    if (auto err = handle_(std::string(p, end))) {
+      Log(kWarn, "%s at %s:%d\n", err.Name(), err.File(), err.Line());
+      return 0;
+    }
+    return len;
+  }
+  size_t Size() const override { return text_.size(); }
+  size_t Load(void* buf, size_t len, size_t offset) override {
+    if (offset >= text_.size()) {
+      return 0;
+    }
+    const size_t n = std::min(len, text_.size() - offset);
+    memcpy(buf, text_.data() + offset, n);
+    return n;
+  }
+
+ private:
+  std::string text_;
+  devfs::StatVnode::Handler handle_;
+  size_t rd_off_ = 0;
+};
+
+// request size and depth of reading /dev/blk, 0 for the driver's choice
+size_t blk_request_bytes = 0;
+size_t blk_depth = 0;
+
+/** @brief BlkDescriptor reads a virtio-blk device from its current offset.
+ */
+class BlkDescriptor : public ::FileDescriptor {
+ public:
+  explicit BlkDescriptor(virtio::blk::Device& dev) : dev_{dev} {}
+  size_t Read(void* buf, size_t len) override {
+    const size_t n = Load(buf, len, rd_off_);
+    rd_off_ += n;
+    return n;
+  }
+  size_t Write(const void* buf, size_t len) override { return 0; }
+  size_t Size() const override { return dev_.NumBlocks() * dev_.BlockSize(); }
+  size_t Load(void* buf, size_t len, size_t offset) override;
+
+ private:
+  // bytes read from the device at a time, two batches of 32 requests of 4 KiB
+  static const size_t kBounceBytes = 256 * 1024;
+
+  virtio::blk::Device& dev_;
+  std::vector<uint8_t> bounce_ = std::vector<uint8_t>(kBounceBytes);
+  size_t rd_off_ = 0;
+};
+
+size_t BlkDescriptor::Load(void* buf, size_t len, size_t offset) {
+  if (offset >= Size()) {
+    return 0;
+  }
+  len = std::min(len, Size() - offset);
+  const size_t block_size = dev_.BlockSize();
+  auto dst = reinterpret_cast<uint8_t*>(buf);
+
+  size_t done = 0;
+  while (done < len) {
+    const size_t skip = (offset + done) % block_size;
+    const size_t num_blocks =
+        std::min((skip + len - done + block_size - 1) / block_size,
+                 bounce_.size() / block_size);
+    const uint64_t lba = (offset + done) / block_size;
+    const size_t request_blocks = blk_request_bytes > 0
+                                      ? blk_request_bytes / block_size
+                                      : num_blocks;
+    const size_t depth = blk_depth > 0 ? blk_depth : dev_.MaxDepth();
+    if (auto err = dev_.ReadInRequests(lba, bounce_.data(), num_blocks,
+                                       request_blocks, depth)) {
+      Log(kWarn, "%s at %s:%d\n", err.Name(), err.File(), err.Line());
+      break;
+    }
+    const size_t n = std::min(num_blocks * block_size - skip, len - done);
+    memcpy(dst + done, &bounce_[skip], n);
+    done += n;
+  }
+  return done;
+}
+
+class DirectoryIterator : public vfs::DirectoryIterator {
+ public:
+  using Map = std::map<std::string, std::unique_ptr<vfs::Vnode>>;
+  explicit DirectoryIterator(const Map& entries)
+      : it_{entries.begin()}, end_{entries.end()} {}
+
+  vfs::Vnode* Next(char* name) override {
+    if (it_ == end_) {
+      return nullptr;
+    }
+    strcpy(name, it_->first.c_str());
+    return (it_++)->second.get();
+  }
+
+ private:
+  Map::const_iterator it_, end_;
+};
+
+void Append(std::string& text, const char* format, ...) {
+  char s[128];
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(s, sizeof(s), format, ap);
+  va_end(ap);
+  text += s;
+}
+
+void GenerateMemStat(std::string& text) {
+  const auto stat = memory_manager->Stat();
+  Append(text, "used_frames %lu\n", stat.allocated_frames);
+  Append(text, "total_frames %lu\n", stat.total_frames);
+  Append(text, "bytes_per_frame %llu\n", kBytesPerFrame);
+}
+
+void GenerateCacheStat(std::string& text) {
+  const auto stat = fat::CacheStat();
+  Append(text, "hits %lu\n", stat.hits);
+  Append(text, "misses %lu\n", stat.misses);
+  Append(text, "evictions %lu\n", stat.evictions);
+  Append(text, "writebacks %lu\n", stat.writebacks);
+  Append(text, "readahead %lu\n", stat.readahead);
+  Append(text, "readahead_hits %lu\n", stat.readahead_hits);
+  Append(text, "readahead_wasted %lu\n", stat.readahead_wasted);
+}
+
+void GenerateLayerStat(std::string& text) {
+  __asm__("cli");
+  const auto stat = layer_manager->Stat();
+  __asm__("sti");
+  Append(text, "frames %lu\n", stat.frames);
+  Append(text, "updates %lu\n", stat.updates);
+  // updates which were drawn by the frame of an earlier one
+  Append(text, "coalesced %lu\n",
+         stat.updates - std::min(stat.updates, stat.frames));
+  Append(text, "damage_rects %lu\n", stat.damage_rects);
+  Append(text, "composed_pixels %lu\n", stat.composed_pixels);
+  Append(text, "layer_pixels %lu\n", stat.layer_pixels);
+  Append(text, "cursor_moves %lu\n", stat.cursor_moves);
+  Append(text, "cursor_pixels %lu\n", stat.cursor_pixels);
+  Append(text, "flips %lu\n", stat.flips);
+  Append(text, "skipped_frames %lu\n", stat.skipped_frames);
+  Append(text, "screen_width %d\n", ScreenSize().x);
+  Append(text, "screen_height %d\n", ScreenSize().y);
+  Append(text, "blit %s\n", blit::Name(blit::Selected()));
+}
+
+void GenerateJournalStat(std::string& text) {
+  const auto stat = fat::GetJournalStat();
+  Append(text, "sectors %lu\n", stat.sectors);
+  Append(text, "commits %lu\n", stat.commits);
+  Append(text, "overflows %lu\n", stat.overflows);
+  Append(text, "replays %lu\n", stat.replays);
+}
+
+Error HandleJournalCommand(const std::string& command) {
+  if (command == "on") {
+    return fat::FormatJournal();
+  }
+  return MAKE_ERROR(Error::kInvalidFormat);
+}
+
+void GenerateBlkCtl(std::string& text) {
+  Append(text, "request_bytes %lu\n", blk_request_bytes);
+  Append(text, "depth %lu\n", blk_depth);
+}
+
+Error HandleBlkCommand(const std::string& command) {
+  const auto space = command.find(' ');
+  if (space == std::string::npos) {
+    return MAKE_ERROR(Error::kInvalidFormat);
+  }
+  const auto key = command.substr(0, space);
+  const size_t value = strtoul(command.c_str() + space + 1, nullptr, 0);
+  if (key == "request_bytes" && value % virtio::blk::device->BlockSize() == 0) {
+    blk_request_bytes = value;
+  } else if (key == "depth") {
+    blk_depth = value;
+  } else {
+    return MAKE_ERROR(Error::kInvalidFormat);
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+void GenerateBlkStat(std::string& text) {
+  const auto& dev = *virtio::blk::device;
+  const auto stat = dev.Stat();
+  Append(text, "blocks %lu\n", dev.NumBlocks());
+  Append(text, "queues %lu\n", dev.NumQueues());
+  Append(text, "requests %lu\n", stat.requests);
+  Append(text, "notifications %lu\n", stat.notifications);
+  Append(text, "interrupts %lu\n", stat.interrupts);
+}
+}  // namespace
+
+namespace devfs {
+
+MemoryDescriptor::MemoryDescriptor(uint8_t* base, size_t size, bool writable)
+    : base_{base}, size_{size}, writable_{writable} {}
+
+size_t MemoryDescriptor::Read(void* buf, size_t len) {
+  const size_t n = Load(buf, len, rd_off_);
+  rd_off_ += n;
+  return n;
+}
+
+size_t MemoryDescriptor::Write(const void* buf, size_t len) {
+  if (!writable_ || wr_off_ >= size_) {
+    return 0;
+  }
+  const size_t n = std::min(len, size_ - wr_off_);
+  memcpy(base_ + wr_off_, buf, n);
+  wr_off_ += n;
+  return n;
+}
+
+size_t MemoryDescriptor::Load(void* buf, size_t len, size_t offset) {
+  if (offset >= size_) {
+    return 0;
+  }
+  const size_t n = std::min(len, size_ - offset);
+  memcpy(buf, base_ + offset, n);
+  return n;
+}
+
+size_t FrameBufferVnode::Size() const {
+  return kBytesPerPixel * screen_config.pixels_per_scan_line *
+         screen_config.vertical_resolution;
+}
+
+std::unique_ptr<::FileDescriptor> FrameBufferVnode::OpenFile() {
+  return std::make_unique<MemoryDescriptor>(screen_config.frame_buffer, Size(),
+                                            true);
+}
+
+StatVnode::StatVnode(Generator generate, Handler handle)
+    : generate_{generate}, handle_{handle} {}
+
+size_t StatVnode::Size() const {
+  std::string text;
+  generate_(text);
+  return text.size();
+}
+
+std::unique_ptr<::FileDescriptor> StatVnode::OpenFile() {
+  std::string text;
+  generate_(text);
+  return std::make_unique<StatDescriptor>(std::move(text), handle_);
+}
+
+vfs::Vnode* DirectoryVnode::Lookup(const char* name) {
+  auto it = entries_.find(name);
+  return it == entries_.end() ? nullptr : it->second.get();
+}
+
+std::unique_ptr<vfs::DirectoryIterator> DirectoryVnode::ReadDir() {
+  return std::make_unique<DirectoryIterator>(entries_);
+}
+
+size_t BlkVnode::Size() const { return dev_.NumBlocks() * dev_.BlockSize(); }
+
+std::unique_ptr<::FileDescriptor> BlkVnode::OpenFile() {
+  return std::make_unique<BlkDescriptor>(dev_);
+}
+
+void DirectoryVnode::Add(const char* name, std::unique_ptr<vfs::Vnode> vnode) {
+  entries_[name] = std::move(vnode);
+}
+
+FileSystem::FileSystem() {
+  root_.Add("fb", std::make_unique<FrameBufferVnode>());
+  root_.Add("memstat", std::make_unique<StatVnode>(GenerateMemStat));
+  root_.Add("cachestat", std::make_unique<StatVnode>(GenerateCacheStat));
+  root_.Add("layerstat", std::make_unique<StatVnode>(GenerateLayerStat));
+  root_.Add("journal", std::make_unique<StatVnode>(GenerateJournalStat,
+                                                   HandleJournalCommand));
+  if (virtio::blk::device) {
+    root_.Add("blk", std::make_unique<BlkVnode>(*virtio::blk::device));
+    root_.Add("blkctl",
+              std::make_unique<StatVnode>(GenerateBlkCtl, HandleBlkCommand));
+    root_.Add("blkstat", std::make_unique<StatVnode>(GenerateBlkStat));
+  }
+}
+
+}  // namespace devfs
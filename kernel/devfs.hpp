@@ -0,0 +1,142 @@
+/**
+ * @file devfs.hpp
+ *
+ * A file system of device files and kernel statistics.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "vfs.hpp"
+
+namespace virtio::blk {
+class Device;
+}
+
+namespace devfs {
+
+/** @brief MemoryDescriptor reads and writes a fixed memory region. */
+class MemoryDescriptor : public ::FileDescriptor {
+ public:
+  MemoryDescriptor(uint8_t* base, size_t size, bool writable);
+  size_t Read(void* buf, size_t len) override;
+  size_t Write(const void* buf, size_t len) override;
+  size_t Size() const override { return size_; }
+  size_t Load(void* buf, size_t len, size_t offset) override;
+
+ private:
+  uint8_t* base_;
+  size_t size_;
+  bool writable_;
+  size_t rd_off_ = 0;
+  size_t wr_off_ = 0;
+};
+
+/** @brief FrameBufferVnode exposes the pixels of the screen. */
+class FrameBufferVnode : public vfs::Vnode {
+ public:
+  vfs::FileType Type() const override { return vfs::FileType::kDevice; }
+  size_t Size() const override;
+  vfs::Vnode* Lookup(const char* name) override { return nullptr; }
+  std::unique_ptr<vfs::DirectoryIterator> ReadDir() override {
+    return nullptr;
+  }
+
+ protected:
+  std::unique_ptr<::FileDescriptor> OpenFile() override;
+};
+
+/** @brief StatVnode is a text file generated when it is opened, like the
+ * files of /proc.
+ *
+ * The file is read-only unless it has a handler, which receives each write
+ * as a command with the surrounding white space removed.
+ */
+class StatVnode : public vfs::Vnode {
+ public:
+  using Generator = void (*)(std::string& text);
+  using Handler = Error (*)(const std::string& command);
+
+  explicit StatVnode(Generator generate, Handler handle = nullptr);
+  vfs::FileType Type() const override { return vfs::FileType::kRegular; }
+  size_t Size() const override;
+  vfs::Vnode* Lookup(const char* name) override { return nullptr; }
+  std::unique_ptr<vfs::DirectoryIterator> ReadDir() override {
+    return nullptr;
+  }
+
+ protected:
+  std::unique_ptr<::FileDescriptor> OpenFile() override;
+
+ private:
+  Generator generate_;
+  Handler handle_;
+};
+
+/** @brief BlkVnode reads a virtio-blk device as a file of its whole
+ * capacity, through a kernel buffer which the device can transfer to. It
+ * does not go through the cluster cache.
+ *
+ * The requests have the size and depth set through /dev/blkctl, or those the
+ * driver chooses if they are 0.
+ */
+class BlkVnode : public vfs::Vnode {
+ public:
+  explicit BlkVnode(virtio::blk::Device& dev) : dev_{dev} {}
+  vfs::FileType Type() const override { return vfs::FileType::kDevice; }
+  size_t Size() const override;
+  vfs::Vnode* Lookup(const char* name) override { return nullptr; }
+  std::unique_ptr<vfs::DirectoryIterator> ReadDir() override {
+    return nullptr;
+  }
+
+ protected:
+  std::unique_ptr<::FileDescriptor> OpenFile() override;
+
+ private:
+  virtio::blk::Device& dev_;
+};
+
+/** @brief DirectoryVnode is a directory with a fixed set of entries. */
+class DirectoryVnode : public vfs::Vnode {
+ public:
+  vfs::FileType Type() const override { return vfs::FileType::kDirectory; }
+  size_t Size() const override { return 0; }
+  vfs::Vnode* Lookup(const char* name) override;
+  std::unique_ptr<vfs::DirectoryIterator> ReadDir() override;
+
+  void Add(const char* name, std::unique_ptr<vfs::Vnode> vnode);
+
+ protected:
+  std::unique_ptr<::FileDescriptor> OpenFile() override { return nullptr; }
+
+ private:
+  std::map<std::string, std::unique_ptr<vfs::Vnode>> entries_{};
+};
+
+/** @brief FileSystem has the following entries.
+ *
+ * - fb: the frame buffer of the screen
+ * - memstat: usage of physical memory
+ * - cachestat: statistics of the FAT cluster cache
+ * - layerstat: statistics of the compositor and the screen size
+ * - journal: state of the FAT journal; writing "on" sets one up
+ * - blk: the contents of the virtio-blk device, if there is one
+ * - blkctl: request size and depth of reading blk; write "request_bytes <n>"
+ *   or "depth <n>" to set them
+ * - blkstat: statistics of the virtio-blk device, if there is one
+ */
+class FileSystem : public vfs::FileSystem {
+ public:
+  FileSystem();
+  vfs::Vnode& Root() override { return root_; }
+
+ private:
+  DirectoryVnode root_;
+};
+
+}  // namespace devfs
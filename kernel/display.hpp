@@ -0,0 +1,22 @@
+/**
+ * @file display.hpp
+ *
+ * Display abstraction for scanout hardware with several frame buffer pages.
+ */
+#pragma once
+
+#include "frame_buffer_config.hpp"
+
+/** @brief Display is a scanout which shows one of several pages of video
+ * memory and switches between them without copying.
+ */
+class Display {
+ public:
+  virtual ~Display() = default;
+  /** @brief Returns the number of pages, each of which holds a screen. */
+  virtual int NumPages() const = 0;
+  /** @brief Returns the frame buffer of the page. */
+  virtual FrameBufferConfig PageConfig(int page) const = 0;
+  /** @brief Scans out the page from the next refresh on. */
+  virtual void Show(int page) = 0;
+};
@@ -35,6 +35,10 @@ class Error {
     kIsDirectory,
     kNoSuchEntry,
     kFreeTypeError,
+    kIOError,
+    kNotDirectory,
+    kNotIdentityMapped,
+    kWouldBlock,
     kLastOfCode,  // この列挙子は常に最後に配置する
   };
 
@@ -69,6 +73,10 @@ class Error {
       "kIsDirectory",
       "kNoSuchEntry",
       "kFreeTypeError",
+      "kIOError",
+      "kNotDirectory",
+      "kNotIdentityMapped",
+      "kWouldBlock",
   };
   static_assert(Error::Code::kLastOfCode == code_names_.size());
 
@@ -1,42 +1,1034 @@
 #include "fat.hpp"
 
 #include <algorithm>
+#include <array>
 #include <cctype>
+#include <cstdio>
 #include <cstring>
+#include <list>
+#include <string>
+#include <unordered_map>
 #include <utility>
 
+#include "logger.hpp"
+#include "task.hpp"
+#include "timer.hpp"
+
 namespace {
+/** @brief Copies the first element of the path into path_elem, which has
+ * kMaxNameBytes bytes. An element too long to be a name becomes empty, so that
+ * it is not found.
+ */
 std::pair<const char*, bool> NextPathElement(const char* path,
                                              char* path_elem) {
   const char* next_slash = strchr(path, '/');
+  const size_t path_len = next_slash ? next_slash - path : strlen(path);
+  const size_t elem_len = path_len < fat::kMaxNameBytes ? path_len : 0;
+  memcpy(path_elem, path, elem_len);
+  path_elem[elem_len] = '\0';
   if (next_slash == nullptr) {
-    strcpy(path_elem, path);
     return {nullptr, false};
   }
-  const auto elem_len = next_slash - path;
-  strncpy(path_elem, path, elem_len);
-  path_elem[elem_len] = '\0';
   return {&next_slash[1], true};
 }
+
+// ntres flags which tell that the base name or the extension of a short name
+// is to be shown in lower case
+const uint8_t kLowerCaseBase = 0x08;
+const uint8_t kLowerCaseExt = 0x10;
+
+const uint8_t kLastLongNameEntry = 0x40;
+const int kCharsPerLongNameEntry = 13;
+const size_t kMaxLongNameChars = 255;
+
+uint8_t ShortNameChecksum(const unsigned char* name83) {
+  uint8_t sum = 0;
+  for (int i = 0; i < 11; ++i) {
+    sum = ((sum & 1) << 7) + (sum >> 1) + name83[i];
+  }
+  return sum;
+}
+
+/** @brief Converts a UTF-8 string into UTF-16.
+ *
+ * @return Number of UTF-16 code units, or max_len + 1 if the string does not
+ * fit into max_len code units or is not valid UTF-8
+ */
+size_t UTF8ToUTF16(const char* s, uint16_t* dest, size_t max_len) {
+  size_t n = 0;
+  auto u = reinterpret_cast<const uint8_t*>(s);
+  while (*u) {
+    uint32_t c;
+    int len;
+    if (u[0] < 0x80) {
+      c = u[0];
+      len = 1;
+    } else if ((u[0] & 0xe0) == 0xc0) {
+      c = u[0] & 0x1f;
+      len = 2;
+    } else if ((u[0] & 0xf0) == 0xe0) {
+      c = u[0] & 0x0f;
+      len = 3;
+    } else if ((u[0] & 0xf8) == 0xf0) {
+      c = u[0] & 0x07;
+      len = 4;
+    } else {
+      return max_len + 1;
+    }
+    for (int i = 1; i < len; ++i) {
+      if ((u[i] & 0xc0) != 0x80) {
+        return max_len + 1;
+      }
+      c = (c << 6) | (u[i] & 0x3f);
+    }
+    u += len;
+
+    if (c >= 0x10000) {
+      if (n + 2 > max_len) {
+        return max_len + 1;
+      }
+      c -= 0x10000;
+      dest[n++] = 0xd800 | (c >> 10);
+      dest[n++] = 0xdc00 | (c & 0x3ff);
+    } else {
+      if (n + 1 > max_len) {
+        return max_len + 1;
+      }
+      dest[n++] = c;
+    }
+  }
+  return n;
+}
+
+/** @brief Converts a UTF-16 string of len code units into null-terminated
+ * UTF-8. dest must hold 3 * len + 1 bytes.
+ */
+void UTF16ToUTF8(const uint16_t* s, size_t len, char* dest) {
+  auto out = reinterpret_cast<uint8_t*>(dest);
+  for (size_t i = 0; i < len; ++i) {
+    uint32_t c = s[i];
+    if (0xd800 <= c && c < 0xdc00 && i + 1 < len &&
+        0xdc00 <= s[i + 1] && s[i + 1] < 0xe000) {
+      c = 0x10000 + ((c - 0xd800) << 10) + (s[i + 1] - 0xdc00);
+      ++i;
+    }
+    if (c < 0x80) {
+      *out++ = c;
+    } else if (c < 0x800) {
+      *out++ = 0xc0 | (c >> 6);
+      *out++ = 0x80 | (c & 0x3f);
+    } else if (c < 0x10000) {
+      *out++ = 0xe0 | (c >> 12);
+      *out++ = 0x80 | ((c >> 6) & 0x3f);
+      *out++ = 0x80 | (c & 0x3f);
+    } else {
+      *out++ = 0xf0 | (c >> 18);
+      *out++ = 0x80 | ((c >> 12) & 0x3f);
+      *out++ = 0x80 | ((c >> 6) & 0x3f);
+      *out++ = 0x80 | (c & 0x3f);
+    }
+  }
+  *out = 0;
+}
+
+bool IsShortNameChar(char c) {
+  if (static_cast<uint8_t>(c) >= 0x80 || isalnum(c)) {
+    return true;
+  }
+  return strchr("$%'-_@~`!(){}^#&", c) != nullptr && c != '\0';
+}
+
+/** @brief Converts a name like "foo.txt" into the space-padded, upper case 11
+ * byte form stored in DirectoryEntry::name.
+ *
+ * @param ntres Receives the lower case flags for the name
+ * @return false if the name cannot be stored as a short name as it is, e.g.
+ * it is too long, has invalid characters or mixes cases within a part
+ */
+bool MakeShortName(const char* name, unsigned char* name83, uint8_t& ntres) {
+  memset(name83, 0x20, 11);
+  ntres = 0;
+  if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+    memcpy(name83, name, strlen(name));
+    return true;
+  }
+
+  const char* dot = strchr(name, '.');
+  const size_t base_len = dot ? dot - name : strlen(name);
+  const size_t ext_len = dot ? strlen(dot + 1) : 0;
+  if (base_len == 0 || base_len > 8 || ext_len > 3 ||
+      (dot && (ext_len == 0 || strchr(dot + 1, '.')))) {
+    return false;
+  }
+
+  // Each part has to be all upper case or all lower case.
+  auto convert = [&](const char* part, size_t len, unsigned char* dest,
+                     uint8_t lower_flag) {
+    bool upper = false, lower = false;
+    for (size_t i = 0; i < len; ++i) {
+      if (!IsShortNameChar(part[i])) {
+        return false;
+      }
+      upper |= isupper(part[i]) != 0;
+      lower |= islower(part[i]) != 0;
+      dest[i] = toupper(part[i]);
+    }
+    if (upper && lower) {
+      return false;
+    }
+    if (lower) {
+      ntres |= lower_flag;
+    }
+    return true;
+  };
+  return convert(name, base_len, name83, kLowerCaseBase) &&
+         (!dot || convert(dot + 1, ext_len, name83 + 8, kLowerCaseExt));
+}
+
+BlockDevice* volume_dev;
+std::unique_ptr<RAMDisk> ram_disk;
+std::vector<uint8_t> boot_sector;
+std::vector<uint8_t> fs_info_sector;
+bool fs_info_dirty;
+// In-memory copy of the first FAT
+std::vector<uint32_t> fat_table;
+// fat_sector_dirty[i] is true if sector i of the FAT has to be written back
+std::vector<bool> fat_sector_dirty;
+// Serializes the tasks which use the volume, the write back task included.
+// The entry points of the fat namespace hold it while they use the caches,
+// the FAT or directory entries, so that a Flush never sees half an update.
+// Page faults, which cannot sleep, only try to take it (TryLockLoad).
+Mutex fs_mutex;
+// Buffer n of the cache holds cluster n + 2
+std::unique_ptr<BufferCache> cluster_cache;
+const size_t kMaxCachedClusters = 1024;
+
+/** @brief Returns the location of a directory entry in a cached cluster. */
+fat::EntryLocation LocateEntry(const fat::DirectoryEntry& entry) {
+  auto [pos, err] = cluster_cache->Locate(&entry);
+  if (err) {
+    Log(kError, "fat: directory entry %p is not cached\n", &entry);
+    return {0, 0};
+  }
+  return {pos.first + 2, pos.second / sizeof(fat::DirectoryEntry)};
+}
+
+/** @brief Returns the directory entry at the location, reading its cluster
+ * if it is not cached. nullptr for {0, 0}.
+ */
+fat::DirectoryEntry* GetEntry(fat::EntryLocation loc) {
+  if (loc.cluster == 0) {
+    return nullptr;
+  }
+  auto dir = fat::GetSectorByCluster<fat::DirectoryEntry>(loc.cluster);
+  return dir ? &dir[loc.index] : nullptr;
+}
+
+/** @brief Returns the case folded form of a name, under which it is stored in
+ * a DirectoryIndex. Only ASCII letters are folded.
+ */
+std::string FoldName(const char* name) {
+  std::string folded{name};
+  for (auto& c : folded) {
+    c = tolower(c);
+  }
+  return folded;
+}
+
+/** @brief DirectoryIndex maps the case folded long names and short names of
+ * the entries of one directory to the locations of the entries.
+ *
+ * An index holds every name of its directory, so a name missing from it is
+ * missing from the directory. Repeated failed lookups, as in a search along
+ * PATH, are thus answered without scanning the directory again while the
+ * index stays cached.
+ */
+using DirectoryIndex = std::unordered_map<std::string, fat::EntryLocation>;
+
+struct CachedDirectoryIndex {
+  DirectoryIndex index;
+  std::list<unsigned long>::iterator lru_pos;
+};
+
+// key: first cluster of the directory
+std::unordered_map<unsigned long, CachedDirectoryIndex> dir_indexes;
+// first clusters of the indexed directories, the most recently used first
+std::list<unsigned long> dir_index_lru;
+const size_t kMaxIndexedDirectories = 256;
+
+void AddToIndex(DirectoryIndex& index, const char* name,
+                const fat::DirectoryEntry& entry) {
+  const auto loc = LocateEntry(entry);
+  index.emplace(FoldName(name), loc);
+  char short_name[13];
+  fat::FormatName(entry, short_name);
+  index.emplace(FoldName(short_name), loc);
+}
+
+/** @brief Returns the index of the directory, building it by scanning the
+ * directory on the first access.
+ */
+DirectoryIndex& GetDirectoryIndex(unsigned long dir_cluster) {
+  if (auto it = dir_indexes.find(dir_cluster); it != dir_indexes.end()) {
+    dir_index_lru.splice(dir_index_lru.begin(), dir_index_lru,
+                         it->second.lru_pos);
+    return it->second.index;
+  }
+  if (dir_indexes.size() >= kMaxIndexedDirectories) {
+    dir_indexes.erase(dir_index_lru.back());
+    dir_index_lru.pop_back();
+  }
+
+  dir_index_lru.push_front(dir_cluster);
+  auto& cached = dir_indexes[dir_cluster];
+  cached.lru_pos = dir_index_lru.begin();
+  auto& index = cached.index;
+  fat::DirectoryReader reader{dir_cluster};
+  char name[fat::kMaxNameBytes];
+  while (auto entry = reader.Next(name)) {
+    AddToIndex(index, name, *entry);
+  }
+  return index;
+}
+
+/** @brief Searches one directory for an entry with the given long or short
+ * name, case insensitively.
+ */
+fat::DirectoryEntry* LookupEntry(unsigned long dir_cluster, const char* name) {
+  auto& index = GetDirectoryIndex(dir_cluster);
+  auto it = index.find(FoldName(name));
+  return it == index.end() ? nullptr : GetEntry(it->second);
+}
+
+/** @brief Makes a short name alias "BASIS~N.EXT" for a long name, unique
+ * within the directory.
+ */
+void MakeShortAlias(unsigned long dir_cluster, const char* name,
+                    unsigned char* name83) {
+  // the basis name: valid characters of the base and the extension, upper
+  // cased, leading dots and all spaces removed
+  while (*name == '.') {
+    ++name;
+  }
+  const char* dot = strrchr(name, '.');
+  char base[9] = {}, ext[4] = {};
+  size_t base_len = 0, ext_len = 0;
+  for (const char* p = name; *p && p != dot && base_len < 8; ++p) {
+    if (*p == ' ' || *p == '.') {
+      continue;
+    }
+    base[base_len++] = IsShortNameChar(*p) ? toupper(*p) : '_';
+  }
+  for (const char* p = dot ? dot + 1 : ""; *p && ext_len < 3; ++p) {
+    if (*p == ' ' || *p == '.') {
+      continue;
+    }
+    ext[ext_len++] = IsShortNameChar(*p) ? toupper(*p) : '_';
+  }
+  if (base_len == 0) {
+    base[base_len++] = '_';
+  }
+
+  auto& index = GetDirectoryIndex(dir_cluster);
+  char alias[13];
+  for (int n = 1; n < 1000000; ++n) {
+    char tail[8];
+    const int tail_len = sprintf(tail, "~%d", n);
+    const int keep = std::min<int>(base_len, 8 - tail_len);
+    sprintf(alias, "%.*s%s%s%s", keep, base, tail, ext_len ? "." : "", ext);
+    if (index.count(FoldName(alias)) == 0) {
+      break;
+    }
+  }
+
+  memset(name83, 0x20, 11);
+  const char* alias_dot = strchr(alias, '.');
+  memcpy(name83, alias, alias_dot ? alias_dot - alias : strlen(alias));
+  if (alias_dot) {
+    memcpy(name83 + 8, alias_dot + 1, strlen(alias_dot + 1));
+  }
+}
+
+void SetFATEntry(unsigned long cluster, uint32_t value) {
+  fat_table[cluster] = value;
+  fat_sector_dirty[cluster * sizeof(uint32_t) /
+                   fat::boot_volume_image->bytes_per_sector] = true;
+}
+
+/** @brief Copies a part of a cluster through the cluster cache. */
+Error ReadCluster(unsigned long cluster, size_t offset, void* buf, size_t n) {
+  auto [data, err] = cluster_cache->Get(cluster - 2);
+  if (err) {
+    return err;
+  }
+  memcpy(buf, &data[offset], n);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+/** @brief Overwrites a part of a cluster through the cluster cache.
+ *
+ * @param buf Source of n bytes, or nullptr to write zeros
+ */
+Error WriteCluster(unsigned long cluster, size_t offset, const void* buf,
+                   size_t n) {
+  auto [data, err] = n == fat::bytes_per_cluster
+                         ? cluster_cache->GetForOverwrite(cluster - 2)
+                         : cluster_cache->Get(cluster - 2);
+  if (err) {
+    return err;
+  }
+  if (buf) {
+    memcpy(&data[offset], buf, n);
+  } else {
+    memset(&data[offset], 0, n);
+  }
+  cluster_cache->MarkDirty(data);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+/** @brief Free cluster bitmap of the volume.
+ * Bit (c % 64) of cluster_bitmap[c / 64] is 1 if cluster c is in use.
+ * Clusters 0 and 1 are reserved and always marked as used.
+ */
+std::vector<uint64_t> cluster_bitmap;
+unsigned long max_cluster;  // one past the last valid cluster number
+unsigned long num_free_clusters;
+unsigned long next_free_hint;
+// Runs of free clusters longer than this were not found by the latest
+// search, which looked at the runs starting in [free_run_window_begin,
+// free_run_window_end), wrapping around at the end of the volume. It only
+// lowers until a cluster is freed, which resets it to max_cluster.
+unsigned long free_run_bound;
+unsigned long free_run_window_begin, free_run_window_end;
+fat::FSInfo* fs_info;
+
+const uint32_t kFSInfoLeadSignature = 0x41615252;
+const uint32_t kFSInfoStructSignature = 0x61417272;
+const uint32_t kFSInfoTrailSignature = 0xaa550000;
+const uint32_t kFSInfoUnknown = 0xffffffff;
+
+bool ClusterIsUsed(unsigned long cluster) {
+  return (cluster_bitmap[cluster / 64] >> (cluster % 64)) & 1;
+}
+
+void MarkCluster(unsigned long cluster, bool used) {
+  const uint64_t bit = uint64_t{1} << (cluster % 64);
+  if (used) {
+    cluster_bitmap[cluster / 64] |= bit;
+    --num_free_clusters;
+  } else {
+    cluster_bitmap[cluster / 64] &= ~bit;
+    ++num_free_clusters;
+    free_run_bound = max_cluster;
+  }
+}
+
+/** @brief Returns the first free cluster at or after `from`, wrapping around
+ * to cluster 2 at the end of the volume. Returns 0 if the volume is full.
+ */
+unsigned long FindFreeCluster(unsigned long from) {
+  if (num_free_clusters == 0) {
+    return 0;
+  }
+  if (from < 2 || from >= max_cluster) {
+    from = 2;
+  }
+
+  unsigned long c = from;
+  do {
+    if (c % 64 == 0 && cluster_bitmap[c / 64] == ~uint64_t{0}) {
+      c += 64;  // skip a fully used word
+    } else if (!ClusterIsUsed(c)) {
+      return c;
+    } else {
+      ++c;
+    }
+    if (c >= max_cluster) {
+      c = 2;
+    }
+  } while (c != from);
+  return 0;
+}
+
+// clusters FindFreeRun looks through before it gives up on a run
+const unsigned long kMaxFreeRunScan = 65536;
+
+bool InFreeRunWindow(unsigned long cluster) {
+  if (free_run_window_begin <= free_run_window_end) {
+    return free_run_window_begin <= cluster && cluster < free_run_window_end;
+  }
+  return free_run_window_begin <= cluster || cluster < free_run_window_end;
+}
+
+/** @brief Returns the head of a run of n free clusters, or the first free
+ * cluster if no run is long enough. Returns 0 if the volume is full.
+ *
+ * The search stops after kMaxFreeRunScan clusters. It is skipped when an
+ * earlier one found no run as long, so that allocating on a fragmented volume
+ * does not scan it for each cluster, until the first free cluster leaves the
+ * clusters which that search looked at.
+ */
+unsigned long FindFreeRun(size_t n) {
+  const auto first = FindFreeCluster(next_free_hint);
+  if (first == 0 || n <= 1 ||
+      (n > free_run_bound && InFreeRunWindow(first))) {
+    return first;
+  }
+
+  auto c = first;
+  unsigned long scanned = 0;
+  size_t longest = 0;
+  while (scanned < std::min(max_cluster, kMaxFreeRunScan)) {
+    size_t len = 1;
+    while (len < n && c + len < max_cluster && !ClusterIsUsed(c + len)) {
+      ++len;
+    }
+    if (len == n) {
+      return c;
+    }
+    longest = std::max(longest, len);
+
+    const auto next = FindFreeCluster(c + len);
+    scanned += next > c ? next - c : max_cluster - c + next;
+    c = next;
+  }
+  free_run_bound = longest;
+  if (scanned >= max_cluster) {
+    free_run_window_begin = 0;
+    free_run_window_end = max_cluster;
+  } else {
+    free_run_window_begin = first;
+    free_run_window_end = c;
+  }
+  return first;
+}
+
+// Clusters freed since the last Flush. They stay marked as used in the
+// bitmap until Flush has written the FAT and the directory entries which no
+// longer refer to them, so that new data never overwrites clusters which the
+// volume on the device still assigns to a file.
+std::vector<unsigned long> freed_clusters;
+
+/** @brief Makes the clusters in freed_clusters available for allocation. */
+void ReleaseFreedClusters() {
+  for (auto c : freed_clusters) {
+    MarkCluster(c, false);
+  }
+  freed_clusters.clear();
+}
+
+void UpdateFSInfo() {
+  if (fs_info == nullptr) {
+    return;
+  }
+  fs_info->free_count = num_free_clusters + freed_clusters.size();
+  fs_info->next_free = next_free_hint;
+  fs_info_dirty = true;
+}
+
+/** @brief Allocates n clusters and links them after `prev`.
+ *
+ * @param prev Cluster to which the new clusters are linked (0 for a new chain)
+ * @param n Number of clusters to allocate
+ * @return The first and the last allocated clusters. {0, prev} if the volume
+ * is full.
+ */
+std::pair<unsigned long, unsigned long> AllocateClusters(unsigned long prev,
+                                                         size_t n) {
+  unsigned long first = 0;
+  auto current = prev;
+
+  while (n > 0) {
+    unsigned long candidate;
+    if (current != 0 && current + 1 < max_cluster &&
+        !ClusterIsUsed(current + 1)) {
+      candidate = current + 1;  // keep the chain contiguous
+    } else if (auto run = FindFreeRun(n); run != 0) {
+      candidate = run;
+    } else if (!freed_clusters.empty()) {
+      // Reusing them before the next Flush is better than failing.
+      ReleaseFreedClusters();
+      continue;
+    } else {
+      Log(kWarn, "fat: no free cluster\n");
+      break;
+    }
+
+    MarkCluster(candidate, true);
+    if (current != 0) {
+      SetFATEntry(current, candidate);
+    }
+    if (first == 0) {
+      first = candidate;
+    }
+    current = candidate;
+    next_free_hint = candidate + 1;
+    --n;
+  }
+
+  if (current != 0) {
+    SetFATEntry(current, fat::kEndOfClusterchain);
+  }
+  UpdateFSInfo();
+  return {first, current};
+}
+
+// Incremented whenever a cluster chain is shortened, which tells file
+// descriptors that the cluster numbers they remember may have been freed.
+unsigned long chain_generation;
+
+/** @brief Frees every cluster of the chain starting at the cluster. */
+void FreeClusterChain(unsigned long cluster) {
+  while (2 <= cluster && cluster < max_cluster) {
+    const auto next = fat::NextCluster(cluster);
+    SetFATEntry(cluster, 0);
+    freed_clusters.push_back(cluster);
+    cluster = next;
+  }
+  ++chain_generation;
+  UpdateFSInfo();
+}
+
+/** @brief Reads the FSInfo sector and sets fs_info if it is valid. */
+Error ReadFSInfo() {
+  const auto bpb = fat::boot_volume_image;
+  fs_info = nullptr;
+  fs_info_dirty = false;
+  if (bpb->fs_info == 0 || bpb->fs_info >= bpb->reserved_sector_count) {
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  fs_info_sector.resize(bpb->bytes_per_sector);
+  if (auto err = volume_dev->Read(bpb->fs_info, fs_info_sector.data(), 1)) {
+    return err;
+  }
+  auto info = reinterpret_cast<fat::FSInfo*>(fs_info_sector.data());
+  if (info->lead_signature == kFSInfoLeadSignature &&
+      info->struct_signature == kFSInfoStructSignature &&
+      info->trail_signature == kFSInfoTrailSignature) {
+    fs_info = info;
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+/** @brief Returns the FAT which is read at mount. It is the first one unless
+ * mirroring is disabled by bit 7 of ext_flags, in which case bits 0-3 tell
+ * the only FAT in use.
+ */
+unsigned int ActiveFAT() {
+  const auto flags = fat::boot_volume_image->ext_flags;
+  return (flags & 0x80) ? flags & 0x0f : 0;
+}
+
+unsigned long FATStartSector(unsigned int fat_index) {
+  const auto bpb = fat::boot_volume_image;
+  return bpb->reserved_sector_count +
+         static_cast<unsigned long>(fat_index) * bpb->fat_size_32;
+}
+
+unsigned long DataStartSector() {
+  return FATStartSector(fat::boot_volume_image->num_fats);
+}
+
+/** @brief Writes n sectors from buf at the sector offset of every FAT in use,
+ * i.e. all copies if the FATs are mirrored.
+ */
+Error WriteFATSectors(unsigned long sector, const void* buf, size_t n) {
+  const auto bpb = fat::boot_volume_image;
+  const bool mirrored = (bpb->ext_flags & 0x80) == 0;
+  for (unsigned int k = 0; k < bpb->num_fats; ++k) {
+    if (!mirrored && k != ActiveFAT()) {
+      continue;
+    }
+    if (auto err = volume_dev->Write(FATStartSector(k) + sector, buf, n)) {
+      return err;
+    }
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+/** @brief Writes the modified sectors of fat_table back to the FATs. The
+ * dirty runs are gathered once per call and each run is written to every
+ * copy.
+ */
+Error WriteBackFAT() {
+  const auto bpb = fat::boot_volume_image;
+  const auto entries_per_sector = bpb->bytes_per_sector / sizeof(uint32_t);
+  size_t i = 0;
+  while (i < fat_sector_dirty.size()) {
+    if (!fat_sector_dirty[i]) {
+      ++i;
+      continue;
+    }
+    // write a run of dirty sectors at once
+    size_t n = 0;
+    while (i + n < fat_sector_dirty.size() && fat_sector_dirty[i + n]) {
+      fat_sector_dirty[i + n] = false;
+      ++n;
+    }
+    if (auto err = WriteFATSectors(i, &fat_table[i * entries_per_sector], n)) {
+      return err;
+    }
+    i += n;
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+/** @brief The journal makes the metadata written by one Flush atomic.
+ *
+ * It lives in the reserved sectors following the boot sector, the FSInfo
+ * sector and their backups, and is used only if its first sector holds a
+ * header, which FormatJournal writes. A transaction consists of the header,
+ * tag sectors listing the target sector of each block, and the blocks, which
+ * are copies of the modified FAT sectors and directory clusters. File data
+ * is not journaled; Flush writes it in place before the transaction.
+ */
+struct JournalHeader {
+  char magic[8];
+  uint64_t sequence;    // incremented for every transaction
+  uint32_t num_blocks;  // blocks of the committed transaction, 0 if none
+  uint32_t checksum;    // FNV-1a of the tag sectors and the blocks
+} __attribute__((packed));
+
+const char kJournalMagic[8] = {'M', 'I', 'K', 'A', 'N', 'J', 'N', 'L'};
+// The journal is not used if the reserved area leaves fewer sectors to it.
+const unsigned long kMinJournalSectors = 8;
+
+unsigned long journal_start;  // first sector of the journal, 0 if none
+fat::JournalStat journal_stat;
+uint64_t journal_sequence;
+
+/** @brief Returns the first sector and the number of sectors of the reserved
+ * area the journal may occupy. The number is 0 if it is too small.
+ */
+std::pair<unsigned long, unsigned long> JournalRegion() {
+  const auto bpb = fat::boot_volume_image;
+  // sectors 0-2 are the boot sectors, and the backup has the same layout
+  unsigned long first = std::max<unsigned long>(3, bpb->fs_info + 1);
+  if (bpb->backup_boot_sector != 0) {
+    first = std::max<unsigned long>(first, bpb->backup_boot_sector + 3);
+  }
+  if (first + kMinJournalSectors > bpb->reserved_sector_count) {
+    return {first, 0};
+  }
+  return {first, bpb->reserved_sector_count - first};
+}
+
+uint32_t JournalChecksum(const uint8_t* p, size_t n) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; ++i) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h;
+}
+
+Error WriteJournalHeader(uint32_t num_blocks, uint32_t checksum) {
+  std::vector<uint8_t> sector(fat::boot_volume_image->bytes_per_sector);
+  auto header = reinterpret_cast<JournalHeader*>(sector.data());
+  memcpy(header->magic, kJournalMagic, sizeof(kJournalMagic));
+  header->sequence = journal_sequence;
+  header->num_blocks = num_blocks;
+  header->checksum = checksum;
+  return volume_dev->Write(journal_start, sector.data(), 1);
+}
+
+struct JournalBlock {
+  unsigned long sector;  // where the block belongs on the volume
+  const uint8_t* data;
+};
+
+/** @brief Returns the modified FAT sectors and directory clusters sector by
+ * sector. FAT sectors are listed at their place in the active FAT and are
+ * written to every copy.
+ */
+std::vector<JournalBlock> CollectMetadataBlocks() {
+  const auto bpb = fat::boot_volume_image;
+  const auto entries_per_sector = bpb->bytes_per_sector / sizeof(uint32_t);
+  std::vector<JournalBlock> blocks;
+  for (size_t i = 0; i < fat_sector_dirty.size(); ++i) {
+    if (fat_sector_dirty[i]) {
+      blocks.push_back({FATStartSector(ActiveFAT()) + i,
+                        reinterpret_cast<const uint8_t*>(
+                            &fat_table[i * entries_per_sector])});
+    }
+  }
+  // directory clusters are the metadata buffers
+  for (auto [index, data] : cluster_cache->DirtyMetadata()) {
+    const auto sector = DataStartSector() + index * bpb->sectors_per_cluster;
+    for (size_t s = 0; s < bpb->sectors_per_cluster; ++s) {
+      blocks.push_back({sector + s, &data[s * bpb->bytes_per_sector]});
+    }
+  }
+  return blocks;
+}
+
+/** @brief Writes the blocks to the journal and commits them.
+ *
+ * @return false if the blocks do not fit into the journal, in which case
+ * nothing is written
+ */
+WithError<bool> CommitJournal(const std::vector<JournalBlock>& blocks) {
+  const size_t bytes_per_sector = fat::boot_volume_image->bytes_per_sector;
+  const size_t tags_per_sector = bytes_per_sector / sizeof(uint64_t);
+  const size_t tag_sectors =
+      (blocks.size() + tags_per_sector - 1) / tags_per_sector;
+  if (1 + tag_sectors + blocks.size() > journal_stat.sectors) {
+    return {false, MAKE_ERROR(Error::kSuccess)};
+  }
+
+  std::vector<uint8_t> body((tag_sectors + blocks.size()) * bytes_per_sector);
+  auto tags = reinterpret_cast<uint64_t*>(body.data());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    tags[i] = blocks[i].sector;
+    memcpy(&body[(tag_sectors + i) * bytes_per_sector], blocks[i].data,
+           bytes_per_sector);
+  }
+
+  // The header is written only after the body is durable, so a header which
+  // describes a transaction always finds all of its blocks.
+  if (auto err = volume_dev->Write(journal_start + 1, body.data(),
+                                   tag_sectors + blocks.size())) {
+    return {false, err};
+  }
+  if (auto err = volume_dev->Flush()) {
+    return {false, err};
+  }
+  ++journal_sequence;
+  if (auto err = WriteJournalHeader(
+          blocks.size(), JournalChecksum(body.data(), body.size()))) {
+    return {false, err};
+  }
+  if (auto err = volume_dev->Flush()) {
+    return {false, err};
+  }
+  ++journal_stat.commits;
+  return {true, MAKE_ERROR(Error::kSuccess)};
+}
+
+/** @brief Finds the journal of the volume and writes the blocks of a
+ * committed transaction to their places. Called at mount, before the FAT is
+ * read.
+ */
+Error ReplayJournal() {
+  const auto bpb = fat::boot_volume_image;
+  journal_start = 0;
+  journal_stat = {};
+  journal_sequence = 0;
+  const auto [first, num_sectors] = JournalRegion();
+  if (num_sectors == 0) {
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  const size_t bytes_per_sector = bpb->bytes_per_sector;
+  std::vector<uint8_t> sector(bytes_per_sector);
+  if (auto err = volume_dev->Read(first, sector.data(), 1)) {
+    return err;
+  }
+  JournalHeader header;
+  memcpy(&header, sector.data(), sizeof(header));
+  if (memcmp(header.magic, kJournalMagic, sizeof(kJournalMagic)) != 0) {
+    return MAKE_ERROR(Error::kSuccess);
+  }
+  journal_start = first;
+  journal_stat.sectors = num_sectors;
+  journal_sequence = header.sequence;
+  if (header.num_blocks == 0) {
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  const size_t tags_per_sector = bytes_per_sector / sizeof(uint64_t);
+  const size_t tag_sectors =
+      (header.num_blocks + tags_per_sector - 1) / tags_per_sector;
+  std::vector<uint8_t> body;
+  bool valid = 1 + tag_sectors + header.num_blocks <= num_sectors;
+  if (valid) {
+    body.resize((tag_sectors + header.num_blocks) * bytes_per_sector);
+    if (auto err = volume_dev->Read(first + 1, body.data(),
+                                    tag_sectors + header.num_blocks)) {
+      return err;
+    }
+    valid = JournalChecksum(body.data(), body.size()) == header.checksum;
+  }
+
+  const unsigned long total_sectors =
+      bpb->total_sectors_16 ? bpb->total_sectors_16 : bpb->total_sectors_32;
+  auto tags = reinterpret_cast<const uint64_t*>(body.data());
+  for (size_t i = 0; valid && i < header.num_blocks; ++i) {
+    // only the FAT and the data area are ever journaled
+    valid = bpb->reserved_sector_count <= tags[i] && tags[i] < total_sectors;
+  }
+  if (!valid) {
+    Log(kWarn, "fat: discarding a broken journal transaction\n");
+    return WriteJournalHeader(0, 0);
+  }
+
+  const auto active_fat = FATStartSector(ActiveFAT());
+  for (size_t i = 0; i < header.num_blocks; ++i) {
+    const uint8_t* data = &body[(tag_sectors + i) * bytes_per_sector];
+    Error err = MAKE_ERROR(Error::kSuccess);
+    if (active_fat <= tags[i] && tags[i] < active_fat + bpb->fat_size_32) {
+      err = WriteFATSectors(tags[i] - active_fat, data, 1);
+    } else {
+      err = volume_dev->Write(tags[i], data, 1);
+    }
+    if (err) {
+      return err;
+    }
+  }
+  if (auto err = volume_dev->Flush()) {
+    return err;
+  }
+  ++journal_stat.replays;
+  Log(kInfo, "fat: replayed %u blocks from the journal\n", header.num_blocks);
+  return WriteJournalHeader(0, 0);
+}
+
+void InitializeClusterBitmap() {
+  const auto bpb = fat::boot_volume_image;
+  const unsigned long total_sectors = bpb->total_sectors_16
+                                          ? bpb->total_sectors_16
+                                          : bpb->total_sectors_32;
+  const unsigned long data_start =
+      bpb->reserved_sector_count + bpb->num_fats * bpb->fat_size_32;
+  const unsigned long fat_entries = bpb->fat_size_32 *
+                                    bpb->bytes_per_sector / sizeof(uint32_t);
+  max_cluster = std::min(
+      (total_sectors - data_start) / bpb->sectors_per_cluster + 2,
+      fat_entries);
+
+  cluster_bitmap.assign((max_cluster + 63) / 64, 0);
+  num_free_clusters = max_cluster;
+  MarkCluster(0, true);
+  MarkCluster(1, true);
+
+  uint32_t* fat = fat::GetFAT();
+  for (unsigned long c = 2; c < max_cluster; ++c) {
+    if ((fat[c] & 0x0fffffffu) != 0) {
+      MarkCluster(c, true);
+    }
+  }
+  // Clusters past the end of the volume are never allocated.
+  for (unsigned long c = max_cluster; c < cluster_bitmap.size() * 64; ++c) {
+    cluster_bitmap[c / 64] |= uint64_t{1} << (c % 64);
+  }
+
+  next_free_hint = 2;
+  free_run_bound = max_cluster;
+  if (fs_info == nullptr) {
+    return;
+  }
+
+  if (fs_info->next_free != kFSInfoUnknown && 2 <= fs_info->next_free &&
+      fs_info->next_free < max_cluster) {
+    next_free_hint = fs_info->next_free;
+  }
+  if (fs_info->free_count != kFSInfoUnknown &&
+      fs_info->free_count != num_free_clusters) {
+    Log(kWarn, "fat: FSInfo free count %u differs from FAT (%lu)\n",
+        fs_info->free_count, num_free_clusters);
+  }
+  UpdateFSInfo();
+}
 }  // namespace
 
 namespace fat {
 BPB* boot_volume_image;
 unsigned long bytes_per_cluster;
-void Initialize(void* volume_image) {
-  boot_volume_image = reinterpret_cast<fat::BPB*>(volume_image);
+void Initialize(BlockDevice& dev) {
+  MutexGuard lock{fs_mutex};
+  cluster_cache.reset();
+  volume_dev = &dev;
+  boot_sector.resize(dev.BlockSize());
+  if (auto err = dev.Read(0, boot_sector.data(), 1)) {
+    Log(kError, "fat: failed to read the boot sector: %s\n", err.Name());
+    return;
+  }
+  boot_volume_image = reinterpret_cast<fat::BPB*>(boot_sector.data());
   bytes_per_cluster =
       static_cast<unsigned long>(boot_volume_image->bytes_per_sector) *
       boot_volume_image->sectors_per_cluster;
+  if (boot_volume_image->bytes_per_sector != dev.BlockSize()) {
+    Log(kError, "fat: sector size %u differs from block size %lu\n",
+        boot_volume_image->bytes_per_sector, dev.BlockSize());
+  }
+
+  if (auto err = ReplayJournal()) {
+    Log(kError, "fat: failed to replay the journal: %s\n", err.Name());
+  }
+
+  const auto fat_sectors = boot_volume_image->fat_size_32;
+  fat_table.resize(fat_sectors * boot_volume_image->bytes_per_sector /
+                   sizeof(uint32_t));
+  fat_sector_dirty.assign(fat_sectors, false);
+  if (auto err = dev.Read(FATStartSector(ActiveFAT()), fat_table.data(),
+                          fat_sectors)) {
+    Log(kError, "fat: failed to read FAT: %s\n", err.Name());
+  }
+  if (auto err = ReadFSInfo()) {
+    Log(kError, "fat: failed to read FSInfo: %s\n", err.Name());
+  }
+
+  cluster_cache = std::make_unique<BufferCache>(
+      dev, DataStartSector(), boot_volume_image->sectors_per_cluster,
+      kMaxCachedClusters);
+
+  dir_indexes.clear();
+  dir_index_lru.clear();
+  freed_clusters.clear();
+  InitializeClusterBitmap();
+}
+
+void Initialize(void* volume_image, size_t image_bytes) {
+  auto bpb = reinterpret_cast<fat::BPB*>(volume_image);
+  const unsigned long total_sectors =
+      bpb->total_sectors_16 ? bpb->total_sectors_16 : bpb->total_sectors_32;
+  const size_t bytes_per_sector = bpb->bytes_per_sector;
+  const unsigned long image_sectors =
+      std::min<unsigned long>(total_sectors, image_bytes / bytes_per_sector);
+  if (image_sectors < total_sectors) {
+    Log(kWarn, "fat: %lu of %lu sectors of the volume are in memory\n",
+        image_sectors, total_sectors);
+  }
+  cluster_cache.reset();
+  ram_disk = std::make_unique<RAMDisk>(volume_image, image_sectors,
+                                       bytes_per_sector);
+  Initialize(*ram_disk);
+}
+
+bool IsSameVolume(BlockDevice& dev, const void* boot_sector) {
+  std::vector<uint8_t> sector(dev.BlockSize());
+  if (sector.size() < 512 || dev.Read(0, sector.data(), 1)) {
+    return false;
+  }
+  auto bpb = reinterpret_cast<const BPB*>(sector.data());
+  return sector[510] == 0x55 && sector[511] == 0xaa &&
+         bpb->bytes_per_sector == dev.BlockSize() &&
+         strncmp(bpb->fs_type, "FAT32   ", 8) == 0 &&
+         memcmp(bpb, boot_sector, sizeof(BPB)) == 0;
 }
 
 uintptr_t GetClusterAddr(unsigned long cluster) {
-  unsigned long sector_num =
-      boot_volume_image->reserved_sector_count +
-      boot_volume_image->num_fats * boot_volume_image->fat_size_32 +
-      (cluster - 2) * boot_volume_image->sectors_per_cluster;
-  uintptr_t offset = sector_num * boot_volume_image->bytes_per_sector;
-  return reinterpret_cast<uintptr_t>(boot_volume_image) + offset;
+  MutexGuard lock{fs_mutex};
+  auto [data, err] = cluster_cache->Get(cluster - 2, true);
+  if (err) {
+    Log(kError, "fat: failed to read cluster %lu: %s\n", cluster, err.Name());
+    return 0;
+  }
+  return reinterpret_cast<uintptr_t>(data);
+}
+
+void PinCluster(const void* addr) {
+  MutexGuard lock{fs_mutex};
+  if (cluster_cache) {
+    cluster_cache->Pin(addr);
+  }
+}
+
+void UnpinCluster(const void* addr) {
+  MutexGuard lock{fs_mutex};
+  if (cluster_cache) {
+    cluster_cache->Unpin(addr);
+  }
 }
 
 void ReadName(const DirectoryEntry& entry, char* base, char* ext) {
@@ -56,17 +1048,94 @@ void ReadName(const DirectoryEntry& entry, char* base, char* ext) {
 void FormatName(const DirectoryEntry& entry, char* dest) {
   char ext[5] = ".";
   ReadName(entry, dest, &ext[1]);
+  auto to_lower = [](char* s) {
+    for (; *s; ++s) {
+      *s = tolower(*s);
+    }
+  };
+  if (entry.ntres & kLowerCaseBase) {
+    to_lower(dest);
+  }
+  if (entry.ntres & kLowerCaseExt) {
+    to_lower(&ext[1]);
+  }
   if (ext[1]) {
     strcat(dest, ext);
   }
 }
 
+DirectoryReader::DirectoryReader(unsigned long dir_cluster)
+    : cluster_{dir_cluster} {}
+
+DirectoryEntry* DirectoryReader::Next(char* name) {
+  MutexGuard lock{fs_mutex};
+  const auto kEntriesPerCluster = bytes_per_cluster / sizeof(DirectoryEntry);
+
+  while (cluster_ != kEndOfClusterchain) {
+    if (index_ == kEntriesPerCluster) {
+      cluster_ = NextCluster(cluster_);
+      index_ = 0;
+      continue;
+    }
+    auto& entry = GetSectorByCluster<DirectoryEntry>(cluster_)[index_++];
+
+    if (entry.name[0] == 0x00) {
+      cluster_ = kEndOfClusterchain;
+      break;
+    } else if (entry.name[0] == 0xe5) {
+      next_ord_ = 0;
+      continue;
+    } else if (entry.attr == Attribute::kLongName) {
+      auto& lfn = reinterpret_cast<LongNameEntry&>(entry);
+      const int ord = lfn.ord & 0x1f;
+      if (ord < 1 || ord > 20) {
+        next_ord_ = 0;
+        continue;
+      }
+      if (lfn.ord & kLastLongNameEntry) {
+        next_ord_ = ord;
+        checksum_ = lfn.checksum;
+        long_name_len_ = ord * kCharsPerLongNameEntry;
+      } else if (ord != next_ord_ || lfn.checksum != checksum_) {
+        next_ord_ = 0;  // broken chain
+        continue;
+      }
+      uint16_t* dest = &long_name_[(ord - 1) * kCharsPerLongNameEntry];
+      memcpy(dest, lfn.name1, sizeof(lfn.name1));
+      memcpy(dest + 5, lfn.name2, sizeof(lfn.name2));
+      memcpy(dest + 11, lfn.name3, sizeof(lfn.name3));
+      next_ord_ = ord - 1;
+      if (next_ord_ == 0) {
+        next_ord_ = -1;  // complete, the short entry comes next
+      }
+      continue;
+    } else if (static_cast<uint8_t>(entry.attr) &
+               static_cast<uint8_t>(Attribute::kVolumeID)) {
+      next_ord_ = 0;
+      continue;
+    }
+
+    const bool has_long_name =
+        next_ord_ == -1 && checksum_ == ShortNameChecksum(entry.name);
+    next_ord_ = 0;
+    if (has_long_name) {
+      size_t len = 0;
+      const size_t max_len = std::min(long_name_len_, kMaxLongNameChars);
+      while (len < max_len && long_name_[len] != 0 &&
+             long_name_[len] != 0xffff) {
+        ++len;
+      }
+      UTF16ToUTF8(long_name_, len, name);
+    } else {
+      FormatName(entry, name);
+    }
+    return &entry;
+  }
+  return nullptr;
+}
+
 unsigned long NextCluster(unsigned long cluster) {
-  uintptr_t fat_offset = boot_volume_image->reserved_sector_count *
-                         boot_volume_image->bytes_per_sector;
-  uint32_t* fat = reinterpret_cast<uint32_t*>(
-      reinterpret_cast<uintptr_t>(boot_volume_image) + fat_offset);
-  uint32_t next = fat[cluster];
+  uint32_t next = fat_table[cluster];
   if (next >= 0x0ffffff8ul) {
     return kEndOfClusterchain;
   }
@@ -75,6 +1144,7 @@ unsigned long NextCluster(unsigned long cluster) {
 
 std::pair<DirectoryEntry*, bool> FindFile(const char* path,
                                           unsigned long directory_cluster) {
+  MutexGuard lock{fs_mutex};
   if (path[0] == '/') {
     directory_cluster = boot_volume_image->root_cluster;
     ++path;
@@ -82,47 +1152,27 @@ std::pair<DirectoryEntry*, bool> FindFile(const char* path,
     directory_cluster = boot_volume_image->root_cluster;
   }
 
-  char path_elem[13];
+  char path_elem[kMaxNameBytes];
   const auto [next_path, post_slash] = NextPathElement(path, path_elem);
   const bool path_last = next_path == nullptr || next_path[0] == '\0';
 
-  while (directory_cluster != kEndOfClusterchain) {
-    auto dir = GetSectorByCluster<DirectoryEntry>(directory_cluster);
-    for (int i = 0; i < bytes_per_cluster / sizeof(DirectoryEntry); ++i) {
-      if (dir[i].name[0] == 0x00) {
-        goto not_found;
-      } else if (!NameIsEqual(dir[i], path_elem)) {
-        continue;
-      }
+  auto entry = LookupEntry(directory_cluster, path_elem);
+  if (entry == nullptr) {
+    return {nullptr, post_slash};
+  }
 
-      if (dir[i].attr == Attribute::kDirectory && !path_last) {
-        return FindFile(next_path, dir[i].FirstCluster());
-      } else {
-        // dir[i] is not a directory, or we are at the end of the path, so stop
-        // searching
-        return {&dir[i], post_slash};
-      }
-    }
-    directory_cluster = NextCluster(directory_cluster);
+  if (entry->attr == Attribute::kDirectory && !path_last) {
+    return FindFile(next_path, entry->FirstCluster());
   }
-not_found:
-  return {nullptr, post_slash};
+  // entry is not a directory, or we are at the end of the path, so stop
+  // searching
+  return {entry, post_slash};
 }
 
 bool NameIsEqual(const DirectoryEntry& entry, const char* name) {
-  unsigned char name83[11];
-  memset(name83, 0x20, sizeof(name83));
-
-  int i = 0;
-  int i83 = 0;
-  for (; name[i] != 0 && i83 < sizeof(name83); ++i, ++i83) {
-    if (name[i] == '.') {
-      i83 = 7;
-      continue;
-    }
-    name83[i83] = toupper(name[i]);
-  }
-  return memcmp(entry.name, name83, sizeof(name83)) == 0;
+  char short_name[13];
+  FormatName(entry, short_name);
+  return FoldName(short_name) == FoldName(name);
 }
 
 size_t LoadFile(void* buf, size_t len, DirectoryEntry& entry) {
@@ -133,74 +1183,138 @@ bool IsEndOfClusterchain(unsigned long cluster) {
   return cluster >= 0x0ffffff8ul;
 }
 
-uint32_t* GetFAT() {
-  uintptr_t fat_offset = boot_volume_image->reserved_sector_count *
-                         boot_volume_image->bytes_per_sector;
-  return reinterpret_cast<uint32_t*>(
-      reinterpret_cast<uintptr_t>(boot_volume_image) + fat_offset);
-}
+uint32_t* GetFAT() { return fat_table.data(); }
 
 unsigned long ExtendCluster(unsigned long eoc_cluster, size_t n) {
+  MutexGuard lock{fs_mutex};
   uint32_t* fat = GetFAT();
   while (!IsEndOfClusterchain(fat[eoc_cluster])) {
     eoc_cluster = fat[eoc_cluster];
   }
+  return AllocateClusters(eoc_cluster, n).second;
+}
 
-  size_t num_allocated = 0;
-  auto current = eoc_cluster;
+std::vector<DirectoryEntry*> AllocateEntries(unsigned long dir_cluster,
+                                             size_t n) {
+  MutexGuard lock{fs_mutex};
+  const auto kEntriesPerCluster = bytes_per_cluster / sizeof(DirectoryEntry);
+  std::vector<DirectoryEntry*> run;
+  run.reserve(n);
 
-  for (unsigned long candidate = 2; num_allocated < n; ++candidate) {
-    if (fat[candidate] != 0) {  // candidate cluster is not free
-      continue;
+  // Each entry of the run pins its cluster, so that reading the following
+  // clusters cannot evict the preceding part of the run.
+  auto clear_run = [&run] {
+    for (auto e : run) {
+      UnpinCluster(e);
     }
-    fat[current] = candidate;
-    current = candidate;
-    ++num_allocated;
-  }
-  fat[current] = kEndOfClusterchain;
-  return current;
-}
+    run.clear();
+  };
 
-DirectoryEntry* AllocateEntry(unsigned long dir_cluster) {
+  unsigned long cluster = dir_cluster;
   while (true) {
-    auto dir = GetSectorByCluster<DirectoryEntry>(dir_cluster);
-    for (int i = 0; i < bytes_per_cluster / sizeof(DirectoryEntry); ++i) {
+    auto dir = GetSectorByCluster<DirectoryEntry>(cluster);
+    if (dir == nullptr) {
+      clear_run();
+      return {};
+    }
+    for (size_t i = 0; i < kEntriesPerCluster; ++i) {
       if (dir[i].name[0] == 0 || dir[i].name[0] == 0xe5) {
-        return &dir[i];
+        PinCluster(&dir[i]);
+        run.push_back(&dir[i]);
+        if (run.size() == n) {
+          return run;
+        }
+      } else if (!run.empty()) {
+        clear_run();
       }
     }
-    auto next = NextCluster(dir_cluster);
+    auto next = NextCluster(cluster);
     if (next == kEndOfClusterchain) {
       break;
     }
-    dir_cluster = next;
+    cluster = next;
   }
 
-  dir_cluster = ExtendCluster(dir_cluster, 1);
-  auto dir = GetSectorByCluster<DirectoryEntry>(dir_cluster);
-  memset(dir, 0, bytes_per_cluster);
-  return &dir[0];
-}
-
-void SetFileName(DirectoryEntry& entry, const char* name) {
-  const char* dot_pos = strrchr(name, '.');
-  memset(entry.name, ' ', 8 + 3);
-  if (dot_pos) {
-    for (int i = 0; i < 8 && i < dot_pos - name; ++i) {
-      entry.name[i] = toupper(name[i]);
+  // The run continues into new clusters appended to the directory.
+  while (run.size() < n) {
+    cluster = ExtendCluster(cluster, 1);
+    auto [data, err] = cluster_cache->GetForOverwrite(cluster - 2, true);
+    if (err) {
+      clear_run();
+      return {};
     }
-    for (int i = 0; i < 3 && dot_pos[i + 1]; ++i) {
-      entry.name[8 + i] = toupper(dot_pos[i + 1]);
+    auto dir = reinterpret_cast<DirectoryEntry*>(data);
+    memset(dir, 0, bytes_per_cluster);
+    MarkDirty(dir);
+    for (size_t i = 0; i < kEntriesPerCluster && run.size() < n; ++i) {
+      PinCluster(&dir[i]);
+      run.push_back(&dir[i]);
     }
-  } else {
-    for (int i = 0; i < 8 && name[i]; ++i) {
-      entry.name[i] = toupper(name[i]);
+  }
+  return run;
+}
+
+size_t NumEntriesForName(const char* name) {
+  unsigned char name83[11];
+  uint8_t ntres;
+  if (MakeShortName(name, name83, ntres)) {
+    return 1;
+  }
+  uint16_t name16[kMaxLongNameChars];
+  const size_t len = UTF8ToUTF16(name, name16, kMaxLongNameChars);
+  if (len == 0 || len > kMaxLongNameChars) {
+    return 0;
+  }
+  return 1 + (len + kCharsPerLongNameEntry - 1) / kCharsPerLongNameEntry;
+}
+
+void SetFileName(unsigned long dir_cluster,
+                 const std::vector<DirectoryEntry*>& entries,
+                 const char* name) {
+  MutexGuard lock{fs_mutex};
+  for (auto e : entries) {
+    memset(e, 0, sizeof(DirectoryEntry));
+  }
+  auto& entry = *entries.back();
+
+  if (MakeShortName(name, entry.name, entry.ntres)) {
+    MarkDirty(&entry);
+    return;
+  }
+
+  MakeShortAlias(dir_cluster, name, entry.name);
+  const uint8_t checksum = ShortNameChecksum(entry.name);
+
+  uint16_t name16[kMaxLongNameChars];
+  const size_t len = UTF8ToUTF16(name, name16, kMaxLongNameChars);
+  const int num_lfn = entries.size() - 1;
+  for (int ord = 1; ord <= num_lfn; ++ord) {
+    auto& lfn = reinterpret_cast<LongNameEntry&>(*entries[num_lfn - ord]);
+    lfn.ord = ord | (ord == num_lfn ? kLastLongNameEntry : 0);
+    lfn.attr = Attribute::kLongName;
+    lfn.checksum = checksum;
+
+    // the name is terminated by 0x0000 and padded with 0xffff
+    uint16_t chars[kCharsPerLongNameEntry];
+    for (int i = 0; i < kCharsPerLongNameEntry; ++i) {
+      const size_t pos = (ord - 1) * kCharsPerLongNameEntry + i;
+      chars[i] = pos < len ? name16[pos] : pos == len ? 0x0000 : 0xffff;
     }
+    memcpy(lfn.name1, &chars[0], sizeof(lfn.name1));
+    memcpy(lfn.name2, &chars[5], sizeof(lfn.name2));
+    memcpy(lfn.name3, &chars[11], sizeof(lfn.name3));
+    MarkDirty(&lfn);
   }
+  MarkDirty(&entry);
 }
 
-WithError<DirectoryEntry*> CreateFile(const char* path) {
-  auto parent_dir_cluster = fat::boot_volume_image->root_cluster;
+WithError<DirectoryEntry*> CreateFile(const char* path,
+                                      unsigned long directory_cluster) {
+  MutexGuard lock{fs_mutex};
+  if (path[0] == '/' || directory_cluster == 0) {
+    directory_cluster = fat::boot_volume_image->root_cluster;
+  }
+  auto parent_dir_cluster = directory_cluster;
   const char* filename = path;
 
   if (const char* slash_pos = strrchr(path, '/')) {
@@ -214,54 +1328,229 @@ WithError<DirectoryEntry*> CreateFile(const char* path) {
     parent_dir_name[slash_pos - path] = '\0';
 
     if (parent_dir_name[0] != '\0') {
-      auto [parent_dir, post_slash2] = fat::FindFile(parent_dir_name);
+      auto [parent_dir, post_slash2] =
+          fat::FindFile(parent_dir_name, directory_cluster);
       if (parent_dir == nullptr) {
         return {nullptr, MAKE_ERROR(Error::kNoSuchEntry)};
       }
-      parent_dir_cluster = parent_dir->FirstCluster();
+      // ".." of a subdirectory of the root points to cluster 0
+      if (parent_dir->FirstCluster() != 0) {
+        parent_dir_cluster = parent_dir->FirstCluster();
+      }
     }
   }
 
-  auto dir = fat::AllocateEntry(parent_dir_cluster);
-  if (dir == nullptr) {
+  const size_t num_entries = NumEntriesForName(filename);
+  if (num_entries == 0) {
+    return {nullptr, MAKE_ERROR(Error::kInvalidFormat)};
+  }
+  // The index must exist before the new name is added so that the alias
+  // search sees every name in the directory.
+  auto& index = GetDirectoryIndex(parent_dir_cluster);
+  auto entries = AllocateEntries(parent_dir_cluster, num_entries);
+  if (entries.empty()) {
     return {nullptr, MAKE_ERROR(Error::kNoEnoughMemory)};
   }
-  fat::SetFileName(*dir, filename);
-  dir->file_size = 0;
+  SetFileName(parent_dir_cluster, entries, filename);
+  auto dir = entries.back();
+  AddToIndex(index, filename, *dir);
+  for (auto e : entries) {
+    UnpinCluster(e);
+  }
   return {dir, MAKE_ERROR(Error::kSuccess)};
 }
 
 unsigned long AllocateClusterChain(size_t n) {
-  uint32_t* fat = GetFAT();
-  unsigned long first_cluster;
-  for (first_cluster = 2;; ++first_cluster) {
-    if (fat[first_cluster] == 0) {
-      fat[first_cluster] = kEndOfClusterchain;
-      break;
+  MutexGuard lock{fs_mutex};
+  return AllocateClusters(0, n).first;
+}
+
+unsigned long CountFreeClusters() {
+  MutexGuard lock{fs_mutex};
+  return num_free_clusters + freed_clusters.size();
+}
+
+void MarkDirty(const void* addr) {
+  MutexGuard lock{fs_mutex};
+  cluster_cache->MarkDirty(addr);
+}
+
+Error Flush() {
+  MutexGuard lock{fs_mutex};
+  // File data goes first, so that no FAT entry or directory entry on the
+  // device refers to clusters whose contents are only in memory.
+  if (auto err = cluster_cache->FlushData()) {
+    return err;
+  }
+
+  bool journaled = false;
+  if (journal_start != 0) {
+    if (auto blocks = CollectMetadataBlocks(); !blocks.empty()) {
+      auto [committed, err] = CommitJournal(blocks);
+      if (err) {
+        return err;
+      }
+      journaled = committed;
+      journal_stat.overflows += !committed;
     }
   }
 
-  if (n > 1) {
-    ExtendCluster(first_cluster, n - 1);
+  // Without the journal, the FAT is made durable before the directory
+  // entries, which may refer to newly allocated clusters. A crash in between
+  // leaves lost clusters at worst.
+  if (!journaled) {
+    if (auto err = volume_dev->Flush()) {
+      return err;
+    }
+  }
+  if (auto err = WriteBackFAT()) {
+    return err;
+  }
+  if (!journaled) {
+    if (auto err = volume_dev->Flush()) {
+      return err;
+    }
+  }
+  // directory clusters, which are the metadata buffers
+  if (auto err = cluster_cache->Flush()) {
+    return err;
+  }
+  if (fs_info && fs_info_dirty) {
+    fs_info_dirty = false;
+    if (auto err = volume_dev->Write(boot_volume_image->fs_info,
+                                     fs_info_sector.data(), 1)) {
+      return err;
+    }
+  }
+  if (auto err = volume_dev->Flush()) {
+    return err;
+  }
+
+  // Replaying the transaction again would be harmless, so the cleared header
+  // need not be durable before the next Flush.
+  if (journaled) {
+    if (auto err = WriteJournalHeader(0, 0)) {
+      return err;
+    }
+  }
+  ReleaseFreedClusters();
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error FormatJournal() {
+  MutexGuard lock{fs_mutex};
+  if (journal_start != 0) {
+    return MAKE_ERROR(Error::kSuccess);
+  }
+  const auto [first, num_sectors] = JournalRegion();
+  if (num_sectors == 0) {
+    return MAKE_ERROR(Error::kBufferTooSmall);
+  }
+
+  // Some formatters put boot code into the reserved area. Leave it alone.
+  std::vector<uint8_t> region(num_sectors * boot_volume_image->bytes_per_sector);
+  if (auto err = volume_dev->Read(first, region.data(), num_sectors)) {
+    return err;
+  }
+  for (auto b : region) {
+    if (b != 0) {
+      return MAKE_ERROR(Error::kAlreadyAllocated);
+    }
+  }
+
+  // Metadata modified so far is written in place before the journal exists.
+  if (auto err = Flush()) {
+    return err;
+  }
+  journal_start = first;
+  journal_stat = {num_sectors, 0, 0, 0};
+  journal_sequence = 0;
+  if (auto err = WriteJournalHeader(0, 0)) {
+    journal_start = 0;
+    return err;
+  }
+  return volume_dev->Flush();
+}
+
+JournalStat GetJournalStat() { return journal_stat; }
+
+BufferCacheStat CacheStat() {
+  MutexGuard lock{fs_mutex};
+  return cluster_cache->Stat();
+}
+
+void TaskWriteBack(uint64_t task_id, int64_t data) {
+  const int kTimerWriteBack = 1;
+  const unsigned long kInterval = kTimerFreq * 5;
+
+  __asm__("cli");
+  Task& task = task_manager->CurrentTask();
+  timer_manager->AddTimer(
+      Timer{timer_manager->CurrentTick() + kInterval, kTimerWriteBack, task_id});
+  __asm__("sti");
+
+  while (true) {
+    __asm__("cli");
+    auto msg = task.ReceiveMessage();
+    if (!msg) {
+      task.Sleep();
+      __asm__("sti");
+      continue;
+    }
+
+    __asm__("sti");
+
+    if (msg->type == Message::kTimerTimeout &&
+        msg->arg.timer.value == kTimerWriteBack) {
+      // Flush waits for fs_mutex, so it runs between whole updates of other
+      // tasks, and with interrupts enabled while the device works.
+      if (auto err = Flush()) {
+        Log(kError, "fat: write back failed: %s at %s:%d\n", err.Name(),
+            err.File(), err.Line());
+      }
+      __asm__("cli");
+      timer_manager->AddTimer(Timer{msg->arg.timer.timeout + kInterval,
+                                    kTimerWriteBack, task_id});
+      __asm__("sti");
+    }
   }
-  return first_cluster;
 }
 
 FileDescriptor::FileDescriptor(DirectoryEntry& fat_entry)
-    : fat_entry_{fat_entry} {}
+    : fat_entry_{fat_entry} {
+  PinCluster(&fat_entry_);
+}
+
+FileDescriptor::~FileDescriptor() { UnpinCluster(&fat_entry_); }
 
 size_t FileDescriptor::Read(void* buf, size_t len) {
-  if (rd_cluster_ == 0) {
-    rd_cluster_ = fat_entry_.FirstCluster();
+  MutexGuard lock{fs_mutex};
+  if (rd_off_ >= fat_entry_.file_size) {
+    return 0;
+  }
+  // Find the cluster again if the previous read stopped at the end of the
+  // chain, which may have been extended since, or if a chain was shortened.
+  if (rd_cluster_ == 0 || rd_cluster_ == kEndOfClusterchain ||
+      rd_gen_ != chain_generation) {
+    rd_cluster_ = rd_off_ < bytes_per_cluster
+                      ? fat_entry_.FirstCluster()
+                      : ClusterAt(rd_off_ / bytes_per_cluster);
+    rd_cluster_off_ = rd_off_ % bytes_per_cluster;
+    rd_gen_ = chain_generation;
   }
   uint8_t* buf8 = reinterpret_cast<uint8_t*>(buf);
   len = std::min(len, fat_entry_.file_size - rd_off_);
 
   size_t total = 0;
   while (total < len) {
-    uint8_t* sec = GetSectorByCluster<uint8_t>(rd_cluster_);
+    const size_t file_cluster = (rd_off_ + total) / bytes_per_cluster;
+    if (ra_enabled_ && file_cluster != ra_.prev_cluster) {
+      UpdateReadahead(file_cluster, file_cluster == ra_.prev_cluster + 1);
+    }
     size_t n = std::min(len - total, bytes_per_cluster - rd_cluster_off_);
-    memcpy(&buf8[total], &sec[rd_cluster_off_], n);
+    if (ReadCluster(rd_cluster_, rd_cluster_off_, &buf8[total], n)) {
+      break;
+    }
     total += n;
 
     rd_cluster_off_ += n;
@@ -276,59 +1565,396 @@ size_t FileDescriptor::Read(void* buf, size_t len) {
 }
 
 size_t FileDescriptor::Write(const void* buf, size_t len) {
-  auto num_cluster = [](size_t bytes) {
-    return (bytes + bytes_per_cluster - 1) / bytes_per_cluster;
+  MutexGuard lock{fs_mutex};
+  const size_t n = WriteAt(buf, len, wr_off_);
+  wr_off_ += n;
+  return n;
+}
+
+size_t FileDescriptor::WriteAt(const void* buf, size_t len, size_t offset) {
+  MutexGuard lock{fs_mutex};
+  const size_t file_size = fat_entry_.file_size;
+  if (offset > file_size &&
+      CopyToClusters(nullptr, offset - file_size, file_size) <
+          offset - file_size) {
+    return 0;
+  }
+  return CopyToClusters(reinterpret_cast<const uint8_t*>(buf), len, offset);
+}
+
+Error FileDescriptor::Truncate(size_t size) {
+  MutexGuard lock{fs_mutex};
+  if (size > fat_entry_.file_size) {
+    const size_t n = size - fat_entry_.file_size;
+    if (CopyToClusters(nullptr, n, fat_entry_.file_size) < n) {
+      return MAKE_ERROR(Error::kNoEnoughMemory);
+    }
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  const size_t keep = (size + bytes_per_cluster - 1) / bytes_per_cluster;
+  unsigned long tail = fat_entry_.FirstCluster();
+  if (keep == 0) {
+    fat_entry_.first_cluster_low = 0;
+    fat_entry_.first_cluster_high = 0;
+  } else if (tail != 0) {
+    const auto last = ClusterAt(keep - 1);
+    if (last == kEndOfClusterchain) {
+      return MAKE_ERROR(Error::kInvalidFile);
+    }
+    tail = NextCluster(last);
+    SetFATEntry(last, kEndOfClusterchain);
+  }
+  if (tail != 0 && tail != kEndOfClusterchain) {
+    FreeClusterChain(tail);
+  }
+
+  fat_entry_.file_size = size;
+  MarkDirty(&fat_entry_);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+size_t FileDescriptor::Load(void* buf, size_t len, size_t offset) {
+  MutexGuard lock{fs_mutex};
+  if (offset >= fat_entry_.file_size) {
+    return 0;
+  }
+
+  // Loads come from page faults of file mappings, so follow them here; the
+  // temporary descriptor below would forget the window. A fault spanning two
+  // clusters is no stream, so only a load starting where the previous one
+  // ended counts as sequential.
+  const size_t end = std::min<size_t>(offset + len, fat_entry_.file_size);
+  UpdateReadahead(offset / bytes_per_cluster, offset == ra_.load_end);
+  ra_.prev_cluster = (end - 1) / bytes_per_cluster;
+  ra_.load_end = end;
+
+  FileDescriptor fd{fat_entry_};
+  fd.ra_enabled_ = false;
+  fd.rd_off_ = offset;
+  fd.rd_cluster_ = ClusterAt(offset / bytes_per_cluster);
+  fd.rd_cluster_off_ = offset % bytes_per_cluster;
+  fd.rd_gen_ = chain_generation;
+  return fd.Read(buf, len);
+}
+
+bool FileDescriptor::TryLockLoad() { return fs_mutex.TryLock(); }
+
+void FileDescriptor::UnlockLoad() { fs_mutex.Unlock(); }
+
+void FileDescriptor::UpdateReadahead(size_t file_cluster, bool sequential) {
+  ra_.prev_cluster = file_cluster;
+  if (!sequential) {
+    ra_.size = 0;
+    return;
+  }
+
+  size_t next;
+  if (ra_.size == 0) {
+    next = file_cluster + 1;
+    ra_.size = kInitialReadahead;
+  } else if (file_cluster >= ra_.start) {
+    // Entered the latest window: keep one window ahead of the reader.
+    next = ra_.start + ra_.size;
+    ra_.size = std::min(ra_.size * 2, kMaxReadahead);
+  } else {
+    return;
+  }
+  ra_.start = next;
+
+  const size_t num_clusters =
+      (fat_entry_.file_size + bytes_per_cluster - 1) / bytes_per_cluster;
+  const size_t end = std::min(next + ra_.size, num_clusters);
+  // prefetch each run of clusters which are contiguous on the volume
+  size_t c = next;
+  while (c < end) {
+    const unsigned long cluster = ClusterAt(c);
+    if (cluster == kEndOfClusterchain) {
+      break;
+    }
+    size_t n = 1;
+    while (c + n < end && ClusterAt(c + n) == cluster + n) {
+      ++n;
+    }
+    if (auto err = cluster_cache->Prefetch(cluster - 2, n)) {
+      Log(kWarn, "fat: readahead failed: %s\n", err.Name());
+      break;
+    }
+    c += n;
+  }
+}
+
+void FileDescriptor::BuildExtents() {
+  extents_.clear();
+  extents_gen_ = chain_generation;
+
+  size_t file_cluster = 0;
+  unsigned long cluster = fat_entry_.FirstCluster();
+  while (cluster != 0 && cluster != kEndOfClusterchain) {
+    if (!extents_.empty()) {
+      auto& last = extents_.back();
+      if (last.cluster + last.count == cluster) {
+        ++last.count;
+        ++file_cluster;
+        cluster = NextCluster(cluster);
+        continue;
+      }
+    }
+    extents_.push_back({file_cluster, cluster, 1});
+    ++file_cluster;
+    cluster = NextCluster(cluster);
+  }
+}
+
+unsigned long FileDescriptor::ClusterAt(size_t file_cluster) {
+  return RunAt(file_cluster).first;
+}
+
+std::pair<unsigned long, size_t> FileDescriptor::RunAt(size_t file_cluster) {
+  auto find = [&]() -> std::pair<unsigned long, size_t> {
+    auto it = std::upper_bound(
+        extents_.begin(), extents_.end(), file_cluster,
+        [](size_t i, const Extent& e) { return i < e.file_cluster; });
+    if (it == extents_.begin()) {
+      return {kEndOfClusterchain, 0};
+    }
+    --it;
+    if (file_cluster >= it->file_cluster + it->count) {
+      return {kEndOfClusterchain, 0};
+    }
+    const size_t skip = file_cluster - it->file_cluster;
+    return {it->cluster + skip, it->count - skip};
   };
 
-  if (wr_cluster_ == 0) {
-    if (fat_entry_.FirstCluster() != 0) {
-      wr_cluster_ = fat_entry_.FirstCluster();
+  if (extents_gen_ != chain_generation) {
+    BuildExtents();
+  }
+  if (auto run = find(); run.first != kEndOfClusterchain) {
+    return run;
+  }
+  // The chain may have been extended through another descriptor.
+  BuildExtents();
+  return find();
+}
+
+size_t FileDescriptor::ChainLength() {
+  if (extents_gen_ != chain_generation || extents_.empty()) {
+    BuildExtents();
+  } else {
+    // The chain may have been extended through another descriptor.
+    const auto& last = extents_.back();
+    if (NextCluster(last.cluster + last.count - 1) != kEndOfClusterchain) {
+      BuildExtents();
+    }
+  }
+  if (extents_.empty()) {
+    return 0;
+  }
+  return extents_.back().file_cluster + extents_.back().count;
+}
+
+size_t FileDescriptor::ReserveClusters(size_t n) {
+  const size_t length = ChainLength();
+  if (length >= n) {
+    return length;
+  }
+
+  unsigned long first;
+  if (length == 0) {
+    first = AllocateClusters(0, n).first;
+    if (first == 0) {
+      return 0;
+    }
+    fat_entry_.first_cluster_low = first & 0xffff;
+    fat_entry_.first_cluster_high = (first >> 16) & 0xffff;
+    MarkDirty(&fat_entry_);
+  } else {
+    const auto& last = extents_.back();
+    first = AllocateClusters(last.cluster + last.count - 1, n - length).first;
+    if (first == 0) {
+      return length;
+    }
+  }
+
+  // append the new clusters to the extent map instead of rebuilding it
+  size_t file_cluster = length;
+  for (auto c = first; c != kEndOfClusterchain; c = NextCluster(c)) {
+    if (!extents_.empty() &&
+        extents_.back().cluster + extents_.back().count == c) {
+      ++extents_.back().count;
     } else {
-      wr_cluster_ = AllocateClusterChain(num_cluster(len));
-      fat_entry_.first_cluster_low = wr_cluster_ & 0xffff;
-      fat_entry_.first_cluster_high = (wr_cluster_ >> 16) & 0xffff;
+      extents_.push_back({file_cluster, c, 1});
     }
+    ++file_cluster;
   }
+  return file_cluster;
+}
 
-  const uint8_t* buf8 = reinterpret_cast<const uint8_t*>(buf);
+size_t FileDescriptor::CopyToClusters(const uint8_t* src, size_t len,
+                                      size_t offset) {
+  // file_size is a 32-bit field
+  const size_t max_end = 0xffffffffu;
+  if (offset >= max_end) {
+    return 0;
+  }
+  size_t end = std::min(max_end, offset + len);
+  const size_t num_clusters =
+      ReserveClusters((end + bytes_per_cluster - 1) / bytes_per_cluster);
+  end = std::min(end, num_clusters * bytes_per_cluster);
 
-  size_t total = 0;
-  while (total < len) {
-    if (wr_cluster_off_ == bytes_per_cluster) {
-      const auto next_cluster = NextCluster(wr_cluster_);
-      if (next_cluster == kEndOfClusterchain) {
-        wr_cluster_ = ExtendCluster(wr_cluster_, num_cluster(len - total));
-      } else {
-        wr_cluster_ = next_cluster;
+  size_t pos = offset;
+  while (pos < end) {
+    const auto [cluster, run] = RunAt(pos / bytes_per_cluster);
+    if (cluster == kEndOfClusterchain) {
+      break;
+    }
+    const size_t cluster_off = pos % bytes_per_cluster;
+    const uint8_t* from = src ? &src[pos - offset] : nullptr;
+
+    // whole clusters contiguous on the volume, written directly if the
+    // device can reach the source, e.g. not for a buffer of an application
+    const size_t whole =
+        cluster_off == 0 ? std::min(run, (end - pos) / bytes_per_cluster) : 0;
+    if (from && whole >= kMinWriteThrough &&
+        volume_dev->CanTransfer(from, whole * bytes_per_cluster)) {
+      if (cluster_cache->WriteThrough(cluster - 2, whole, from)) {
+        break;
       }
-      wr_cluster_off_ = 0;
+      pos += whole * bytes_per_cluster;
+      continue;
     }
 
-    uint8_t* sec = GetSectorByCluster<uint8_t>(wr_cluster_);
-    size_t n = std::min(len, bytes_per_cluster - wr_cluster_off_);
-    memcpy(&sec[wr_cluster_off_], &buf8[total], n);
-    total += n;
+    const size_t n = std::min(end - pos, bytes_per_cluster - cluster_off);
+    if (WriteCluster(cluster, cluster_off, from, n)) {
+      break;
+    }
+    pos += n;
+  }
 
-    wr_cluster_off_ += n;
+  if (pos > fat_entry_.file_size) {
+    fat_entry_.file_size = pos;
+    MarkDirty(&fat_entry_);
   }
+  return pos - offset;
+}
 
-  wr_off_ += total;
-  fat_entry_.file_size = wr_off_;
-  return total;
+namespace {
+class DirectoryIterator : public vfs::DirectoryIterator {
+ public:
+  DirectoryIterator(FileSystem& fs, unsigned long dir_cluster)
+      : fs_{fs}, reader_{dir_cluster} {}
+
+  vfs::Vnode* Next(char* name) override {
+    MutexGuard lock{fs_mutex};
+    auto entry = reader_.Next(name);
+    return entry ? fs_.GetVnode(*entry) : nullptr;
+  }
+
+ private:
+  FileSystem& fs_;
+  DirectoryReader reader_;
+};
+}  // namespace
+
+static_assert(kMaxNameBytes <= vfs::kMaxNameBytes);
+
+Vnode::Vnode(FileSystem& fs, EntryLocation loc) : fs_{fs}, loc_{loc} {}
+
+DirectoryEntry* Vnode::Entry() const { return GetEntry(loc_); }
+
+vfs::FileType Vnode::Type() const {
+  MutexGuard lock{fs_mutex};
+  auto entry = Entry();
+  if (entry == nullptr || (static_cast<uint8_t>(entry->attr) &
+                           static_cast<uint8_t>(Attribute::kDirectory))) {
+    return vfs::FileType::kDirectory;
+  }
+  return vfs::FileType::kRegular;
 }
 
-size_t FileDescriptor::Load(void* buf, size_t len, size_t offset) {
-  FileDescriptor fd{fat_entry_};
-  fd.rd_off_ = offset;
+size_t Vnode::Size() const {
+  MutexGuard lock{fs_mutex};
+  return Type() == vfs::FileType::kDirectory ? 0 : Entry()->file_size;
+}
 
-  unsigned long cluster = fat_entry_.FirstCluster();
-  while (offset >= bytes_per_cluster) {
-    offset -= bytes_per_cluster;
-    cluster = NextCluster(cluster);
+vfs::FileStat Vnode::Stat() const {
+  MutexGuard lock{fs_mutex};
+  auto stat = vfs::Vnode::Stat();
+  auto entry = Entry();
+  if (entry == nullptr) {  // the root directory has no entry
+    stat.attr = static_cast<uint8_t>(Attribute::kDirectory);
+    return stat;
   }
-  fd.rd_cluster_ = cluster;
-  fd.rd_cluster_off_ = offset;
-  return fd.Read(buf, len);
+  stat.attr = static_cast<uint8_t>(entry->attr);
+  stat.create_date = entry->create_date;
+  stat.create_time = entry->create_time;
+  stat.write_date = entry->write_date;
+  stat.write_time = entry->write_time;
+  stat.access_date = entry->last_access_date;
+  return stat;
+}
+
+vfs::Vnode* Vnode::Lookup(const char* name) {
+  MutexGuard lock{fs_mutex};
+  if (Type() != vfs::FileType::kDirectory) {
+    return nullptr;
+  }
+  auto entry = LookupEntry(DirectoryCluster(), name);
+  return entry ? fs_.GetVnode(*entry) : nullptr;
+}
+
+WithError<vfs::Vnode*> Vnode::Create(const char* name) {
+  MutexGuard lock{fs_mutex};
+  if (Type() != vfs::FileType::kDirectory) {
+    return {nullptr, MAKE_ERROR(Error::kNotDirectory)};
+  }
+  auto [entry, err] = CreateFile(name, DirectoryCluster());
+  if (err) {
+    return {nullptr, err};
+  }
+  return {fs_.GetVnode(*entry), MAKE_ERROR(Error::kSuccess)};
+}
+
+Error Vnode::Truncate(size_t size) {
+  MutexGuard lock{fs_mutex};
+  if (Type() == vfs::FileType::kDirectory) {
+    return MAKE_ERROR(Error::kIsDirectory);
+  }
+  return FileDescriptor{*Entry()}.Truncate(size);
+}
+
+std::unique_ptr<vfs::DirectoryIterator> Vnode::ReadDir() {
+  MutexGuard lock{fs_mutex};
+  if (Type() != vfs::FileType::kDirectory) {
+    return nullptr;
+  }
+  return std::make_unique<DirectoryIterator>(fs_, DirectoryCluster());
+}
+
+std::unique_ptr<::FileDescriptor> Vnode::OpenFile() {
+  MutexGuard lock{fs_mutex};
+  return std::make_unique<FileDescriptor>(*Entry());
+}
+
+unsigned long Vnode::DirectoryCluster() const {
+  MutexGuard lock{fs_mutex};
+  auto entry = Entry();
+  if (entry == nullptr || entry->FirstCluster() == 0) {
+    return boot_volume_image->root_cluster;
+  }
+  return entry->FirstCluster();
+}
+
+FileSystem::FileSystem() : root_{*this, {0, 0}} {}
+
+Vnode* FileSystem::GetVnode(DirectoryEntry& entry) {
+  MutexGuard lock{fs_mutex};
+  const auto loc = LocateEntry(entry);
+  auto& vnode = vnodes_[uint64_t{loc.cluster} << 32 | loc.index];
+  if (!vnode) {
+    vnode = std::make_unique<Vnode>(*this, loc);
+  }
+  return vnode.get();
 }
 
 }  // namespace fat
\ No newline at end of file
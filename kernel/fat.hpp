@@ -6,9 +6,14 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
+#include "block.hpp"
 #include "error.hpp"
 #include "file.hpp"
+#include "vfs.hpp"
 
 namespace fat {
 
@@ -43,6 +48,17 @@ struct BPB {
   char fs_type[8];
 } __attribute__((packed));
 
+// FSInfo sector structure (FAT32 only)
+struct FSInfo {
+  uint32_t lead_signature;
+  uint8_t reserved1[480];
+  uint32_t struct_signature;
+  uint32_t free_count;
+  uint32_t next_free;
+  uint8_t reserved2[12];
+  uint32_t trail_signature;
+} __attribute__((packed));
+
 // Attribute flags for directory entries
 enum class Attribute : uint8_t {
   kReadOnly = 0x01,
@@ -75,23 +91,68 @@ struct DirectoryEntry {
   }
 } __attribute__((packed));
 
-// Pointer to the boot volume image
+// Long file name (VFAT) directory entry structure. A long name is stored in
+// UTF-16, 13 characters per entry, in entries placed right before the short
+// entry in reverse order.
+struct LongNameEntry {
+  uint8_t ord;  // sequence number (1-20), 0x40 is set on the last one
+  uint16_t name1[5];
+  Attribute attr;  // always kLongName
+  uint8_t type;
+  uint8_t checksum;  // checksum of the short name
+  uint16_t name2[6];
+  uint16_t first_cluster_low;
+  uint16_t name3[2];
+} __attribute__((packed));
+
+// Bytes needed for a file name in UTF-8, including the terminating null
+const size_t kMaxNameBytes = 255 * 3 + 1;
+
+// Pointer to the in-memory copy of the boot sector of the volume
 extern BPB* boot_volume_image;
 extern unsigned long bytes_per_cluster;
-// Initializes the volume image
-void Initialize(void* volume_image);
+/** @brief Mounts the FAT volume stored on the block device.
+ * The boot sector, the FSInfo sector and the FAT are kept in memory. Clusters
+ * are read through a buffer cache and written back by Flush.
+ */
+void Initialize(BlockDevice& dev);
+/** @brief Mounts the volume image in memory through a RAM disk.
+ *
+ * @param volume_image Start of the volume
+ * @param image_bytes Number of bytes of the volume present in memory. Reads
+ * beyond it fail; mount the whole volume from a block device before
+ * accessing data clusters in that case.
+ */
+void Initialize(void* volume_image, size_t image_bytes);
+/** @brief Returns true if block 0 of the device is the FAT32 boot sector of
+ * the volume whose image starts at boot_sector. The whole BPB, the volume
+ * serial number included, has to match, so that another FAT32 disk is not
+ * taken for the boot volume.
+ */
+bool IsSameVolume(BlockDevice& dev, const void* boot_sector);
 
-/** @brief Returns the memory address where the first sector of the specified
+/** @brief Returns the memory address where the cached copy of the specified
  *cluster is located.
+ *
+ * The cluster is cached as metadata. The address is valid until the next call
+ * which reads a cluster, unless the buffer is pinned with PinCluster. Call
+ * MarkDirty after modifying the buffer.
  *@param cluster Cluster number (starting from 2)
- *@return The memory address where the first sector of the cluster is located
+ *@return The memory address where the cached cluster is located
  */
 uintptr_t GetClusterAddr(unsigned long cluster);
-/** @brief Returns a pointer to the memory area where the first sector of the
- *specified cluster is located.
+/** @brief Keeps the cached cluster containing the address in memory, so that
+ * pointers into it stay valid until UnpinCluster is called for it.
+ *
+ * @param addr Any address within a buffer returned by GetClusterAddr
+ */
+void PinCluster(const void* addr);
+/** @brief Releases a pin taken by PinCluster. */
+void UnpinCluster(const void* addr);
+/** @brief Returns a pointer to the memory area where the cached copy of the
+ *specified cluster is located. See GetClusterAddr.
  *@param cluster Cluster number (starting from 2)
- *@return A pointer to the memory area where the first sector of the cluster is
- *located
+ *@return A pointer to the memory area where the cached cluster is located
  */
 template <class T>
 T* GetSectorByCluster(unsigned long cluster) {
@@ -108,7 +169,8 @@ void ReadName(const DirectoryEntry& entry, char* base, char* ext);
 
 /** @brief Copy the short name of the directory entry to dest.
  * Copy "<base>" if the short name extension is empty, otherwise copy "<base>.
- * <ext>" if the short name extension is not empty.
+ * <ext>" if the short name extension is not empty. The base name and the
+ * extension are lower cased if the entry says so in ntres.
  *
  * @param entry Target directory entry from which the file name is obtained.
  * @param dest An array large enough to contain the concatenated string of the
@@ -125,9 +187,36 @@ static const unsigned long kEndOfClusterchain = 0x0ffffffflu;
  */
 unsigned long NextCluster(unsigned long cluster);
 
+/** @brief DirectoryReader walks the entries of a directory and assembles
+ * their long names.
+ */
+class DirectoryReader {
+ public:
+  explicit DirectoryReader(unsigned long dir_cluster);
+  /** @brief Returns the next file or directory entry. Deleted entries, long
+   * name entries and the volume label are skipped.
+   *
+   * @param name Buffer of kMaxNameBytes bytes which receives the long name of
+   * the entry in UTF-8, or its formatted short name if it has no valid one
+   * @return The short entry, or nullptr at the end of the directory
+   */
+  DirectoryEntry* Next(char* name);
+
+ private:
+  unsigned long cluster_;
+  size_t index_{0};
+  uint16_t long_name_[20 * 13];
+  // ord of the long name entry expected next, 0 if none, -1 if the long name
+  // is complete
+  int next_ord_{0};
+  size_t long_name_len_{0};  // upper bound of the assembled name length
+  uint8_t checksum_{0};
+};
+
 /** @brief Search for files in the specified directory.
  *
- * @param name 8+3 format file name (case insensitive)
+ * @param name File name, either the long name or the 8+3 format short name
+ * (case insensitive)
  * @param directory_cluster The starting cluster of the directory (if omitted,
  * search from the root directory)
  * @return An entry representing a file or directory, followed by a pair of
@@ -155,7 +244,9 @@ bool IsEndOfClusterchain(unsigned long cluster);
 uint32_t* GetFAT();
 
 /** @brief Extend the cluster chain by the specified number of clusters.
- * * @param eoc_cluster
+ * New clusters are taken from the free cluster bitmap, preferring a run
+ * which directly follows the current end of the chain.
+ *
  * @param eoc_cluster Cluster number of one of the clusters in the cluster chain
  * to be decompressed
  * @param n number of clusters to be decompressed
@@ -163,53 +254,270 @@ uint32_t* GetFAT();
  */
 unsigned long ExtendCluster(unsigned long eoc_cluster, size_t n);
 
-/** @brief Return one free entry in the specified directory.
- * If the directory is full, the cluster is extended by one to make room for a
- * free entry.
+/** @brief Return consecutive free entries in the specified directory.
+ * If the directory has no such run, the directory is extended to make room.
  *
- * @param dir_cluster directory to look for a free entry
- * @return free entry
+ * @param dir_cluster directory to look for free entries
+ * @param n number of entries
+ * @return free entries in directory order, or an empty vector on failure.
+ * The clusters of the entries are pinned, so call UnpinCluster for each
+ * entry once done with them.
+ */
+std::vector<DirectoryEntry*> AllocateEntries(unsigned long dir_cluster,
+                                             size_t n);
+
+/** @brief Returns the number of directory entries needed to store the name,
+ * i.e. 1 for a short name and 1 + the number of long name entries otherwise.
+ * Returns 0 if the name is too long.
  */
-DirectoryEntry* AllocateEntry(unsigned long dir_cluster);
+size_t NumEntriesForName(const char* name);
 
-/** @brief Set short file name for directory entry.
+/** @brief Set file name for directory entries.
+ *
+ * The last entry receives the short name. A name which does not fit the 8.3
+ * format is stored as a long name in the preceding entries, and the short
+ * name becomes an alias like "LONGNA~1.TXT" which is unique in the directory.
+ * All entries are cleared first.
  *
- * @param entry Directory entry for which the file name is to be set.
+ * @param dir_cluster Directory which contains the entries
+ * @param entries NumEntriesForName(name) entries from AllocateEntries
  * @param name File name consisting of base name and extension joined by dots
  */
-void SetFileName(DirectoryEntry& entry, const char* name);
+void SetFileName(unsigned long dir_cluster,
+                 const std::vector<DirectoryEntry*>& entries,
+                 const char* name);
 
 /** @brief Create a file entry at the specified path.
  *
  * @param path File path
+ * @param directory_cluster The directory a relative path starts from (if
+ * omitted, the root directory)
  * @return Newly created file entry
  */
-WithError<DirectoryEntry*> CreateFile(const char* path);
+WithError<DirectoryEntry*> CreateFile(const char* path,
+                                      unsigned long directory_cluster = 0);
 
 /** @brief Construct a chain consisting of the specified number of free
- * clusters.
+ * clusters. A contiguous run is used if the volume has one.
  *
  * @param n number of clusters
  * @return First cluster number of the constructed chain
  */
 unsigned long AllocateClusterChain(size_t n);
 
+/** @brief Returns the number of free clusters in the volume. */
+unsigned long CountFreeClusters();
+
+/** @brief Records that a cached cluster buffer has been modified.
+ *
+ * @param addr Any address within a buffer returned by GetClusterAddr, such as
+ * a DirectoryEntry
+ */
+void MarkDirty(const void* addr);
+
+/** @brief Writes modified data clusters, the FATs, directory clusters and
+ * the FSInfo sector back to the block device in this order. Every FAT copy
+ * receives the same modified sectors.
+ *
+ * With a journal, the FAT sectors and directory clusters are committed to it
+ * before they are written in place, so a crash leaves the volume either
+ * before or after the whole Flush. Clusters freed since the previous Flush
+ * are not reused until it completes.
+ */
+Error Flush();
+
+struct JournalStat {
+  unsigned long sectors;  // size of the journal, 0 if the volume has none
+  // transactions committed, flushes too large for the journal, and
+  // transactions replayed at mount
+  unsigned long commits, overflows, replays;
+};
+
+/** @brief Sets up an empty journal in the reserved sectors after the backup
+ * boot sectors. The journal is found again when the volume is mounted.
+ *
+ * @return kBufferTooSmall if the reserved area has too few spare sectors,
+ * kAlreadyAllocated if they are not all zero
+ */
+Error FormatJournal();
+
+/** @brief Returns the state of the journal of the mounted volume. */
+JournalStat GetJournalStat();
+
+/** @brief Returns the statistics of the cluster buffer cache. */
+BufferCacheStat CacheStat();
+
+/** @brief A task which calls Flush periodically. */
+void TaskWriteBack(uint64_t task_id, int64_t data);
+
 class FileDescriptor : public ::FileDescriptor {
  public:
+  /** @brief The cluster holding fat_entry stays pinned while the file
+   * descriptor exists.
+   */
   explicit FileDescriptor(DirectoryEntry& fat_entry);
+  ~FileDescriptor();
+  FileDescriptor(const FileDescriptor&) = delete;
+  FileDescriptor& operator=(const FileDescriptor&) = delete;
   size_t Read(void* buf, size_t len) override;
   size_t Write(const void* buf, size_t len) override;
   size_t Size() const override { return fat_entry_.file_size; }
   size_t Load(void* buf, size_t len, size_t offset) override;
+  bool TryLockLoad() override;
+  void UnlockLoad() override;
+
+  /** @brief Writes len bytes at the offset without moving the write
+   * position.
+   *
+   * All clusters the write needs are allocated up front in one go. A range
+   * between the end of the file and the offset is filled with zeros.
+   *
+   * @return Number of bytes written, less than len if the volume is full or
+   * the file would exceed 4 GiB - 1
+   */
+  size_t WriteAt(const void* buf, size_t len, size_t offset) override;
+  /** @brief Changes the file size. Clusters past the new end are freed, and
+   * the file is extended with zeros if it grows.
+   */
+  Error Truncate(size_t size);
 
  private:
+  /** @brief A run of clusters which are contiguous both in the file and on
+   * the volume.
+   */
+  struct Extent {
+    size_t file_cluster;    // index of the first cluster within the file
+    unsigned long cluster;  // cluster number of the first cluster
+    size_t count;           // number of clusters in the run
+  };
+
+  /** @brief Sequential access detection for readahead. The window grows
+   * from kInitialReadahead to kMaxReadahead clusters while the file is read
+   * sequentially and is dropped on a random access.
+   */
+  struct Readahead {
+    size_t prev_cluster;  // file cluster accessed last
+    size_t start;         // first file cluster of the latest window
+    size_t size;          // size of the latest window, 0 if not sequential
+    size_t load_end;      // offset where the latest Load ended
+  };
+  static constexpr size_t kInitialReadahead = 4;
+  static constexpr size_t kMaxReadahead = 64;
+  /** @brief Runs of at least this many whole clusters are written to the
+   * device directly instead of through the cluster cache.
+   */
+  static constexpr size_t kMinWriteThrough = 8;
+
   DirectoryEntry& fat_entry_;
+  /** @brief Extent map of the cluster chain, sorted by file_cluster.
+   * Built lazily on the first random access or write, extended as clusters
+   * are appended and rebuilt when a chain of the volume is shortened.
+   */
+  std::vector<Extent> extents_{};
+  unsigned long extents_gen_ = 0;  // chain generation extents_ was built at
   size_t rd_off_ = 0;
   unsigned long rd_cluster_ = 0;
   size_t rd_cluster_off_ = 0;
+  unsigned long rd_gen_ = 0;  // chain generation rd_cluster_ was found at
   size_t wr_off_ = 0;
-  unsigned long wr_cluster_ = 0;
-  size_t wr_cluster_off_ = 0;
+  Readahead ra_{~static_cast<size_t>(0), 0, 0, ~static_cast<size_t>(0)};
+  bool ra_enabled_ = true;
+
+  /** @brief Updates the readahead window for an access to the specified
+   * cluster index of the file and prefetches the next window when the
+   * access enters the latest one.
+   *
+   * @param sequential true if the access continues the previous one, false
+   *    to drop the window
+   */
+  void UpdateReadahead(size_t file_cluster, bool sequential);
+  void BuildExtents();
+  /** @brief Returns the number of clusters in the chain of the file,
+   * updating extents_ if the chain has changed.
+   */
+  size_t ChainLength();
+  /** @brief Makes the chain at least n clusters long with one allocation.
+   *
+   * @return The new chain length, less than n if the volume is full
+   */
+  size_t ReserveClusters(size_t n);
+  /** @brief Copies len bytes from src, or zeros if src is nullptr, to the
+   * offset of the file. Clusters have to be reserved beforehand.
+   *
+   * @return Number of bytes written
+   */
+  size_t CopyToClusters(const uint8_t* src, size_t len, size_t offset);
+  /** @brief Returns the cluster number holding the specified cluster index of
+   * the file.
+   *
+   * @param file_cluster Cluster index within the file (starting from 0)
+   * @return Cluster number (or kEndOfClusterchain if the file is shorter)
+   */
+  unsigned long ClusterAt(size_t file_cluster);
+  /** @brief Returns the cluster number holding the specified cluster index
+   * and the number of clusters which follow it contiguously on the volume,
+   * itself included. {kEndOfClusterchain, 0} if the file is shorter.
+   */
+  std::pair<unsigned long, size_t> RunAt(size_t file_cluster);
+};
+
+class FileSystem;
+
+/** @brief EntryLocation identifies a directory entry on the volume. */
+struct EntryLocation {
+  unsigned long cluster;  // directory cluster, 0 for the root's own entry
+  size_t index;           // index of the entry within the cluster
+};
+
+/** @brief Vnode is a file or directory of the FAT volume. */
+class Vnode : public vfs::Vnode {
+ public:
+  /** @param loc Location of the directory entry of the file, {0, 0} for the
+   * root
+   */
+  Vnode(FileSystem& fs, EntryLocation loc);
+  vfs::FileType Type() const override;
+  size_t Size() const override;
+  vfs::FileStat Stat() const override;
+  vfs::Vnode* Lookup(const char* name) override;
+  WithError<vfs::Vnode*> Create(const char* name) override;
+  Error Truncate(size_t size) override;
+  std::unique_ptr<vfs::DirectoryIterator> ReadDir() override;
+
+  /** @brief Returns the directory entry, nullptr for the root. The pointer
+   * is valid until the next call which reads a cluster.
+   */
+  DirectoryEntry* Entry() const;
+
+ protected:
+  std::unique_ptr<::FileDescriptor> OpenFile() override;
+
+ private:
+  FileSystem& fs_;
+  EntryLocation loc_;
+
+  /** @brief Returns the first cluster of this directory. */
+  unsigned long DirectoryCluster() const;
+};
+
+/** @brief FileSystem makes the FAT volume mountable in the VFS.
+ *
+ * Vnodes are cached by the location of their directory entry, as directory
+ * clusters may be evicted from the cache and read again at another address.
+ * It has to be created after Initialize and must not be used once the volume
+ * is initialized again.
+ */
+class FileSystem : public vfs::FileSystem {
+ public:
+  FileSystem();
+  vfs::Vnode& Root() override { return root_; }
+  /** @brief Returns the vnode of the entry, creating it on the first call. */
+  Vnode* GetVnode(DirectoryEntry& entry);
+
+ private:
+  Vnode root_;
+  // key: directory cluster << 32 | index of the entry within the cluster
+  std::unordered_map<uint64_t, std::unique_ptr<Vnode>> vnodes_{};
 };
 
 }  // namespace fat
\ No newline at end of file
@@ -4,6 +4,10 @@
 
 #include "error.hpp"
 
+namespace vfs {
+class Vnode;
+}
+
 class FileDescriptor {
  public:
   virtual ~FileDescriptor() = default;
@@ -14,6 +18,32 @@ class FileDescriptor {
   /** @brief Load reads file content without changing internal offset
    */
   virtual size_t Load(void* buf, size_t len, size_t offset) = 0;
+  /** @brief Takes what Load needs to wait for, unless another task holds it,
+   * for callers which must not sleep like the page fault handler. A
+   * successful call is followed by Load and then UnlockLoad.
+   *
+   * @return false if Load would have to wait
+   */
+  virtual bool TryLockLoad() { return true; }
+  virtual void UnlockLoad() {}
+  /** @brief WriteAt writes file content at the offset without changing
+   * internal offset. Files which cannot be written at an offset, like a
+   * terminal or a pipe, write nothing.
+   *
+   * @return Number of bytes written
+   */
+  virtual size_t WriteAt(const void* buf, size_t len, size_t offset) {
+    return 0;
+  }
+
+  /** @brief Returns the file this descriptor was opened from, or nullptr if
+   * it is not a file of the VFS, like a terminal or a pipe.
+   */
+  vfs::Vnode* Node() const { return node_; }
+
+ private:
+  friend class vfs::Vnode;
+  vfs::Vnode* node_ = nullptr;
 };
 
 size_t PrintToFD(FileDescriptor& fd, const char* format, ...);
@@ -48,10 +48,18 @@ void WriteAscii(PixelWriter& writer, Vector2D<int> pos, char c,
     return;
   }
   for (int dy = 0; dy < 16; ++dy) {
-    for (int dx = 0; dx < 8; ++dx) {
-      if ((font[dy] << dx) & 0x80u) {
-        writer.Write(pos + Vector2D<int>{dx, dy}, color);
+    // fill each run of set bits in the row with one span
+    for (int dx = 0; dx < 8;) {
+      if (((font[dy] << dx) & 0x80u) == 0) {
+        ++dx;
+        continue;
       }
+      const int run_start = dx;
+      while (dx < 8 && ((font[dy] << dx) & 0x80u)) {
+        ++dx;
+      }
+      writer.FillSpan(pos + Vector2D<int>{run_start, dy}, dx - run_start,
+                      color);
     }
   }
 }
@@ -151,11 +159,19 @@ Error WriteUnicode(PixelWriter& writer, Vector2D<int> pos, char32_t c,
     if (bitmap.pitch < 0) {
       q -= bitmap.pitch * bitmap.rows;
     }
-    for (int dx = 0; dx < bitmap.width; ++dx) {
-      const bool b = q[dx >> 3] & (0x80 >> (dx & 0x7));
-      if (b) {
-        writer.Write(glyph_topleft + Vector2D<int>{dx, dy}, color);
+    auto bit = [q](int dx) { return q[dx >> 3] & (0x80 >> (dx & 0x7)); };
+    const int width = bitmap.width;
+    for (int dx = 0; dx < width;) {
+      if (!bit(dx)) {
+        ++dx;
+        continue;
+      }
+      const int run_start = dx;
+      while (dx < width && bit(dx)) {
+        ++dx;
       }
+      writer.FillSpan(glyph_topleft + Vector2D<int>{run_start, dy},
+                      dx - run_start, color);
     }
   }
 
@@ -1,5 +1,7 @@
 #include "frame_buffer.hpp"
 
+#include "blit.hpp"
+
 namespace {
 int BytesPerPixel(PixelFormat format) {
   switch (format) {
@@ -22,6 +24,21 @@ Vector2D<int> FrameBufferSize(const FrameBufferConfig& config) {
   return {static_cast<int>(config.horizontal_resolution),
           static_cast<int>(config.vertical_resolution)};
 }
+
+/** @brief Clips src_area placed at dst_pos to both buffers and returns the
+ * area in dst. The source of its origin is written to src_start_pos. */
+Rectangle<int> CopyArea(Vector2D<int> dst_pos, const FrameBufferConfig& dst,
+                        const FrameBufferConfig& src,
+                        const Rectangle<int>& src_area,
+                        Vector2D<int>& src_start_pos) {
+  const Rectangle<int> src_area_shifted{dst_pos, src_area.size};
+  const Rectangle<int> src_outline{dst_pos - src_area.pos,
+                                   FrameBufferSize(src)};
+  const Rectangle<int> dst_outline{{0, 0}, FrameBufferSize(dst)};
+  const auto copy_area = dst_outline & src_outline & src_area_shifted;
+  src_start_pos = copy_area.pos - (dst_pos - src_area.pos);
+  return copy_area;
+}
 }  // namespace
 
 Error FrameBuffer::Initialize(const FrameBufferConfig& config) {
@@ -66,18 +83,51 @@ Error FrameBuffer::Copy(Vector2D<int> dst_pos, const FrameBuffer& src,
     return MAKE_ERROR(Error::kUnknownPixelFormat);
   }
 
-  const Rectangle<int> src_area_shifted{dst_pos, src_area.size};
-  const Rectangle<int> src_outline{dst_pos - src_area.pos,
-                                   FrameBufferSize(src.config_)};
-  const Rectangle<int> dst_outline{{0, 0}, FrameBufferSize(config_)};
-  const auto copy_area = dst_outline & src_outline & src_area_shifted;
-  const auto src_start_pos = copy_area.pos - (dst_pos - src_area.pos);
+  Vector2D<int> src_start_pos;
+  const auto copy_area =
+      CopyArea(dst_pos, config_, src.config_, src_area, src_start_pos);
+
+  uint8_t* dst_buf = FrameAddrAt(copy_area.pos, config_);
+  const uint8_t* src_buf = FrameAddrAt(src_start_pos, src.config_);
+
+  // the hardware frame buffer is only written, so bypass the cache for it
+  const bool non_temporal = buffer_.empty();
+  for (int y = 0; y < copy_area.size.y; ++y) {
+    blit::CopyRow(reinterpret_cast<uint32_t*>(dst_buf),
+                  reinterpret_cast<const uint32_t*>(src_buf),
+                  copy_area.size.x, non_temporal);
+    dst_buf += BytesPerScanLine(config_);
+    src_buf += BytesPerScanLine(src.config_);
+  }
+  if (non_temporal) {
+    blit::Fence();
+  }
+
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error FrameBuffer::CopyKeyed(Vector2D<int> dst_pos, const FrameBuffer& src,
+                             const Rectangle<int>& src_area,
+                             const PixelColor& key) {
+  if (config_.pixel_format != src.config_.pixel_format) {
+    return MAKE_ERROR(Error::kUnknownPixelFormat);
+  }
+  if (BytesPerPixel(config_.pixel_format) != 4) {
+    return MAKE_ERROR(Error::kUnknownPixelFormat);
+  }
+
+  Vector2D<int> src_start_pos;
+  const auto copy_area =
+      CopyArea(dst_pos, config_, src.config_, src_area, src_start_pos);
+  const uint32_t key_pixel = EncodePixel(config_.pixel_format, key);
 
   uint8_t* dst_buf = FrameAddrAt(copy_area.pos, config_);
   const uint8_t* src_buf = FrameAddrAt(src_start_pos, src.config_);
 
   for (int y = 0; y < copy_area.size.y; ++y) {
-    memcpy(dst_buf, src_buf, bytes_per_pixel * copy_area.size.x);
+    blit::CopyKeyedRow(reinterpret_cast<uint32_t*>(dst_buf),
+                       reinterpret_cast<const uint32_t*>(src_buf),
+                       copy_area.size.x, key_pixel);
     dst_buf += BytesPerScanLine(config_);
     src_buf += BytesPerScanLine(src.config_);
   }
@@ -85,15 +135,79 @@ Error FrameBuffer::Copy(Vector2D<int> dst_pos, const FrameBuffer& src,
   return MAKE_ERROR(Error::kSuccess);
 }
 
+Error FrameBuffer::CopyBlended(Vector2D<int> dst_pos, const FrameBuffer& src,
+                               const Rectangle<int>& src_area, uint8_t opacity,
+                               const std::optional<PixelColor>& key) {
+  if (config_.pixel_format != src.config_.pixel_format) {
+    return MAKE_ERROR(Error::kUnknownPixelFormat);
+  }
+  if (BytesPerPixel(config_.pixel_format) != 4) {
+    return MAKE_ERROR(Error::kUnknownPixelFormat);
+  }
+
+  Vector2D<int> src_start_pos;
+  const auto copy_area =
+      CopyArea(dst_pos, config_, src.config_, src_area, src_start_pos);
+  const uint32_t key_pixel =
+      key ? EncodePixel(config_.pixel_format, *key) : blit::kNoKey;
+
+  uint8_t* dst_buf = FrameAddrAt(copy_area.pos, config_);
+  const uint8_t* src_buf = FrameAddrAt(src_start_pos, src.config_);
+
+  for (int y = 0; y < copy_area.size.y; ++y) {
+    blit::BlendRow(reinterpret_cast<uint32_t*>(dst_buf),
+                   reinterpret_cast<const uint32_t*>(src_buf),
+                   copy_area.size.x, opacity, key_pixel);
+    dst_buf += BytesPerScanLine(config_);
+    src_buf += BytesPerScanLine(src.config_);
+  }
+
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+void FrameBuffer::FillAlpha(Vector2D<int> pos, Vector2D<int> size,
+                            const PixelColor& c, uint8_t alpha) {
+  const Rectangle<int> area =
+      Rectangle<int>{pos, size} &
+      Rectangle<int>{{0, 0}, FrameBufferSize(config_)};
+  if (area.size.x <= 0 || area.size.y <= 0) {
+    return;
+  }
+  const uint32_t pixel = EncodePixel(config_.pixel_format, c, alpha);
+  for (int y = 0; y < area.size.y; ++y) {
+    blit::FillRow(reinterpret_cast<uint32_t*>(
+                      FrameAddrAt(area.pos + Vector2D<int>{0, y}, config_)),
+                  pixel, area.size.x, false);
+  }
+}
+
+PixelColor FrameBuffer::At(Vector2D<int> pos) const {
+  const uint8_t* p = FrameAddrAt(pos, config_);
+  if (config_.pixel_format == kPixelRGBResv8BitPerColor) {
+    return {p[0], p[1], p[2]};
+  }
+  return {p[2], p[1], p[0]};
+}
+
 void FrameBuffer::Move(Vector2D<int> dst_pos, const Rectangle<int>& src) {
   const auto bytes_per_pixel = BytesPerPixel(config_.pixel_format);
   const auto bytes_per_scan_line = BytesPerScanLine(config_);
 
-  if (dst_pos.y < src.pos.y) {  // move up
+  if (dst_pos.y == src.pos.y) {  // move within the rows, which may overlap
+    uint8_t* dst_buf = FrameAddrAt(dst_pos, config_);
+    const uint8_t* src_buf = FrameAddrAt(src.pos, config_);
+    for (int y = 0; y < src.size.y; ++y) {
+      memmove(dst_buf, src_buf, bytes_per_pixel * src.size.x);
+      dst_buf += bytes_per_scan_line;
+      src_buf += bytes_per_scan_line;
+    }
+  } else if (dst_pos.y < src.pos.y) {  // move up
     uint8_t* dst_buf = FrameAddrAt(dst_pos, config_);
     const uint8_t* src_buf = FrameAddrAt(src.pos, config_);
     for (int y = 0; y < src.size.y; ++y) {
-      memcpy(dst_buf, src_buf, bytes_per_pixel * src.size.x);
+      blit::CopyRow(reinterpret_cast<uint32_t*>(dst_buf),
+                    reinterpret_cast<const uint32_t*>(src_buf), src.size.x,
+                    false);
       dst_buf += bytes_per_scan_line;
       src_buf += bytes_per_scan_line;
     }
@@ -103,7 +217,9 @@ void FrameBuffer::Move(Vector2D<int> dst_pos, const Rectangle<int>& src) {
     const uint8_t* src_buf =
         FrameAddrAt(src.pos + Vector2D<int>{0, src.size.y - 1}, config_);
     for (int y = 0; y < src.size.y; ++y) {
-      memcpy(dst_buf, src_buf, bytes_per_pixel * src.size.x);
+      blit::CopyRow(reinterpret_cast<uint32_t*>(dst_buf),
+                    reinterpret_cast<const uint32_t*>(src_buf), src.size.x,
+                    false);
       dst_buf -= bytes_per_scan_line;
       src_buf -= bytes_per_scan_line;
     }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include <vector>
 
 #include "error.hpp"
@@ -12,7 +13,25 @@ class FrameBuffer {
   Error Initialize(const FrameBufferConfig& config);
   Error Copy(Vector2D<int> dst_pos, const FrameBuffer& src,
              const Rectangle<int>& src_area);
+  /** @brief Copies like Copy, but skips the pixels of src which are key. */
+  Error CopyKeyed(Vector2D<int> dst_pos, const FrameBuffer& src,
+                  const Rectangle<int>& src_area, const PixelColor& key);
+  /** @brief Blends src_area of src over this buffer at dst_pos.
+   *
+   * Each pixel of src is scaled by opacity and blended by its own alpha, see
+   * EncodePixel. Pixels of src whose color is key are skipped, unless key is
+   * std::nullopt.
+   */
+  Error CopyBlended(Vector2D<int> dst_pos, const FrameBuffer& src,
+                    const Rectangle<int>& src_area, uint8_t opacity,
+                    const std::optional<PixelColor>& key);
+  /** @brief Fills the rectangle with the color of the given alpha, replacing
+   * the pixels there. */
+  void FillAlpha(Vector2D<int> pos, Vector2D<int> size, const PixelColor& c,
+                 uint8_t alpha);
   void Move(Vector2D<int> dst_pos, const Rectangle<int>& src);
+  /** @brief Returns the color of the pixel, decoded from the native format. */
+  PixelColor At(Vector2D<int> pos) const;
 
   FrameBufferWriter& Writer() { return *writer_; }
   const FrameBufferConfig& Config() const { return config_; }
@@ -6,41 +6,121 @@
 
 #include "graphics.hpp"
 
-void RGBResv8BitPerColorPixelWriter::Write(Vector2D<int> pos,
-                                           const PixelColor& c) {
-  auto p = PixelAt(pos);
-  p[0] = c.r;
-  p[1] = c.g;
-  p[2] = c.b;
+#include "blit.hpp"
+
+void PixelWriter::FillSpan(Vector2D<int> pos, int len, const PixelColor& c) {
+  FillRect(pos, {len, 1}, c);
+}
+
+void PixelWriter::FillRect(Vector2D<int> pos, Vector2D<int> size,
+                           const PixelColor& c) {
+  Vector2D<int> skip{0, 0};
+  if (!Clip(pos, size, skip)) {
+    return;
+  }
+  for (int dy = 0; dy < size.y; ++dy) {
+    for (int dx = 0; dx < size.x; ++dx) {
+      Write(pos + Vector2D<int>{dx, dy}, c);
+    }
+  }
+}
+
+void PixelWriter::BlitRect(Vector2D<int> pos, Vector2D<int> size,
+                           const PixelColor* src, int src_pitch) {
+  Vector2D<int> skip{0, 0};
+  if (!Clip(pos, size, skip)) {
+    return;
+  }
+  src += src_pitch * skip.y + skip.x;
+  for (int dy = 0; dy < size.y; ++dy, src += src_pitch) {
+    for (int dx = 0; dx < size.x; ++dx) {
+      Write(pos + Vector2D<int>{dx, dy}, src[dx]);
+    }
+  }
+}
+
+bool PixelWriter::Clip(Vector2D<int>& pos, Vector2D<int>& size,
+                       Vector2D<int>& skip) const {
+  const auto begin = ElementMax(pos, {0, 0});
+  const auto end = ElementMin(pos + size, {Width(), Height()});
+  if (end.x <= begin.x || end.y <= begin.y) {
+    return false;
+  }
+  skip += begin - pos;
+  pos = begin;
+  size = end - begin;
+  return true;
+}
+
+template <PixelFormat F>
+void NativePixelWriter<F>::Write(Vector2D<int> pos, const PixelColor& c) {
+  *WordAt(pos) = EncodePixel(F, c);
+}
+
+template <PixelFormat F>
+void NativePixelWriter<F>::FillSpan(Vector2D<int> pos, int len,
+                                    const PixelColor& c) {
+  FillRect(pos, {len, 1}, c);
 }
 
-void BGRResv8BitPerColorPixelWriter::Write(Vector2D<int> pos,
-                                           const PixelColor& c) {
-  auto p = PixelAt(pos);
-  p[0] = c.b;
-  p[1] = c.g;
-  p[2] = c.r;
+template <PixelFormat F>
+void NativePixelWriter<F>::FillRect(Vector2D<int> pos, Vector2D<int> size,
+                                    const PixelColor& c) {
+  Vector2D<int> skip{0, 0};
+  if (!Clip(pos, size, skip)) {
+    return;
+  }
+  const uint32_t pixel = EncodePixel(F, c);
+  uint32_t* row = WordAt(pos);
+  for (int dy = 0; dy < size.y; ++dy, row += PixelsPerScanLine()) {
+    if (size.x < 8) {  // too short for the vector kernels to pay off
+      for (int dx = 0; dx < size.x; ++dx) {
+        row[dx] = pixel;
+      }
+    } else {
+      blit::FillRow(row, pixel, size.x, false);
+    }
+  }
+}
+
+template <PixelFormat F>
+void NativePixelWriter<F>::BlitRect(Vector2D<int> pos, Vector2D<int> size,
+                                    const PixelColor* src, int src_pitch) {
+  Vector2D<int> skip{0, 0};
+  if (!Clip(pos, size, skip)) {
+    return;
+  }
+  src += src_pitch * skip.y + skip.x;
+  uint32_t* row = WordAt(pos);
+  for (int dy = 0; dy < size.y;
+       ++dy, row += PixelsPerScanLine(), src += src_pitch) {
+    for (int dx = 0; dx < size.x; ++dx) {
+      row[dx] = EncodePixel(F, src[dx]);
+    }
+  }
 }
 
+template class NativePixelWriter<kPixelRGBResv8BitPerColor>;
+template class NativePixelWriter<kPixelBGRResv8BitPerColor>;
+
 void DrawRectangle(PixelWriter& writer, const Vector2D<int>& pos,
                    const Vector2D<int>& size, const PixelColor& c) {
-  for (int dx = 0; dx < size.x; ++dx) {
-    writer.Write(pos + Vector2D<int>{dx, 0}, c);
-    writer.Write(pos + Vector2D<int>{dx, size.y - 1}, c);
+  if (size.x <= 0 || size.y <= 0) {
+    return;
+  }
+  writer.FillSpan(pos, size.x, c);
+  if (size.y > 1) {
+    writer.FillSpan(pos + Vector2D<int>{0, size.y - 1}, size.x, c);
   }
-  for (int dy = 1; dy < size.y - 1; ++dy) {
-    writer.Write(pos + Vector2D<int>{0, dy}, c);
-    writer.Write(pos + Vector2D<int>{size.x - 1, dy}, c);
+  writer.FillRect(pos + Vector2D<int>{0, 1}, {1, size.y - 2}, c);
+  if (size.x > 1) {
+    writer.FillRect(pos + Vector2D<int>{size.x - 1, 1}, {1, size.y - 2}, c);
   }
 }
 
 void FillRectangle(PixelWriter& writer, const Vector2D<int>& pos,
                    const Vector2D<int>& size, const PixelColor& c) {
-  for (int dy = 0; dy < size.y; ++dy) {
-    for (int dx = 0; dx < size.x; ++dx) {
-      writer.Write(pos + Vector2D<int>{dx, dy}, c);
-    }
-  }
+  writer.FillRect(pos, size, c);
 }
 
 void DrawDesktop(PixelWriter& writer) {
@@ -66,6 +146,7 @@ char pixel_writer_buf[sizeof(RGBResv8BitPerColorPixelWriter)];
 
 void InitializeGraphics(const FrameBufferConfig& screen_config) {
   ::screen_config = screen_config;
+  blit::Initialize();
 
   switch (screen_config.pixel_format) {
     case kPixelRGBResv8BitPerColor:
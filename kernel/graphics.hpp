@@ -90,8 +90,49 @@ class PixelWriter {
   virtual void Write(Vector2D<int> pos, const PixelColor& c) = 0;
   virtual int Width() const = 0;
   virtual int Height() const = 0;
+
+  /** @brief Fills len pixels of the row from pos to the right.
+   *
+   * Span methods clip to Width() and Height(), so that callers check bounds
+   * once per span instead of once per pixel. The defaults fall back to Write.
+   */
+  virtual void FillSpan(Vector2D<int> pos, int len, const PixelColor& c);
+  /** @brief Fills the rectangle of size at pos. */
+  virtual void FillRect(Vector2D<int> pos, Vector2D<int> size,
+                        const PixelColor& c);
+  /** @brief Writes the rectangle of size at pos from src, which holds its
+   * rows one after another, src_pitch pixels apart. */
+  virtual void BlitRect(Vector2D<int> pos, Vector2D<int> size,
+                        const PixelColor* src, int src_pitch);
+
+ protected:
+  /** @brief Clips the rectangle to this writer. Returns false if nothing is
+   * left. The offset of the new pos from the old one is added to skip. */
+  bool Clip(Vector2D<int>& pos, Vector2D<int>& size,
+            Vector2D<int>& skip) const;
 };
 
+/** @brief Returns the color as a pixel of the format, read as a little endian
+ * 32 bit integer with the reserved byte 0. */
+constexpr uint32_t EncodePixel(PixelFormat format, const PixelColor& c) {
+  if (format == kPixelRGBResv8BitPerColor) {
+    return c.r | (c.g << 8) | (uint32_t{c.b} << 16);
+  }
+  return c.b | (c.g << 8) | (uint32_t{c.r} << 16);
+}
+
+/** @brief Returns the color with alpha as a pixel of the format: the color
+ * premultiplied by alpha, and 255 - alpha in the reserved byte. A pixel from
+ * EncodePixel is thus opaque. */
+constexpr uint32_t EncodePixel(PixelFormat format, const PixelColor& c,
+                               uint8_t alpha) {
+  const PixelColor premultiplied{
+      static_cast<uint8_t>(c.r * alpha / 255),
+      static_cast<uint8_t>(c.g * alpha / 255),
+      static_cast<uint8_t>(c.b * alpha / 255)};
+  return EncodePixel(format, premultiplied) | uint32_t{255u - alpha} << 24;
+}
+
 class FrameBufferWriter : public PixelWriter {
  public:
   FrameBufferWriter(const FrameBufferConfig& config) : config_{config} {}
@@ -104,23 +145,38 @@ class FrameBufferWriter : public PixelWriter {
     return config_.frame_buffer +
            4 * (config_.pixels_per_scan_line * pos.y + pos.x);
   }
+  int PixelsPerScanLine() const { return config_.pixels_per_scan_line; }
 
  private:
   const FrameBufferConfig& config_;
 };
 
-class RGBResv8BitPerColorPixelWriter : public FrameBufferWriter {
+/** @brief NativePixelWriter writes pixels of the format F as whole 32 bit
+ * words, so that its span methods store one encoded word per pixel.
+ */
+template <PixelFormat F>
+class NativePixelWriter : public FrameBufferWriter {
  public:
   using FrameBufferWriter::FrameBufferWriter;
   virtual void Write(Vector2D<int> pos, const PixelColor& c) override;
-};
+  virtual void FillSpan(Vector2D<int> pos, int len,
+                        const PixelColor& c) override;
+  virtual void FillRect(Vector2D<int> pos, Vector2D<int> size,
+                        const PixelColor& c) override;
+  virtual void BlitRect(Vector2D<int> pos, Vector2D<int> size,
+                        const PixelColor* src, int src_pitch) override;
 
-class BGRResv8BitPerColorPixelWriter : public FrameBufferWriter {
- public:
-  using FrameBufferWriter::FrameBufferWriter;
-  virtual void Write(Vector2D<int> pos, const PixelColor& c) override;
+ private:
+  uint32_t* WordAt(Vector2D<int> pos) {
+    return reinterpret_cast<uint32_t*>(PixelAt(pos));
+  }
 };
 
+using RGBResv8BitPerColorPixelWriter =
+    NativePixelWriter<kPixelRGBResv8BitPerColor>;
+using BGRResv8BitPerColorPixelWriter =
+    NativePixelWriter<kPixelBGRResv8BitPerColor>;
+
 void DrawRectangle(PixelWriter& writer, const Vector2D<int>& pos,
                    const Vector2D<int>& size, const PixelColor& c);
 
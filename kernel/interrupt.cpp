@@ -14,6 +14,7 @@
 #include "segment.hpp"
 #include "task.hpp"
 #include "timer.hpp"
+#include "virtio/blk.hpp"
 
 std::array<InterruptDescriptor, 256> idt;
 
@@ -37,6 +38,13 @@ __attribute__((interrupt)) void IntHandlerXHCI(InterruptFrame* frame) {
   NotifyEndOfInterrupt();
 }
 
+__attribute__((interrupt)) void IntHandlerVirtioBlk(InterruptFrame* frame) {
+  if (virtio::blk::device) {
+    virtio::blk::device->HandleInterrupt();
+  }
+  NotifyEndOfInterrupt();
+}
+
 void PrintHex(uint64_t value, int width, Vector2D<int> pos) {
   for (int i = 0; i < width; ++i) {
     int x = (value >> 4 * (width - i - 1)) & 0xfu;
@@ -75,7 +83,8 @@ void KillApp(InterruptFrame* frame) {
 __attribute__((interrupt)) void IntHandlerPF(InterruptFrame* frame,
                                              uint64_t error_code) {
   uint64_t cr2 = GetCR2();
-  if (auto err = HandlePageFault(error_code, cr2); !err) {
+  if (auto err = HandlePageFault(error_code, cr2);
+      !err || err.Cause() == Error::kWouldBlock) {
     return;
   }
   KillApp(frame);
@@ -129,6 +138,7 @@ void InitializeInterrupt() {
                 reinterpret_cast<uint64_t>(handler), kKernelCS);
   };
   set_idt_entry(InterruptVector::kXHCI, IntHandlerXHCI);
+  set_idt_entry(InterruptVector::kVirtioBlk, IntHandlerVirtioBlk);
   SetIDTEntry(idt[InterruptVector::kLAPICTimer],
               MakeIDTAttr(DescriptorType::kInterruptGate, 0 /* DPL */,
                           true /* present */, kISTForTimer /* IST */),
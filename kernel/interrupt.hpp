@@ -57,6 +57,7 @@ class InterruptVector {
   enum Number {
     kXHCI = 0x40,
     kLAPICTimer = 0x41,
+    kVirtioBlk = 0x42,
   };
 };
 
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 
+#include "blit.hpp"
 #include "console.hpp"
 #include "logger.hpp"
 #include "task.hpp"
@@ -13,6 +14,26 @@ void EraseIf(T& c, const U& pred) {
   auto it = std::remove_if(c.begin(), c.end(), pred);
   c.erase(it, c.end());
 }
+
+// rows of the scratch buffer, which should stay in the cache
+const uint32_t kScratchRows = 16;
+
+/** @brief Masks interrupts in a scope and restores the previous state, so the
+ * compositor task cannot preempt a half-done update of the damage. */
+class InterruptGuard {
+ public:
+  InterruptGuard() {
+    __asm__ volatile("pushfq\n\tpopq %0\n\tcli" : "=r"(rflags_));
+  }
+  ~InterruptGuard() {
+    if (rflags_ & (1u << 9)) {
+      __asm__ volatile("sti");
+    }
+  }
+
+ private:
+  uint64_t rflags_;
+};
 }  // namespace
 
 Layer::Layer(unsigned int id) : id_{id} {}
@@ -35,6 +56,13 @@ Layer& Layer::SetDraggable(bool draggable) {
 
 bool Layer::IsDraggable() const { return draggable_; }
 
+Layer& Layer::SetOpacity(uint8_t opacity) {
+  opacity_ = opacity;
+  return *this;
+}
+
+uint8_t Layer::Opacity() const { return opacity_; }
+
 Layer& Layer::Move(Vector2D<int> pos) {
   pos_ = pos;
   return *this;
@@ -45,12 +73,29 @@ Layer& Layer::MoveRelative(Vector2D<int> pos_diff) {
   return *this;
 }
 
-void Layer::DrawTo(FrameBuffer& screen, const Rectangle<int>& area) const {
+void Layer::DrawTo(FrameBuffer& dst, const Rectangle<int>& area,
+                   Vector2D<int> origin) const {
   if (window_) {
-    window_->DrawTo(screen, pos_, area);
+    window_->DrawTo(dst, pos_ - origin, {area.pos - origin, area.size},
+                    opacity_);
   }
 }
 
+Rectangle<int> Layer::Area() const {
+  if (!window_) {
+    return {pos_, {0, 0}};
+  }
+  return {pos_, window_->Size()};
+}
+
+bool Layer::IsOpaque() const {
+  return window_ && opacity_ == 255 && window_->IsOpaque();
+}
+
+bool Layer::IsBlended() const {
+  return window_ && (opacity_ != 255 || window_->HasAlpha());
+}
+
 void LayerManager::SetWriter(FrameBuffer* screen) {
   screen_ = screen;
 
@@ -59,67 +104,327 @@ void LayerManager::SetWriter(FrameBuffer* screen) {
   back_buffer_.Initialize(back_config);
 }
 
+void LayerManager::SetDisplay(Display* display) {
+  if (display->NumPages() < 2) {
+    return;
+  }
+  for (int page = 0; page < 2; ++page) {
+    if (auto err = pages_[page].Initialize(display->PageConfig(page))) {
+      Log(kWarn, "failed to initialize display page %d: %s\n", page,
+          err.Name());
+      return;
+    }
+  }
+  FrameBufferConfig scratch_config = screen_->Config();
+  scratch_config.frame_buffer = nullptr;
+  scratch_config.vertical_resolution = kScratchRows;
+  if (auto err = scratch_.Initialize(scratch_config)) {
+    Log(kWarn, "failed to initialize the compose scratch: %s\n", err.Name());
+    return;
+  }
+
+  // the first page shows the screen composed so far, the second nothing yet
+  const auto& config = screen_->Config();
+  last_damage_.Clear();
+  last_damage_.Add({{0, 0},
+                    {static_cast<int>(config.horizontal_resolution),
+                     static_cast<int>(config.vertical_resolution)}});
+  display_ = display;
+  back_page_ = 1;
+  back_buffer_ = FrameBuffer{};
+}
+
 Layer& LayerManager::NewLayer() {
+  InterruptGuard guard;
   ++latest_id_;
   return *layers_.emplace_back(new Layer{latest_id_});
 }
 
 void LayerManager::RemoveLayer(unsigned int id) {
+  InterruptGuard guard;
   Hide(id);
+  if (cursor_ && cursor_->ID() == id) {
+    cursor_ = nullptr;
+  }
   auto pred = [id](const std::unique_ptr<Layer>& elem) {
     return elem->ID() == id;
   };
   EraseIf(layers_, pred);
 }
 
-void LayerManager::Draw(const Rectangle<int>& area) const {
-  for (auto layer : layer_stack_) {
-    layer->DrawTo(back_buffer_, area);
-  }
-  screen_->Copy(area.pos, back_buffer_, area);
-}
+void LayerManager::Draw(const Rectangle<int>& area) const { Update({area}); }
 
 void LayerManager::Draw(unsigned int id) const { Draw(id, {{0, 0}, {-1, -1}}); }
 
 void LayerManager::Draw(unsigned int id, Rectangle<int> area) const {
-  bool draw = false;
   Rectangle<int> window_area;
-  for (auto layer : layer_stack_) {
-    if (layer->ID() == id) {
-      window_area.size = layer->GetWindow()->Size();
-      window_area.pos = layer->GetPosition();
-      if (area.size.x >= 0 || area.size.y >= 0) {
-        area.pos = area.pos + window_area.pos;
-        window_area = window_area & area;
-      }
-      draw = true;
-    }
-    if (draw) {
-      layer->DrawTo(back_buffer_, window_area);
+  {
+    InterruptGuard guard;
+    auto it = std::find_if(layer_stack_.begin(), layer_stack_.end(),
+                           [id](Layer* layer) { return layer->ID() == id; });
+    if (it == layer_stack_.end()) {
+      return;
     }
+    window_area = (*it)->Area();
+  }
+  if (area.size.x >= 0 || area.size.y >= 0) {
+    area.pos = area.pos + window_area.pos;
+    window_area = window_area & area;
   }
-  screen_->Copy(window_area.pos, back_buffer_, window_area);
+  Update({window_area});
 }
 
 void LayerManager::Move(unsigned int id, Vector2D<int> new_pos) {
   auto layer = FindLayer(id);
-  const auto window_size = layer->GetWindow()->Size();
-  const auto old_pos = layer->GetPosition();
-  layer->Move(new_pos);
-  Draw({old_pos, window_size});
-  Draw(id);
+  if (layer == nullptr) {
+    return;
+  }
+  MoveLayer(*layer, new_pos);
 }
 
 void LayerManager::MoveRelative(unsigned int id, Vector2D<int> pos_diff) {
   auto layer = FindLayer(id);
-  const auto window_size = layer->GetWindow()->Size();
-  const auto old_pos = layer->GetPosition();
-  layer->MoveRelative(pos_diff);
-  Draw({old_pos, window_size});
-  Draw(id);
+  if (layer == nullptr) {
+    return;
+  }
+  MoveLayer(*layer, layer->GetPosition() + pos_diff);
+}
+
+void LayerManager::MoveLayer(Layer& layer, Vector2D<int> new_pos) {
+  if (&layer == cursor_) {
+    MoveCursor(new_pos);
+    return;
+  }
+
+  Rectangle<int> old_area, new_area;
+  {
+    InterruptGuard guard;
+    old_area = layer.Area();
+    layer.Move(new_pos);
+    new_area = layer.Area();
+    if (GetHeight(layer.ID()) < 0) {
+      return;
+    }
+  }
+  Update({old_area, new_area});
+}
+
+void LayerManager::Compose() const {
+  while (true) {
+    {
+      InterruptGuard guard;
+      if (composing_ || damage_.Empty()) {
+        return;
+      }
+      composing_ = true;
+      frame_damage_ = damage_;
+      damage_.Clear();
+      stack_snapshot_.clear();
+      cursor_snapshot_ = Layer{};
+      for (auto layer : layer_stack_) {
+        if (layer == cursor_) {
+          cursor_snapshot_ = *layer;
+        } else {
+          stack_snapshot_.push_back(*layer);
+        }
+      }
+    }
+
+    ComposeFrame();
+    // drop the references to windows which may have been closed meanwhile
+    stack_snapshot_.clear();
+    cursor_snapshot_ = Layer{};
+
+    InterruptGuard guard;
+    composing_ = false;
+    // paced, the damage added meanwhile waits for the next frame
+    if (paced_) {
+      return;
+    }
+  }
+}
+
+void LayerManager::ComposeFrame() const {
+  const auto& config = screen_->Config();
+  const Rectangle<int> screen_area{
+      {0, 0},
+      {static_cast<int>(config.horizontal_resolution),
+       static_cast<int>(config.vertical_resolution)}};
+
+  FrameBuffer& target = display_ ? pages_[back_page_] : back_buffer_;
+  paint_damage_ = frame_damage_;
+  if (display_) {
+    for (const auto& rect : last_damage_.Rects()) {
+      paint_damage_.Add(rect);
+    }
+  }
+
+  bool drawn = false;
+  for (const auto& rect : paint_damage_.Rects()) {
+    const auto area = rect & screen_area;
+    if (RectArea(area) == 0) {
+      continue;
+    }
+
+    visible_.clear();
+    visible_.push_back(area);
+    clips_.clear();
+    for (auto it = stack_snapshot_.rbegin();
+         it != stack_snapshot_.rend() && !visible_.empty(); ++it) {
+      const auto layer_area = it->Area();
+      const bool opaque = it->IsOpaque();
+      next_visible_.clear();
+      for (const auto& r : visible_) {
+        const auto clip = r & layer_area;
+        if (RectArea(clip) == 0) {
+          next_visible_.push_back(r);
+          continue;
+        }
+        clips_.push_back({&*it, clip});
+        if (opaque) {
+          SubtractRect(r, clip, next_visible_);
+        } else {
+          next_visible_.push_back(r);
+        }
+      }
+      visible_.swap(next_visible_);
+    }
+
+    // blending into the back page would read video memory, which is slow
+    const bool blended =
+        std::any_of(clips_.begin(), clips_.end(),
+                    [](const auto& clip) { return clip.first->IsBlended(); }) ||
+        (cursor_snapshot_.IsBlended() &&
+         RectArea(cursor_snapshot_.Area() & area) > 0);
+    if (display_ && blended) {
+      ComposeBands(target, area);
+    } else {
+      for (auto it = clips_.rbegin(); it != clips_.rend(); ++it) {
+        it->first->DrawTo(target, it->second);
+        stat_.layer_pixels += RectArea(it->second);
+      }
+    }
+    if (display_) {
+      if (!blended) {
+        DrawCursor(cursor_snapshot_, target, area);
+      }
+    } else {
+      screen_->Copy(area.pos, back_buffer_, area);
+      DrawCursor(cursor_snapshot_, *screen_, area);
+    }
+
+    drawn = true;
+    ++stat_.damage_rects;
+    stat_.composed_pixels += RectArea(area);
+  }
+
+  if (drawn) {
+    ++stat_.frames;
+    if (display_) {
+      blit::Fence();
+      display_->Show(back_page_);
+      back_page_ ^= 1;
+      last_damage_ = frame_damage_;
+      ++stat_.flips;
+    }
+  }
+}
+
+void LayerManager::Update(std::initializer_list<Rectangle<int>> areas) const {
+  {
+    InterruptGuard guard;
+    for (const auto& area : areas) {
+      damage_.Add(area);
+    }
+    ++stat_.updates;
+    if (paced_) {
+      return;
+    }
+  }
+  Compose();
+}
+
+void LayerManager::SetPaced(bool paced) {
+  paced_ = paced;
+  if (!paced_) {
+    Present();
+  }
+}
+
+void LayerManager::Present() const { Compose(); }
+
+void LayerManager::ComposeBands(FrameBuffer& dst,
+                                const Rectangle<int>& area) const {
+  const int rows = scratch_.Config().vertical_resolution;
+  const int end_y = area.pos.y + area.size.y;
+  for (int y = area.pos.y; y < end_y; y += rows) {
+    const Rectangle<int> band{{area.pos.x, y},
+                              {area.size.x, std::min(rows, end_y - y)}};
+    const Vector2D<int> origin{0, y};
+    for (auto it = clips_.rbegin(); it != clips_.rend(); ++it) {
+      const auto clip = it->second & band;
+      if (RectArea(clip) == 0) {
+        continue;
+      }
+      it->first->DrawTo(scratch_, clip, origin);
+      stat_.layer_pixels += RectArea(clip);
+    }
+    DrawCursor(cursor_snapshot_, scratch_, band, origin);
+    dst.Copy(band.pos, scratch_, {band.pos - origin, band.size});
+  }
+}
+
+void LayerManager::DrawCursor(const Layer& cursor, FrameBuffer& dst,
+                              const Rectangle<int>& area,
+                              Vector2D<int> origin) const {
+  const auto cursor_area = cursor.Area() & area;
+  if (RectArea(cursor_area) == 0) {
+    return;
+  }
+  cursor.DrawTo(dst, cursor_area, origin);
+  stat_.cursor_pixels += RectArea(cursor_area);
+}
+
+void LayerManager::MoveCursor(Vector2D<int> new_pos) {
+  Rectangle<int> old_area, new_area;
+  {
+    InterruptGuard guard;
+    old_area = cursor_->Area();
+    cursor_->Move(new_pos);
+    new_area = cursor_->Area();
+    ++stat_.cursor_moves;
+    if (GetHeight(cursor_->ID()) < 0) {
+      return;
+    }
+
+    // a frame being composed draws the cursor where it was, so it is
+    // damaged like any layer then
+    if (!display_ && !composing_) {
+      // the back buffer holds the screen without the cursor
+      const auto& config = screen_->Config();
+      const Rectangle<int> screen_area{
+          {0, 0},
+          {static_cast<int>(config.horizontal_resolution),
+           static_cast<int>(config.vertical_resolution)}};
+      const auto restore_area = old_area & screen_area;
+      if (RectArea(restore_area) > 0) {
+        screen_->Copy(restore_area.pos, back_buffer_, restore_area);
+        stat_.cursor_pixels += RectArea(restore_area);
+      }
+      DrawCursor(*cursor_, *screen_, screen_area);
+      return;
+    }
+  }
+  Update({old_area, new_area});
+}
+
+void LayerManager::SetCursorLayer(unsigned int id) {
+  InterruptGuard guard;
+  cursor_ = FindLayer(id);
 }
 
 void LayerManager::UpDown(unsigned int id, int new_height) {
+  InterruptGuard guard;
   if (new_height < 0) {
     Hide(id);
     return;
@@ -145,6 +450,7 @@ void LayerManager::UpDown(unsigned int id, int new_height) {
 }
 
 void LayerManager::Hide(unsigned int id) {
+  InterruptGuard guard;
   auto layer = FindLayer(id);
   auto pos = std::find(layer_stack_.begin(), layer_stack_.end(), layer);
   if (pos != layer_stack_.end()) {
@@ -154,6 +460,7 @@ void LayerManager::Hide(unsigned int id) {
 
 Layer* LayerManager::FindLayerByPosition(Vector2D<int> pos,
                                          unsigned int exclude_id) const {
+  InterruptGuard guard;
   auto pred = [pos, exclude_id](Layer* layer) {
     if (layer->ID() == exclude_id) {
       return false;
@@ -175,6 +482,7 @@ Layer* LayerManager::FindLayerByPosition(Vector2D<int> pos,
 }
 
 Layer* LayerManager::FindLayer(unsigned int id) {
+  InterruptGuard guard;
   auto pred = [id](const std::unique_ptr<Layer>& elem) {
     return elem->ID() == id;
   };
@@ -186,6 +494,7 @@ Layer* LayerManager::FindLayer(unsigned int id) {
 }
 
 int LayerManager::GetHeight(unsigned int id) {
+  InterruptGuard guard;
   for (int h = 0; h < layer_stack_.size(); ++h) {
     if (layer_stack_[h]->ID() == id) {
       return h;
@@ -312,4 +621,47 @@ Error CloseLayer(unsigned int layer_id) {
   __asm__("sti");
 
   return MAKE_ERROR(Error::kSuccess);
-}
\ No newline at end of file
+}
+
+void TaskCompositor(uint64_t task_id, int64_t data) {
+  __asm__("cli");
+  Task& task = task_manager->CurrentTask();
+  const unsigned long start = timer_manager->CurrentTick();
+  // the timer cannot fire at 60 Hz exactly, so frame n is due at the tick
+  // nearest below n / kCompositorFrameRate seconds, which averages out
+  auto frame_tick = [start](unsigned long frame) {
+    return start + frame * kTimerFreq / kCompositorFrameRate;
+  };
+  unsigned long frame = 1;
+  timer_manager->AddTimer(Timer{frame_tick(frame), 1, task_id});
+  layer_manager->SetPaced(true);
+  __asm__("sti");
+
+  while (true) {
+    __asm__("cli");
+    auto msg = task.ReceiveMessage();
+    if (!msg) {
+      task.Sleep();
+      __asm__("sti");
+      continue;
+    }
+    __asm__("sti");
+
+    if (msg->type != Message::kTimerTimeout) {
+      continue;
+    }
+
+    layer_manager->Present();
+
+    // frames whose tick passed while composing are skipped, not caught up
+    __asm__("cli");
+    const auto now = timer_manager->CurrentTick();
+    const auto presented = frame;
+    do {
+      ++frame;
+    } while (frame_tick(frame) <= now);
+    layer_manager->CountSkippedFrames(frame - presented - 1);
+    timer_manager->AddTimer(Timer{frame_tick(frame), 1, task_id});
+    __asm__("sti");
+  }
+}
@@ -4,12 +4,16 @@
  */
 #pragma once
 
+#include <initializer_list>
 #include <map>
 #include <memory>
+#include <utility>
 #include <vector>
 
+#include "display.hpp"
 #include "graphics.hpp"
 #include "message.hpp"
+#include "region.hpp"
 #include "window.hpp"
 
 /** @brief Layer represents a layer.
@@ -34,6 +38,10 @@ class Layer {
   Layer& SetDraggable(bool draggable);
   /** @brief Return true if the layer is draggable. */
   bool IsDraggable() const;
+  /** @brief Sets how much the layer covers the ones below, from 0 for not at
+   * all to 255 for fully. No redraw is performed. */
+  Layer& SetOpacity(uint8_t opacity);
+  uint8_t Opacity() const;
 
   /** @brief Updates the position information of the layer to the specified
    * absolute coordinates.
@@ -44,14 +52,37 @@ class Layer {
   relative coordinates. No redraw is performed.
   */
   Layer& MoveRelative(Vector2D<int> pos_diff);
-  /** @brief Draws the contents of the currently set window to the writer. */
-  void DrawTo(FrameBuffer& screen, const Rectangle<int>& area) const;
+  /** @brief Draws the area of the screen from the currently set window to
+   * dst, whose top left pixel is at origin on the screen. */
+  void DrawTo(FrameBuffer& dst, const Rectangle<int>& area,
+              Vector2D<int> origin = {0, 0}) const;
+  /** @brief Returns the area covered by the window, empty if none is set. */
+  Rectangle<int> Area() const;
+  /** @brief Returns true if drawing this layer overwrites every pixel of its
+   * area, which hides the layers below there. */
+  bool IsOpaque() const;
+  /** @brief Returns true if drawing this layer reads the pixels below. */
+  bool IsBlended() const;
 
  private:
   unsigned int id_;
   Vector2D<int> pos_{};
   std::shared_ptr<Window> window_{};
   bool draggable_{false};
+  uint8_t opacity_{255};
+};
+
+/** @brief Counters of the compositor, for measuring how much is redrawn. */
+struct LayerManagerStat {
+  unsigned long frames;           // number of Compose calls that drew anything
+  unsigned long updates;          // calls that added damage
+  unsigned long damage_rects;     // rectangles composed in total
+  unsigned long composed_pixels;  // pixels copied to the screen in total
+  unsigned long layer_pixels;     // pixels drawn by layers in total
+  unsigned long cursor_moves;     // moves of the cursor layer
+  unsigned long cursor_pixels;    // pixels written to move the cursor
+  unsigned long flips;            // frames shown by flipping display pages
+  unsigned long skipped_frames;   // frame ticks passed while composing
 };
 
 /** @brief LayerManager manages multiple layers. */
@@ -62,6 +93,15 @@ class LayerManager {
    * Draw().
    */
   void SetWriter(FrameBuffer* screen);
+  /** @brief Makes the compositor draw into the pages of the display and show
+   * each frame by flipping to its page, instead of copying from the back
+   * buffer to the screen.
+   *
+   * The display needs two pages, the first of which is the screen given to
+   * SetWriter. Each page is then one frame behind the other, so a frame also
+   * redraws the damage of the previous one.
+   */
+  void SetDisplay(Display* display);
   /** @brief Create a new layer and return a reference to it.
    *
    * The newly created layer is held in a container inside LayerManager.
@@ -106,13 +146,90 @@ class LayerManager {
   Layer* FindLayer(unsigned int id);
   /** @brief Returns the current height of the specified layer. */
   int GetHeight(unsigned int id);
+  /** @brief Makes the layer the cursor, which is drawn like a hardware
+   * cursor plane.
+   *
+   * The cursor is left out of the back buffer and drawn directly over the
+   * screen after each compose. Moving it restores the pixels under its old
+   * position from the back buffer and draws it at the new one, without
+   * composing any layer. The layer should be the top one.
+   */
+  void SetCursorLayer(unsigned int id);
+  /** @brief Selects when damage is composed.
+   *
+   * Unpaced, every Draw and Move composes right away. Paced, they only add
+   * damage, which Present composes, so updates arriving within one frame are
+   * drawn once. Leaving the paced mode presents the pending damage.
+   */
+  void SetPaced(bool paced);
+  /** @brief Composes the damage added since the last frame, if any. */
+  void Present() const;
+  /** @brief Returns the compositor counters. */
+  const LayerManagerStat& Stat() const { return stat_; }
+  /** @brief Counts frames the paced compositor skipped because it was late. */
+  void CountSkippedFrames(unsigned long n) { stat_.skipped_frames += n; }
 
  private:
   FrameBuffer* screen_{nullptr};
   mutable FrameBuffer back_buffer_{};
+  Display* display_{nullptr};
+  mutable FrameBuffer pages_[2]{};
+  // a few rows in system memory, where blended layers are composed instead
+  // of reading back video memory
+  mutable FrameBuffer scratch_{};
+  mutable int back_page_{1};
+  mutable Region damage_{};
+  // damage of the last frame, which the back page lacks, and of this frame
+  mutable Region last_damage_{}, frame_damage_{};
+  // what the frame is drawn from: the damage of last_damage_ added, and
+  // copies of the layers, taken so that they may change while it is drawn
+  mutable Region paint_damage_{};
+  mutable std::vector<Layer> stack_snapshot_{};
+  mutable Layer cursor_snapshot_{};
+  mutable bool composing_{false};
+  mutable LayerManagerStat stat_{};
+  // scratch space of Compose, kept to avoid allocating on every frame
+  mutable std::vector<Rectangle<int>> visible_{}, next_visible_{};
+  mutable std::vector<std::pair<const Layer*, Rectangle<int>>> clips_{};
+  Layer* cursor_{nullptr};
+  bool paced_{false};
   std::vector<std::unique_ptr<Layer>> layers_{};
   std::vector<Layer*> layer_stack_{};
   unsigned int latest_id_{0};
+
+  /** @brief Takes the damage and copies the layer stack with interrupts
+   * masked, then composes the frame from them with interrupts as they were.
+   *
+   * Only one task composes at a time. Another one calling meanwhile leaves
+   * its damage to the composing task, which composes again when unpaced.
+   */
+  void Compose() const;
+  /** @brief Redraws the damaged rectangles into the back buffer and copies
+   * them to the screen. With a display, they are drawn into the back page,
+   * which is then shown.
+   *
+   * The part of each layer not hidden by opaque layers above is found from
+   * the top, then those parts are drawn from the bottom. Each pixel is thus
+   * written by one opaque layer plus the transparent layers over it.
+   */
+  void ComposeFrame() const;
+  /** @brief Adds the rectangles to the damage as one update and composes
+   * unless paced. */
+  void Update(std::initializer_list<Rectangle<int>> areas) const;
+  /** @brief Draws the cursor over the area of the screen to dst, whose top
+   * left pixel is at origin on the screen. */
+  void DrawCursor(const Layer& cursor, FrameBuffer& dst,
+                  const Rectangle<int>& area,
+                  Vector2D<int> origin = {0, 0}) const;
+  /** @brief Draws the clips of the area band by band into scratch_, and
+   * copies each band to dst, which is thus only written. */
+  void ComposeBands(FrameBuffer& dst, const Rectangle<int>& area) const;
+  /** @brief Moves the cursor by writing only the pixels of its old and new
+   * areas on the screen. With a display, the areas are damaged instead, as
+   * the pages hold no copy without the cursor. */
+  void MoveCursor(Vector2D<int> new_pos);
+  /** @brief Moves the layer and damages its old and new areas. */
+  void MoveLayer(Layer& layer, Vector2D<int> new_pos);
 };
 
 extern LayerManager* layer_manager;
@@ -136,6 +253,12 @@ extern std::map<unsigned int, uint64_t>* layer_task_map;
 void InitializeLayer();
 void ProcessLayerMessage(const Message& msg);
 
+/** @brief Frames per second the compositor task presents at. */
+const int kCompositorFrameRate = 60;
+/** @brief Switches the layer manager to paced mode and presents the damage
+ * once per frame, driven by the timer. */
+void TaskCompositor(uint64_t task_id, int64_t data);
+
 constexpr Message MakeLayerMessage(uint64_t task_id, unsigned int layer_id,
                                    LayerOperation op,
                                    const Rectangle<int>& area) {
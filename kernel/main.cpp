@@ -13,7 +13,10 @@
 
 #include "acpi.hpp"
 #include "asmfunc.h"
+#include "bochs_display.hpp"
+#include "boot_volume.hpp"
 #include "console.hpp"
+#include "devfs.hpp"
 #include "fat.hpp"
 #include "font.hpp"
 #include "frame_buffer_config.hpp"
@@ -33,7 +36,10 @@
 #include "task.hpp"
 #include "terminal.hpp"
 #include "timer.hpp"
+#include "tmpfs.hpp"
 #include "usb/xhci/xhci.hpp"
+#include "vfs.hpp"
+#include "virtio/blk.hpp"
 #include "window.hpp"
 
 int printk(const char* format, ...) {
@@ -120,8 +126,9 @@ alignas(16) uint8_t kernel_main_stack[1024 * 1024];
 extern "C" void KernelMainNewStack(
     const FrameBufferConfig& frame_buffer_config_ref,
     const MemoryMap& memory_map_ref, const acpi::RSDP& acpi_table,
-    void* volume_image) {
+    const BootVolume& boot_volume_ref) {
   MemoryMap memory_map{memory_map_ref};
+  const BootVolume boot_volume{boot_volume_ref};
 
   InitializeGraphics(frame_buffer_config_ref);
   InitializeConsole();
@@ -132,14 +139,24 @@ extern "C" void KernelMainNewStack(
   InitializeSegmentation();
   InitializePaging();
   InitializeMemoryManager(memory_map);
+  if (auto err = MapWriteCombining(
+          reinterpret_cast<uint64_t>(frame_buffer_config_ref.frame_buffer),
+          4ul * frame_buffer_config_ref.pixels_per_scan_line *
+              frame_buffer_config_ref.vertical_resolution)) {
+    Log(kWarn, "failed to map the frame buffer write-combining: %s\n",
+        err.Name());
+  }
   InitializeTSS();
   InitializeInterrupt();
 
-  fat::Initialize(volume_image);
-  InitializeFont();
+  fat::Initialize(boot_volume.image, boot_volume.image_bytes);
   InitializePCI();
 
   InitializeLayer();
+  bochs::Initialize(frame_buffer_config_ref);
+  if (bochs::device) {
+    layer_manager->SetDisplay(bochs::device);
+  }
   InitializeMainWindow();
   InitializeTextWindow();
   layer_manager->Draw({{0, 0}, ScreenSize()});
@@ -161,8 +178,24 @@ extern "C" void KernelMainNewStack(
   InitializeKeyboard();
   InitializeMouse();
 
-  app_loads = new std::map<fat::DirectoryEntry*, AppLoadInfo>;
+  virtio::blk::Initialize();
+  if (virtio::blk::device &&
+      fat::IsSameVolume(*virtio::blk::device, boot_volume.image)) {
+    fat::Initialize(*virtio::blk::device);
+  } else if (boot_volume.image_bytes < boot_volume.volume_bytes) {
+    Log(kError, "no block device for the rest of the boot volume\n");
+  }
+  // The font is read from the volume, which may only be complete now.
+  InitializeFont();
+
+  vfs::Mount("/", std::make_unique<fat::FileSystem>());
+  vfs::Mount("/tmp", std::make_unique<tmpfs::FileSystem>());
+  vfs::Mount("/dev", std::make_unique<devfs::FileSystem>());
+
+  app_loads = new std::map<vfs::Vnode*, AppLoadInfo>;
+  task_manager->NewTask().InitContext(fat::TaskWriteBack, 0).Wakeup();
   task_manager->NewTask().InitContext(TaskTerminal, 0).Wakeup();
+  task_manager->NewTask().InitContext(TaskCompositor, 0).Wakeup();
 
   char str[128];
 
@@ -159,6 +159,7 @@ void InitializeMouse() {
   DrawMouseCursor(mouse_window->Writer(), {0, 0});
 
   auto mouse_layer_id = layer_manager->NewLayer().SetWindow(mouse_window).ID();
+  layer_manager->SetCursorLayer(mouse_layer_id);
 
   auto mouse = std::make_shared<Mouse>(mouse_layer_id);
   mouse->SetPosition({200, 200});
@@ -1,16 +1,22 @@
 #include "paging.hpp"
 
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <vector>
 
 #include "asmfunc.h"
 #include "logger.hpp"
 #include "memory_manager.hpp"
+#include "msr.hpp"
 #include "task.hpp"
 
 namespace {
 const uint64_t kPageSize4K = 4096;
 const uint64_t kPageSize2M = 512 * kPageSize4K;
 const uint64_t kPageSize1G = 512 * kPageSize2M;
+// size of the kernel buffer which SyncFileMapping writes dirty pages from
+const size_t kSyncBounceBytes = 16 * kPageSize4K;
 
 alignas(kPageSize4K) std::array<uint64_t, 512> pml4_table;
 alignas(kPageSize4K) std::array<uint64_t, 512> pdp_table;
@@ -33,10 +39,82 @@ void SetupIdentityPageTable() {
   SetCR0(GetCR0() & 0xfffeffff);  // Clear WP
 }
 
-void InitializePaging() { SetupIdentityPageTable(); }
+namespace {
+/* PAT entries, selected by the PAT, PCD and PWT bits of an entry in this
+ * order. The power-on value has write-through at 1, which no page here uses;
+ * it becomes write-combining, so that PWT alone selects write-combining.
+ * PAT is part of every x86-64 CPU.
+ */
+const uint64_t kPATWriteBack = 0x06, kPATWriteCombining = 0x01,
+               kPATUncachedMinus = 0x07, kPATUncached = 0x00,
+               kPATWriteThrough = 0x04;
+const uint64_t kPATValue = kPATWriteBack | kPATWriteCombining << 8 |
+                           kPATUncachedMinus << 16 | kPATUncached << 24 |
+                           kPATWriteBack << 32 | kPATWriteThrough << 40 |
+                           kPATUncachedMinus << 48 | kPATUncached << 56;
+const uint64_t kPageWriteThroughBit = 1u << 3;  // PWT, selects PAT entry 1
+
+void SetupPAT() {
+  __asm__ volatile("wbinvd");
+  WriteMSR(kIA32_PAT, kPATValue);
+  __asm__ volatile("wbinvd");
+}
+}  // namespace
+
+void InitializePaging() {
+  SetupPAT();
+  SetupIdentityPageTable();
+}
 
 void ResetCR3() { SetCR3(reinterpret_cast<uint64_t>(&pml4_table[0])); }
 
+bool IsIdentityMapped(const void* addr, size_t bytes) {
+  const uint64_t limit = kPageDirectoryCount * kPageSize1G;
+  const auto a = reinterpret_cast<uint64_t>(addr);
+  return a < limit && bytes <= limit - a;
+}
+
+Error MapWriteCombining(uint64_t addr, uint64_t bytes) {
+  const uint64_t begin = addr & ~(kPageSize4K - 1);
+  const uint64_t end = (addr + bytes + kPageSize4K - 1) & ~(kPageSize4K - 1);
+  if (end > kPageDirectoryCount * kPageSize1G) {
+    return MAKE_ERROR(Error::kIndexOutOfRange);
+  }
+
+  for (uint64_t page_2m = begin & ~(kPageSize2M - 1); page_2m < end;
+       page_2m += kPageSize2M) {
+    auto& pde = page_directory[page_2m / kPageSize1G]
+                              [page_2m % kPageSize1G / kPageSize2M];
+    const bool huge = pde & 0x080;
+    if (huge && begin <= page_2m && page_2m + kPageSize2M <= end) {
+      pde |= kPageWriteThroughBit;
+      continue;
+    }
+
+    PageMapEntry* table = reinterpret_cast<PageMapEntry*>(pde & ~0xfffull);
+    if (huge) {
+      auto [new_table, err] = NewPageMap();
+      if (err) {
+        return err;
+      }
+      table = new_table;
+      for (int i = 0; i < 512; ++i) {
+        table[i].data = (page_2m + i * kPageSize4K) | 0x003;
+      }
+      pde = reinterpret_cast<uint64_t>(table) | 0x003;
+    }
+    for (int i = 0; i < 512; ++i) {
+      const uint64_t page = page_2m + i * kPageSize4K;
+      if (begin <= page && page < end) {
+        table[i].data |= kPageWriteThroughBit;
+      }
+    }
+  }
+
+  SetCR3(GetCR3());  // flush the TLB
+  return MAKE_ERROR(Error::kSuccess);
+}
+
 namespace {
 
 WithError<PageMapEntry*> SetNewPageMapIfNotPresent(PageMapEntry& entry) {
@@ -130,16 +208,51 @@ const FileMapping* FindFileMapping(const std::vector<FileMapping>& fmaps,
   return nullptr;
 }
 
+/** @brief Returns the level 1 entry for the address, or nullptr if no page
+ * table covers it.
+ */
+PageMapEntry* FindPageEntry(uint64_t vaddr) {
+  const LinearAddress4Level addr{vaddr};
+  auto table = reinterpret_cast<PageMapEntry*>(GetCR3());
+  for (int level = 4; level > 1; --level) {
+    const auto& entry = table[addr.Part(level)];
+    if (!entry.bits.present || entry.bits.huge_page) {
+      return nullptr;
+    }
+    table = entry.Pointer();
+  }
+  return &table[addr.Part(1)];
+}
+
+bool PageIsDirty(uint64_t vaddr) {
+  auto entry = FindPageEntry(vaddr);
+  return entry && entry->bits.present && entry->bits.dirty;
+}
+
+void ClearDirty(uint64_t vaddr) {
+  FindPageEntry(vaddr)->bits.dirty = 0;
+  InvalidateTLB(vaddr);
+}
+
 Error PreparePageCache(FileDescriptor& fd, const FileMapping& m,
                        uint64_t causal_addr) {
+  // The handler runs on the interrupt stack shared by all tasks, so it must
+  // not sleep. The app faults again and retries once the holder is done.
+  if (!fd.TryLockLoad()) {
+    return MAKE_ERROR(Error::kWouldBlock);
+  }
   LinearAddress4Level page_vaddr{causal_addr};
   page_vaddr.parts.offset = 0;
   if (auto err = SetupPageMaps(page_vaddr, 1)) {
+    fd.UnlockLoad();
     return err;
   }
   const long file_offset = page_vaddr.value - m.vaddr_begin;
   void* page_cache = reinterpret_cast<void*>(page_vaddr.value);
   fd.Load(page_cache, 4096, file_offset);
+  fd.UnlockLoad();
+  // Loading the page set the dirty bit. Only the app's stores count.
+  ClearDirty(page_vaddr.value);
   return MAKE_ERROR(Error::kSuccess);
 }
 
@@ -226,6 +339,71 @@ Error CopyPageMaps(PageMapEntry* dest, PageMapEntry* src, int part, int start) {
   return MAKE_ERROR(Error::kSuccess);
 }
 
+Error SyncFileMapping(FileDescriptor& fd, const FileMapping& m, uint64_t begin,
+                      uint64_t end) {
+  if (!m.shared) {
+    return MAKE_ERROR(Error::kSuccess);
+  }
+  begin = std::max(begin, m.vaddr_begin) & ~(kPageSize4K - 1);
+  end = std::min(end, m.vaddr_end);
+  const size_t file_size = fd.Size();
+  std::vector<uint8_t> bounce;
+
+  uint64_t page = begin;
+  while (page < end) {
+    if (!PageIsDirty(page)) {
+      page += kPageSize4K;
+      continue;
+    }
+    // The dirty bits are cleared before the pages are read, so a store made
+    // meanwhile marks its page again.
+    const uint64_t run_begin = page;
+    for (; page < end && PageIsDirty(page); page += kPageSize4K) {
+      ClearDirty(page);
+    }
+
+    const size_t offset = run_begin - m.vaddr_begin;
+    if (offset >= file_size) {
+      continue;
+    }
+    // The pages are addresses of the application, which a device cannot
+    // reach by DMA. They are copied to kernel memory a part at a time.
+    const size_t run_bytes =
+        std::min<size_t>(page - run_begin, file_size - offset);
+    bounce.resize(std::min(run_bytes, kSyncBounceBytes));
+    for (size_t done = 0; done < run_bytes; done += bounce.size()) {
+      const size_t n = std::min(run_bytes - done, bounce.size());
+      memcpy(bounce.data(), reinterpret_cast<const void*>(run_begin + done),
+             n);
+      if (fd.WriteAt(bounce.data(), n, offset + done) != n) {
+        return MAKE_ERROR(Error::kIOError);
+      }
+    }
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error UnmapFileMapping(FileDescriptor& fd, const FileMapping& m) {
+  if (auto err = SyncFileMapping(fd, m, m.vaddr_begin, m.vaddr_end)) {
+    return err;
+  }
+  for (uint64_t page = m.vaddr_begin; page < m.vaddr_end;
+       page += kPageSize4K) {
+    auto entry = FindPageEntry(page);
+    if (entry == nullptr || !entry->bits.present) {
+      continue;
+    }
+    const FrameID frame{reinterpret_cast<uintptr_t>(entry->Pointer()) /
+                        kBytesPerFrame};
+    entry->data = 0;
+    InvalidateTLB(page);
+    if (auto err = memory_manager->Free(frame, 1)) {
+      return err;
+    }
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
 Error HandlePageFault(uint64_t error_code, uint64_t causal_addr) {
   auto& task = task_manager->CurrentTask();
   const bool present = (error_code >> 0) & 1;
@@ -12,6 +12,9 @@
 
 #include "error.hpp"
 
+class FileDescriptor;
+struct FileMapping;
+
 /** @brief Number of page directories to be statically reserved
  *
  * This constant is used in SetupIdentityPageMap.
@@ -29,6 +32,21 @@ void SetupIdentityPageTable();
 void InitializePaging();
 void ResetCR3();
 
+/** @brief Returns true if [addr, addr + bytes) lies in the identity map, so
+ * that its virtual addresses are also its physical addresses. Devices which
+ * access memory by DMA need such buffers.
+ */
+bool IsIdentityMapped(const void* addr, size_t bytes);
+
+/** @brief Maps [addr, addr + bytes) of the identity map as write-combining.
+ *
+ * Writes to such memory are buffered and sent in bursts, which suits frame
+ * buffers. The 2 MiB pages which the range covers only partly are split into
+ * 4 KiB pages, so that memory around the range keeps its memory type. Needs
+ * the memory manager for the page tables of the split pages.
+ */
+Error MapWriteCombining(uint64_t addr, uint64_t bytes);
+
 union LinearAddress4Level {
   uint64_t value;
 
@@ -114,3 +132,14 @@ Error SetupPageMaps(LinearAddress4Level addr, size_t num_4kpages,
 Error CleanPageMaps(LinearAddress4Level addr);
 Error CopyPageMaps(PageMapEntry* dest, PageMapEntry* src, int part, int start);
 Error HandlePageFault(uint64_t error_code, uint64_t causal_addr);
+
+/** @brief Writes the pages of a shared file mapping within [begin, end) which
+ * were stored to since they were loaded or last written back. The dirty bits
+ * of their page table entries tell which pages they are. Runs of such pages
+ * are written with one call each, and nothing is written past the end of the
+ * file. Private mappings are left alone.
+ */
+Error SyncFileMapping(FileDescriptor& fd, const FileMapping& m, uint64_t begin,
+                      uint64_t end);
+/** @brief Writes back a shared file mapping and frees its pages. */
+Error UnmapFileMapping(FileDescriptor& fd, const FileMapping& m);
@@ -6,6 +6,8 @@
 
 #include "pci.hpp"
 
+#include <algorithm>
+
 #include "asmfunc.h"
 #include "logger.hpp"
 
@@ -170,11 +172,43 @@ namespace {
     return MAKE_ERROR(Error::kSuccess);
   }
 
-  /** @brief 指定された MSI レジスタを設定する */
+  /** @brief 指定された MSI-X レジスタを設定する
+   *
+   * MSI-X テーブルの先頭 2^num_vector_exponent 個のエントリに
+   * 同じメッセージを設定し，マスクを解除してから MSI-X を有効化する．
+   */
   Error ConfigureMSIXRegister(const Device& dev, uint8_t cap_addr,
                              uint32_t msg_addr, uint32_t msg_data,
                              unsigned int num_vector_exponent) {
-    return MAKE_ERROR(Error::kNotImplemented);
+    auto header = ReadCapabilityHeader(dev, cap_addr);
+    const unsigned int table_size = (header.bits.cap & 0x7ffu) + 1;
+
+    // テーブルオフセットの下位 3 ビットはテーブルを含む BAR の番号 (BIR)
+    const auto table_reg = ReadConfReg(dev, cap_addr + 4);
+    Device bar_dev = dev;
+    auto [ bar, err ] = ReadBar(bar_dev, table_reg & 0x7u);
+    if (err) {
+      return err;
+    }
+    if (bar & 1u) {  // MSI-X テーブルは I/O 空間には置けない
+      return MAKE_ERROR(Error::kInvalidFormat);
+    }
+    auto table = reinterpret_cast<volatile uint32_t*>(
+        (bar & ~static_cast<uint64_t>(0xf)) + (table_reg & ~0x7u));
+
+    const unsigned int num_vectors =
+      std::min(1u << num_vector_exponent, table_size);
+    for (unsigned int i = 0; i < num_vectors; ++i) {
+      table[4 * i + 0] = msg_addr;
+      table[4 * i + 1] = 0;
+      table[4 * i + 2] = msg_data;
+      table[4 * i + 3] = 0;  // Vector Control: マスクを解除する
+    }
+
+    // Message Control の bit 15 が MSI-X Enable
+    header.bits.cap |= 0x8000u;
+    WriteConfReg(dev, cap_addr, header.data);
+    return MAKE_ERROR(Error::kSuccess);
   }
 }
 
@@ -0,0 +1,120 @@
+#include "region.hpp"
+
+#include <algorithm>
+
+namespace {
+Rectangle<int> BoundingBox(const Rectangle<int>& a, const Rectangle<int>& b) {
+  const auto pos = ElementMin(a.pos, b.pos);
+  const auto end = ElementMax(a.pos + a.size, b.pos + b.size);
+  return {pos, end - pos};
+}
+
+/** @brief Splits the part of r outside of q into up to 4 rectangles: the
+ * bands above and below q, and the parts left and right of q between them.
+ */
+template <class F>
+void ForEachOutside(const Rectangle<int>& r, const Rectangle<int>& q, F f) {
+  const auto r_end = r.pos + r.size;
+  const auto q_end = q.pos + q.size;
+  const int top = std::max(r.pos.y, q.pos.y);
+  const int bottom = std::min(r_end.y, q_end.y);
+  if (r.pos.y < top) {
+    f(Rectangle<int>{r.pos, {r.size.x, top - r.pos.y}});
+  }
+  if (bottom < r_end.y) {
+    f(Rectangle<int>{{r.pos.x, bottom}, {r.size.x, r_end.y - bottom}});
+  }
+  if (r.pos.x < q.pos.x) {
+    f(Rectangle<int>{{r.pos.x, top}, {q.pos.x - r.pos.x, bottom - top}});
+  }
+  if (q_end.x < r_end.x) {
+    f(Rectangle<int>{{q_end.x, top}, {r_end.x - q_end.x, bottom - top}});
+  }
+}
+}  // namespace
+
+void Region::Add(const Rectangle<int>& rect) {
+  if (RectArea(rect) == 0) {
+    return;
+  }
+
+  for (size_t i = 0; i < rects_.size(); ++i) {
+    const auto q = rects_[i];
+    if (Contains(q, rect)) {
+      return;
+    }
+    // merging wastes no more pixels than the two have in common
+    const auto box = BoundingBox(q, rect);
+    if (RectArea(box) <= RectArea(q) + RectArea(rect)) {
+      rects_.erase(rects_.begin() + i);
+      Add(box);
+      return;
+    }
+  }
+
+  rects_.erase(std::remove_if(rects_.begin(), rects_.end(),
+                              [&rect](const auto& q) {
+                                return Contains(rect, q);
+                              }),
+               rects_.end());
+  for (const auto& q : rects_) {
+    if (Overlaps(q, rect)) {
+      const auto covered = q;
+      ForEachOutside(rect, covered, [this](const auto& r) { Add(r); });
+      return;
+    }
+  }
+
+  rects_.push_back(rect);
+  if (rects_.size() > kMaxRects) {
+    MergeClosestPair();
+  }
+}
+
+void SubtractRect(const Rectangle<int>& r, const Rectangle<int>& q,
+                  std::vector<Rectangle<int>>& out) {
+  if (!Overlaps(r, q)) {
+    out.push_back(r);
+    return;
+  }
+  ForEachOutside(r, q, [&out](const auto& piece) { out.push_back(piece); });
+}
+
+long Region::Area() const {
+  long area = 0;
+  for (const auto& r : rects_) {
+    area += RectArea(r);
+  }
+  return area;
+}
+
+void Region::MergeClosestPair() {
+  size_t best_i = 0, best_j = 1;
+  long best_waste = -1;
+  for (size_t i = 0; i < rects_.size(); ++i) {
+    for (size_t j = i + 1; j < rects_.size(); ++j) {
+      const long waste = RectArea(BoundingBox(rects_[i], rects_[j])) -
+                         RectArea(rects_[i]) - RectArea(rects_[j]);
+      if (best_waste < 0 || waste < best_waste) {
+        best_i = i;
+        best_j = j;
+        best_waste = waste;
+      }
+    }
+  }
+
+  auto box = BoundingBox(rects_[best_i], rects_[best_j]);
+  rects_.erase(rects_.begin() + best_j);
+  rects_.erase(rects_.begin() + best_i);
+  // absorb whatever the box now overlaps so that the list only shrinks
+  for (size_t i = 0; i < rects_.size();) {
+    if (Overlaps(box, rects_[i])) {
+      box = BoundingBox(box, rects_[i]);
+      rects_.erase(rects_.begin() + i);
+      i = 0;
+    } else {
+      ++i;
+    }
+  }
+  rects_.push_back(box);
+}
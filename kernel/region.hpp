@@ -0,0 +1,60 @@
+/**
+ * @file region.hpp
+ *
+ * Screen areas made of rectangles, such as the damage the compositor redraws.
+ */
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "graphics.hpp"
+
+/** @brief Region is a set of pixels held as rectangles which do not overlap.
+ *
+ * A rectangle added to the region is merged with one already in it when
+ * their bounding box is not much larger than the two, such as the old and the
+ * new area of a window dragged by a few pixels. Otherwise the part not yet
+ * covered is added, so that no pixel is listed twice. The list is kept at
+ * kMaxRects or fewer by merging the pair whose bounding box wastes the least.
+ */
+class Region {
+ public:
+  static const size_t kMaxRects = 16;
+
+  /** @brief Adds the rectangle to the region. Empty ones are ignored. */
+  void Add(const Rectangle<int>& rect);
+  void Clear() { rects_.clear(); }
+  bool Empty() const { return rects_.empty(); }
+  const std::vector<Rectangle<int>>& Rects() const { return rects_; }
+  /** @brief Returns the number of pixels in the region. */
+  long Area() const;
+
+ private:
+  std::vector<Rectangle<int>> rects_{};
+
+  void MergeClosestPair();
+};
+
+/** @brief Returns the number of pixels in the rectangle, 0 if it is empty. */
+inline long RectArea(const Rectangle<int>& r) {
+  return r.size.x <= 0 || r.size.y <= 0 ? 0 : long{r.size.x} * r.size.y;
+}
+
+/** @brief Returns true if the rectangles share at least one pixel. */
+inline bool Overlaps(const Rectangle<int>& a, const Rectangle<int>& b) {
+  return a.pos.x < b.pos.x + b.size.x && b.pos.x < a.pos.x + a.size.x &&
+         a.pos.y < b.pos.y + b.size.y && b.pos.y < a.pos.y + a.size.y;
+}
+
+/** @brief Returns true if every pixel of inner is in outer. */
+inline bool Contains(const Rectangle<int>& outer, const Rectangle<int>& inner) {
+  return outer.pos.x <= inner.pos.x && outer.pos.y <= inner.pos.y &&
+         inner.pos.x + inner.size.x <= outer.pos.x + outer.size.x &&
+         inner.pos.y + inner.size.y <= outer.pos.y + outer.size.y;
+}
+
+/** @brief Appends the part of r outside of q to out as up to 4 rectangles
+ * which do not overlap. */
+void SubtractRect(const Rectangle<int>& r, const Rectangle<int>& q,
+                  std::vector<Rectangle<int>>& out);
@@ -2,12 +2,15 @@
 
 #include <fcntl.h>
 
+#include <algorithm>
 #include <array>
 #include <cerrno>
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
 
 #include "app_event.hpp"
+#include "app_file.hpp"
 #include "asmfunc.h"
 #include "font.hpp"
 #include "keyboard.hpp"
@@ -16,6 +19,7 @@
 #include "task.hpp"
 #include "terminal.hpp"
 #include "timer.hpp"
+#include "vfs.hpp"
 
 namespace syscall {
 struct Result {
@@ -107,6 +111,9 @@ Result DoWinFunc(Func f, uint64_t layer_id_flags, Args... args) {
   if ((layer_flags & 1) == 0) {
     __asm__("cli");
     layer_manager->Draw(layer_id);
+    if (layer_flags & 2) {
+      layer_manager->Present();
+    }
     __asm__("sti");
   }
 
@@ -146,7 +153,7 @@ SYSCALL(WinDrawLine) {
         const int dy = y1 - y0 + sign(y1 - y0);
 
         if (dx == 0 && dy == 0) {
-          win.Writer()->Write({x0, y0}, ToColor(color));
+          win.Writer()->FillSpan({x0, y0}, 1, ToColor(color));
           return Result{0, 0};
         }
 
@@ -160,9 +167,17 @@ SYSCALL(WinDrawLine) {
           }
           const auto roundish = y1 >= y0 ? floord : ceild;
           const double m = static_cast<double>(dy) / dx;
-          for (int x = x0; x <= x1; ++x) {
-            const int y = roundish(m * (x - x0) + y0);
-            win.Writer()->Write({x, y}, ToColor(color));
+          // pixels on the same row form one span
+          int span_x = x0;
+          int span_y = y0;
+          for (int x = x0 + 1; x <= x1 + 1; ++x) {
+            const int y = x <= x1 ? roundish(m * (x - x0) + y0) : span_y + 1;
+            if (y != span_y) {
+              win.Writer()->FillSpan({span_x, span_y}, x - span_x,
+                                     ToColor(color));
+              span_x = x;
+              span_y = y;
+            }
           }
         } else {
           if (dy < 0) {
@@ -173,7 +188,7 @@ SYSCALL(WinDrawLine) {
           const double m = static_cast<double>(dx) / dy;
           for (int y = y0; y <= y1; ++y) {
             const int x = roundish(m * (y - y0) + x0);
-            win.Writer()->Write({x, y}, ToColor(color));
+            win.Writer()->FillSpan({x, y}, 1, ToColor(color));
           }
         }
         return Result{0, 0};
@@ -190,6 +205,43 @@ SYSCALL(CloseWindow) {
   return {0, 0};
 }
 
+SYSCALL(WinMove) {
+  const uint32_t layer_flags = arg1 >> 32;
+  const unsigned int layer_id = arg1 & 0xffffffff;
+  const Vector2D<int> pos{static_cast<int>(arg2), static_cast<int>(arg3)};
+
+  __asm__("cli");
+  auto layer = layer_manager->FindLayer(layer_id);
+  if (layer) {
+    layer_manager->Move(layer_id, pos);
+    if (layer_flags & 2) {
+      layer_manager->Present();
+    }
+  }
+  __asm__("sti");
+  return {0, layer ? 0 : EBADF};
+}
+
+SYSCALL(WinSetOpacity) {
+  const uint32_t layer_flags = arg1 >> 32;
+  const unsigned int layer_id = arg1 & 0xffffffff;
+  const uint8_t opacity = std::clamp(static_cast<int>(arg2), 0, 255);
+
+  __asm__("cli");
+  auto layer = layer_manager->FindLayer(layer_id);
+  if (layer) {
+    layer->SetOpacity(opacity);
+    if ((layer_flags & 1) == 0) {
+      layer_manager->Draw(layer_id);
+    }
+    if (layer_flags & 2) {
+      layer_manager->Present();
+    }
+  }
+  __asm__("sti");
+  return {0, layer ? 0 : EBADF};
+}
+
 SYSCALL(ReadEvent) {
   if (arg1 < 0x8000'0000'0000'0000) {
     return {0, EFAULT};
@@ -302,17 +354,24 @@ size_t AllocateFD(Task& task) {
   return num_files;
 }
 
-std::pair<fat::DirectoryEntry*, int> CreateFile(const char* path) {
-  auto [file, err] = fat::CreateFile(path);
+int ErrorToErrno(const Error& err) {
   switch (err.Cause()) {
+    case Error::kSuccess:
+      return 0;
     case Error::kIsDirectory:
-      return {file, EISDIR};
+      return EISDIR;
+    case Error::kNotDirectory:
+      return ENOTDIR;
     case Error::kNoSuchEntry:
-      return {file, ENOENT};
+      return ENOENT;
     case Error::kNoEnoughMemory:
-      return {file, ENOSPC};
+      return ENOSPC;
+    case Error::kInvalidFormat:
+      return EINVAL;
+    case Error::kNotImplemented:
+      return EPERM;
     default:
-      return {file, 0};
+      return EIO;
   }
 }
 }  // namespace
@@ -328,22 +387,23 @@ SYSCALL(OpenFile) {
     return {0, 0};
   }
 
-  auto [file, post_slash] = fat::FindFile(path);
-  if (file == nullptr) {
-    if ((flags & O_CREAT) == 0) {
-      return {0, ENOENT};
-    }
-    auto [new_file, err] = CreateFile(path);
-    if (err) {
-      return {0, err};
+  auto file = vfs::Resolve(path);
+  if (file.error.Cause() == Error::kNoSuchEntry && (flags & O_CREAT) != 0) {
+    file = vfs::Create(path);
+  }
+  if (file.error) {
+    return {0, ErrorToErrno(file.error)};
+  }
+  if ((flags & O_TRUNC) != 0 && (flags & O_ACCMODE) != O_RDONLY &&
+      file.value->Type() == vfs::FileType::kRegular) {
+    if (auto err = file.value->Truncate(0);
+        err && err.Cause() != Error::kNotImplemented) {
+      return {0, ErrorToErrno(err)};
     }
-    file = new_file;
-  } else if (file->attr != fat::Attribute::kDirectory && post_slash) {
-    return {0, ENOENT};
   }
 
   size_t fd = AllocateFD(task);
-  task.Files()[fd] = std::make_unique<fat::FileDescriptor>(*file);
+  task.Files()[fd] = file.value->Open();
   return {fd, 0};
 }
 
@@ -376,7 +436,7 @@ SYSCALL(DemandPages) {
 SYSCALL(MapFile) {
   const int fd = arg1;
   size_t* file_size = reinterpret_cast<size_t*>(arg2);
-  // const int flags = arg3;
+  const int flags = arg3;
   __asm__("cli");
   auto& task = task_manager->CurrentTask();
   __asm__("sti");
@@ -389,17 +449,165 @@ SYSCALL(MapFile) {
   const uint64_t vaddr_end = task.FileMapEnd();
   const uint64_t vaddr_begin = (vaddr_end - *file_size) & 0xffff'ffff'ffff'f000;
   task.SetFileMapEnd(vaddr_begin);
-  task.FileMaps().push_back(FileMapping{fd, vaddr_begin, vaddr_end});
+  task.FileMaps().push_back(FileMapping{fd, vaddr_begin, vaddr_end,
+                                        (flags & kAppMapShared) != 0});
   return {vaddr_begin, 0};
 }
 
+namespace {
+std::vector<FileMapping>::iterator FindFileMapping(Task& task,
+                                                   uint64_t addr) {
+  auto& fmaps = task.FileMaps();
+  return std::find_if(fmaps.begin(), fmaps.end(), [addr](const auto& m) {
+    return m.vaddr_begin <= addr && addr < m.vaddr_end;
+  });
+}
+}  // namespace
+
+SYSCALL(SyncMappedFile) {
+  const uint64_t addr = arg1;
+  const size_t len = arg2;
+  __asm__("cli");
+  auto& task = task_manager->CurrentTask();
+  __asm__("sti");
+
+  auto it = FindFileMapping(task, addr);
+  if (it == task.FileMaps().end()) {
+    return {0, EINVAL};
+  } else if (it->fd >= task.Files().size() || !task.Files()[it->fd]) {
+    return {0, EBADF};
+  }
+  if (SyncFileMapping(*task.Files()[it->fd], *it, addr, addr + len)) {
+    return {0, EIO};
+  }
+  return {0, 0};
+}
+
+SYSCALL(UnmapFile) {
+  const uint64_t addr = arg1;
+  __asm__("cli");
+  auto& task = task_manager->CurrentTask();
+  __asm__("sti");
+
+  auto it = FindFileMapping(task, addr);
+  if (it == task.FileMaps().end()) {
+    return {0, EINVAL};
+  } else if (it->fd >= task.Files().size() || !task.Files()[it->fd]) {
+    return {0, EBADF};
+  }
+  auto err = UnmapFileMapping(*task.Files()[it->fd], *it);
+  task.FileMaps().erase(it);
+  return {0, err ? EIO : 0};
+}
+
+namespace {
+AppFileType ToAppFileType(vfs::FileType type) {
+  switch (type) {
+    case vfs::FileType::kDirectory:
+      return kAppFileDirectory;
+    case vfs::FileType::kDevice:
+      return kAppFileDevice;
+    default:
+      return kAppFileRegular;
+  }
+}
+
+void FillAppFileStat(const vfs::Vnode& file, AppFileStat& stat) {
+  const auto s = file.Stat();
+  stat.size = s.size;
+  stat.type = ToAppFileType(s.type);
+  stat.attr = s.attr;
+  stat.create_date = s.create_date;
+  stat.create_time = s.create_time;
+  stat.write_date = s.write_date;
+  stat.write_time = s.write_time;
+  stat.access_date = s.access_date;
+}
+}  // namespace
+
+SYSCALL(ReadDirectory) {
+  const int fd = arg1;
+  auto buf = reinterpret_cast<uint8_t*>(arg2);
+  const size_t len = arg3;
+  __asm__("cli");
+  auto& task = task_manager->CurrentTask();
+  __asm__("sti");
+
+  if (fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
+    return {0, EBADF};
+  }
+  auto node = task.Files()[fd]->Node();
+  if (node == nullptr || node->Type() != vfs::FileType::kDirectory) {
+    return {0, ENOTDIR};
+  }
+  // vfs::Vnode::Open opens every directory as a DirectoryDescriptor
+  auto& dir = static_cast<vfs::DirectoryDescriptor&>(*task.Files()[fd]);
+
+  size_t filled = 0;
+  const char* name;
+  while (auto entry = dir.PeekEntry(name)) {
+    const size_t name_len = strlen(name);
+    const size_t reclen =
+        (offsetof(AppDirEntry, name) + name_len + 1 + 7) & ~size_t{7};
+    if (len - filled < reclen) {
+      if (filled == 0) {
+        return {0, EINVAL};
+      }
+      break;
+    }
+
+    auto rec = reinterpret_cast<AppDirEntry*>(&buf[filled]);
+    rec->reclen = reclen;
+    rec->namelen = name_len;
+    rec->type = ToAppFileType(entry->Type());
+    rec->size = entry->Size();
+    memcpy(rec->name, name, name_len + 1);
+    filled += reclen;
+    dir.NextEntry();
+  }
+  return {filled, 0};
+}
+
+SYSCALL(Stat) {
+  const char* path = reinterpret_cast<const char*>(arg1);
+  auto stat = reinterpret_cast<AppFileStat*>(arg2);
+
+  auto [file, err] = vfs::Resolve(path);
+  if (err) {
+    return {0, ErrorToErrno(err)};
+  }
+  FillAppFileStat(*file, *stat);
+  return {0, 0};
+}
+
+SYSCALL(FStat) {
+  const int fd = arg1;
+  auto stat = reinterpret_cast<AppFileStat*>(arg2);
+  __asm__("cli");
+  auto& task = task_manager->CurrentTask();
+  __asm__("sti");
+
+  if (fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
+    return {0, EBADF};
+  }
+  auto node = task.Files()[fd]->Node();
+  if (node == nullptr) {
+    // a terminal or a pipe
+    *stat = AppFileStat{};
+    stat->type = kAppFileDevice;
+    return {0, 0};
+  }
+  FillAppFileStat(*node, *stat);
+  return {0, 0};
+}
+
 #undef SYSCALL
 
 }  // namespace syscall
 
 using SyscallFuncType = syscall::Result(uint64_t, uint64_t, uint64_t, uint64_t,
                                         uint64_t, uint64_t);
-extern "C" std::array<SyscallFuncType*, 0x10> syscall_table{
+extern "C" std::array<SyscallFuncType*, 0x17> syscall_table{
     /* 0x00 */ syscall::LogString,
     /* 0x01 */ syscall::PutString,
     /* 0x02 */ syscall::Exit,
@@ -416,6 +624,13 @@ extern "C" std::array<SyscallFuncType*, 0x10> syscall_table{
     /* 0x0d */ syscall::ReadFile,
     /* 0x0e */ syscall::DemandPages,
     /* 0x0f */ syscall::MapFile,
+    /* 0x10 */ syscall::ReadDirectory,
+    /* 0x11 */ syscall::Stat,
+    /* 0x12 */ syscall::FStat,
+    /* 0x13 */ syscall::SyncMappedFile,
+    /* 0x14 */ syscall::UnmapFile,
+    /* 0x15 */ syscall::WinMove,
+    /* 0x16 */ syscall::WinSetOpacity,
 };
 
 void InitializeSyscall() {
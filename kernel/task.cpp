@@ -14,6 +14,18 @@ void Erase(T& c, const U& value) {
 void TaskIdle(uint64_t task_id, int64_t data) {
   while (true) __asm__("hlt");
 }
+
+uint64_t SaveInterruptFlag() {
+  uint64_t rflags;
+  __asm__ volatile("pushfq\n\tpopq %0\n\tcli" : "=r"(rflags));
+  return rflags;
+}
+
+void RestoreInterruptFlag(uint64_t rflags) {
+  if (rflags & (1u << 9)) {
+    __asm__ volatile("sti");
+  }
+}
 }  // namespace
 
 Task::Task(uint64_t id) : id_{id}, msgs_{} {}
@@ -268,6 +280,73 @@ Task* TaskManager::RotateCurrentRunQueue(bool current_sleep) {
 
 TaskManager* task_manager;
 
+void Mutex::Lock() {
+  if (task_manager == nullptr) {
+    return;
+  }
+  const auto rflags = SaveInterruptFlag();
+  Task* current = &task_manager->CurrentTask();
+  while (!Acquire(current)) {
+    current->Sleep();
+  }
+  RestoreInterruptFlag(rflags);
+}
+
+bool Mutex::TryLock() {
+  if (task_manager == nullptr) {
+    return true;
+  }
+  const auto rflags = SaveInterruptFlag();
+  Task* current = &task_manager->CurrentTask();
+  const bool locked = (owner_ == nullptr || owner_ == current) &&
+                      Acquire(current);
+  RestoreInterruptFlag(rflags);
+  return locked;
+}
+
+void Mutex::Unlock() {
+  if (task_manager == nullptr) {
+    return;
+  }
+  const auto rflags = SaveInterruptFlag();
+  if (Task* next = Release()) {
+    next->Wakeup();
+  }
+  RestoreInterruptFlag(rflags);
+}
+
+bool Mutex::Acquire(Task* task) {
+  auto it = std::find(waiters_.begin(), waiters_.end(), task);
+  if (owner_ != nullptr && owner_ != task) {
+    // a message may wake the task before the mutex is released
+    if (it == waiters_.end()) {
+      waiters_.push_back(task);
+    }
+    return false;
+  }
+  // A task woken by a message may find the mutex free while still queued.
+  // Unlock would wake it again instead of the waiters behind it.
+  if (it != waiters_.end()) {
+    waiters_.erase(it);
+  }
+  owner_ = task;
+  ++depth_;
+  return true;
+}
+
+Task* Mutex::Release() {
+  if (depth_ == 0 || --depth_ > 0) {
+    return nullptr;
+  }
+  owner_ = nullptr;
+  if (waiters_.empty()) {
+    return nullptr;
+  }
+  Task* next = waiters_.front();
+  waiters_.pop_front();
+  return next;
+}
+
 void InitializeTask() {
   task_manager = new TaskManager;
 
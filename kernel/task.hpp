@@ -33,6 +33,7 @@ class TaskManager;
 struct FileMapping {
   int fd;
   uint64_t vaddr_begin, vaddr_end;
+  bool shared;  // stores are written back to the file
 };
 
 class Task {
@@ -119,4 +120,50 @@ class TaskManager {
 
 extern TaskManager* task_manager;
 
+/** @brief Mutex lets one task at a time run a critical section which may
+ * take long, such as one which waits for a device. Other tasks which lock it
+ * sleep until it is unlocked, so interrupts stay enabled meanwhile.
+ *
+ * The owner may lock it again. It is released when every Lock has been
+ * matched by Unlock. Before the task manager is initialized there is only one
+ * flow of control, and locking does nothing.
+ */
+class Mutex {
+ public:
+  void Lock();
+  /** @brief Locks the mutex unless that has to wait for another task.
+   *
+   * @return false if another task holds the mutex
+   */
+  bool TryLock();
+  void Unlock();
+
+  /** @brief The bookkeeping of Lock and Unlock on behalf of task, which
+   * neither sleeps nor wakes a task.
+   *
+   * Acquire takes the mutex for task, or queues task and returns false if
+   * another task holds it. Release undoes one Acquire and returns the waiter
+   * to wake, if the mutex became free and has one.
+   */
+  bool Acquire(Task* task);
+  Task* Release();
+
+ private:
+  Task* owner_{nullptr};
+  unsigned int depth_{0};
+  std::deque<Task*> waiters_{};
+};
+
+/** @brief MutexGuard holds a mutex for its lifetime. */
+class MutexGuard {
+ public:
+  explicit MutexGuard(Mutex& mutex) : mutex_{mutex} { mutex_.Lock(); }
+  ~MutexGuard() { mutex_.Unlock(); }
+  MutexGuard(const MutexGuard&) = delete;
+  MutexGuard& operator=(const MutexGuard&) = delete;
+
+ private:
+  Mutex& mutex_;
+};
+
 void InitializeTask();
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "terminal.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <limits>
 
@@ -145,32 +146,25 @@ Error FreePML4(Task& current_task) {
   return memory_manager->Free(frame, 1);
 }
 
-void ListAllEntries(FileDescriptor& fd, uint32_t dir_cluster) {
-  const auto kEntriesPerCluster =
-      fat::bytes_per_cluster / sizeof(fat::DirectoryEntry);
-
-  while (dir_cluster != fat::kEndOfClusterchain) {
-    auto dir = fat::GetSectorByCluster<fat::DirectoryEntry>(dir_cluster);
-
-    for (int i = 0; i < kEntriesPerCluster; ++i) {
-      if (dir[i].name[0] == 0x00) {
-        return;
-      } else if (static_cast<uint8_t>(dir[i].name[0]) == 0xe5) {
-        continue;
-      } else if (dir[i].attr == fat::Attribute::kLongName) {
-        continue;
-      }
-
-      char name[13];
-      fat::FormatName(dir[i], name);
-      PrintToFD(fd, "%s\n", name);
+void ListAllEntries(FileDescriptor& fd, vfs::Vnode& dir) {
+  auto it = dir.ReadDir();
+  char name[vfs::kMaxNameBytes];
+  // names are written in batches rather than one Write per entry
+  std::string batch;
+  while (it->Next(name)) {
+    batch.append(name);
+    batch.push_back('\n');
+    if (batch.size() >= 4096) {
+      fd.Write(batch.data(), batch.size());
+      batch.clear();
     }
-
-    dir_cluster = fat::NextCluster(dir_cluster);
+  }
+  if (!batch.empty()) {
+    fd.Write(batch.data(), batch.size());
   }
 }
 
-WithError<AppLoadInfo> LoadApp(fat::DirectoryEntry& file_entry, Task& task) {
+WithError<AppLoadInfo> LoadApp(vfs::Vnode& file, Task& task) {
   PageMapEntry* temp_pml4;
   if (auto [pml4, err] = SetupPML4(task); err) {
     return {{}, err};
@@ -178,15 +172,18 @@ WithError<AppLoadInfo> LoadApp(fat::DirectoryEntry& file_entry, Task& task) {
     temp_pml4 = pml4;
   }
 
-  if (auto it = app_loads->find(&file_entry); it != app_loads->end()) {
+  if (auto it = app_loads->find(&file); it != app_loads->end()) {
     AppLoadInfo app_load = it->second;
     auto err = CopyPageMaps(temp_pml4, app_load.pml4, 4, 256);
     app_load.pml4 = temp_pml4;
     return {app_load, err};
   }
 
-  std::vector<uint8_t> file_buf(file_entry.file_size);
-  fat::LoadFile(&file_buf[0], file_buf.size(), file_entry);
+  std::vector<uint8_t> file_buf(file.Size());
+  if (file_buf.size() < sizeof(Elf64_Ehdr)) {
+    return {{}, MAKE_ERROR(Error::kInvalidFile)};
+  }
+  file.Open()->Load(&file_buf[0], file_buf.size(), 0);
 
   auto elf_header = reinterpret_cast<Elf64_Ehdr*>(&file_buf[0]);
   if (memcmp(elf_header->e_ident,
@@ -202,7 +199,7 @@ WithError<AppLoadInfo> LoadApp(fat::DirectoryEntry& file_entry, Task& task) {
   }
 
   AppLoadInfo app_load{last_addr, elf_header->e_entry, temp_pml4};
-  app_loads->insert(std::make_pair(&file_entry, app_load));
+  app_loads->insert(std::make_pair(&file, app_load));
 
   if (auto [pml4, err] = SetupPML4(task); err) {
     return {app_load, err};
@@ -213,32 +210,25 @@ WithError<AppLoadInfo> LoadApp(fat::DirectoryEntry& file_entry, Task& task) {
   return {app_load, err};
 }
 
-fat::DirectoryEntry* FindCommand(const char* command,
-                                 unsigned long dir_cluster = 0) {
-  auto file_entry = fat::FindFile(command, dir_cluster);
-  if (file_entry.first != nullptr &&
-      (file_entry.first->attr == fat::Attribute::kDirectory ||
-       file_entry.second)) {
-    return nullptr;
-  } else if (file_entry.first) {
-    return file_entry.first;
+vfs::Vnode* FindCommand(const char* command) {
+  if (auto [file, err] = vfs::Resolve(command); !err) {
+    return file->Type() == vfs::FileType::kDirectory ? nullptr : file;
   }
-
-  if (dir_cluster != 0 || strchr(command, '/') != nullptr) {
+  if (strchr(command, '/') != nullptr) {
     return nullptr;
   }
 
-  auto apps_entry = fat::FindFile("apps");
-  if (apps_entry.first == nullptr ||
-      apps_entry.first->attr != fat::Attribute::kDirectory) {
+  const std::string app_path = std::string{"apps/"} + command;
+  auto [app, err] = vfs::Resolve(app_path.c_str());
+  if (err || app->Type() == vfs::FileType::kDirectory) {
     return nullptr;
   }
-  return FindCommand(command, apps_entry.first->FirstCluster());
+  return app;
 }
 
 }  // namespace
 
-std::map<fat::DirectoryEntry*, AppLoadInfo>* app_loads;
+std::map<vfs::Vnode*, AppLoadInfo>* app_loads;
 
 Terminal::Terminal(Task& task, const TerminalDescriptor* term_desc)
     : task_{task} {
@@ -376,20 +366,34 @@ void Terminal::ExecuteLine() {
       ++redir_dest;
     }
 
-    auto [file, post_slash] = fat::FindFile(redir_dest);
-    if (file == nullptr) {
-      auto [new_file, err] = fat::CreateFile(redir_dest);
-      if (err) {
+    auto file = vfs::Resolve(redir_dest);
+    if (file.error.Cause() == Error::kNoSuchEntry) {
+      file = vfs::Create(redir_dest);
+      if (file.error) {
         PrintToFD(*files_[2], "failed to create a redirect file: %s\n",
-                  err.Name());
+                  file.error.Name());
         return;
       }
-      file = new_file;
-    } else if (file->attr == fat::Attribute::kDirectory || post_slash) {
+    }
+    if (file.error.Cause() == Error::kNotDirectory ||
+        (!file.error && file.value->Type() == vfs::FileType::kDirectory)) {
       PrintToFD(*files_[2], "cannot redirect to a directory\n");
       return;
+    } else if (file.error) {
+      PrintToFD(*files_[2], "failed to open a redirect file: %s\n",
+                file.error.Name());
+      return;
     }
-    files_[1] = std::make_shared<fat::FileDescriptor>(*file);
+    // the output replaces the old content; devices are written as they are
+    if (file.value->Type() == vfs::FileType::kRegular) {
+      if (auto err = file.value->Truncate(0);
+          err && err.Cause() != Error::kNotImplemented) {
+        PrintToFD(*files_[2], "failed to truncate a redirect file: %s\n",
+                  err.Name());
+        return;
+      }
+    }
+    files_[1] = file.value->Open();
   }
 
   std::shared_ptr<PipeDescriptor> pipe_fd;
@@ -440,42 +444,42 @@ void Terminal::ExecuteLine() {
           dev.class_code.base, dev.class_code.sub, dev.class_code.interface);
     }
   } else if (strcmp(command, "ls") == 0) {
-    if (!first_arg || first_arg[0] == '\0') {
-      ListAllEntries(*files_[1], fat::boot_volume_image->root_cluster);
+    const char* path = first_arg && first_arg[0] != '\0' ? first_arg : "/";
+    auto [file, err] = vfs::Resolve(path);
+    if (err.Cause() == Error::kNotDirectory) {
+      PrintToFD(*files_[2], "%s is not a directory\n", path);
+      exit_code = 1;
+    } else if (err) {
+      PrintToFD(*files_[2], "No such file or directory: %s\n", path);
+      exit_code = 1;
+    } else if (file->Type() == vfs::FileType::kDirectory) {
+      ListAllEntries(*files_[1], *file);
     } else {
-      auto [dir, post_slash] = fat::FindFile(first_arg);
-      if (dir == nullptr) {
-        PrintToFD(*files_[2], "No such file or directory: %s\n", first_arg);
-        exit_code = 1;
-      } else if (dir->attr == fat::Attribute::kDirectory) {
-        ListAllEntries(*files_[1], dir->FirstCluster());
-      } else {
-        char name[13];
-        fat::FormatName(*dir, name);
-        if (post_slash) {
-          PrintToFD(*files_[2], "%s is not a directory\n", name);
-          exit_code = 1;
-        } else {
-          PrintToFD(*files_[1], "%s\n", name);
-        }
-      }
+      PrintToFD(*files_[1], "%s\n", path);
+    }
+  } else if (strcmp(command, "mkdir") == 0) {
+    if (!first_arg || first_arg[0] == '\0') {
+      PrintToFD(*files_[2], "Usage: mkdir <path>\n");
+      exit_code = 1;
+    } else if (auto [dir, err] = vfs::MakeDirectory(first_arg); err) {
+      PrintToFD(*files_[2], "failed to create %s: %s\n", first_arg,
+                err.Name());
+      exit_code = 1;
     }
   } else if (strcmp(command, "cat") == 0) {
     std::shared_ptr<FileDescriptor> fd;
     if (!first_arg || first_arg[0] == '\0') {
       fd = files_[0];
     } else {
-      auto [file_entry, post_slash] = fat::FindFile(first_arg);
-      if (!file_entry) {
-        PrintToFD(*files_[2], "no such file %s\n", first_arg);
+      auto [file, err] = vfs::Resolve(first_arg);
+      if (err.Cause() == Error::kNotDirectory) {
+        PrintToFD(*files_[2], "%s is not a directory\n", first_arg);
         exit_code = 1;
-      } else if (file_entry->attr != fat::Attribute::kDirectory && post_slash) {
-        char name[13];
-        fat::FormatName(*file_entry, name);
-        PrintToFD(*files_[2], "%s is not a directory\n", name);
+      } else if (err) {
+        PrintToFD(*files_[2], "no such file %s\n", first_arg);
         exit_code = 1;
       } else {
-        fd = std::make_shared<fat::FileDescriptor>(*file_entry);
+        fd = file->Open();
       }
     }
     if (fd) {
@@ -504,12 +508,12 @@ void Terminal::ExecuteLine() {
               p_stat.total_frames,
               p_stat.total_frames * kBytesPerFrame / 1024 / 1024);
   } else if (command[0] != 0) {
-    auto file_entry = FindCommand(command);
-    if (!file_entry) {
+    auto file = FindCommand(command);
+    if (!file) {
       PrintToFD(*files_[2], "no such command: %s\n", command);
       exit_code = 1;
     } else {
-      auto [ec, err] = ExecuteFile(*file_entry, command, first_arg);
+      auto [ec, err] = ExecuteFile(*file, command, first_arg);
       if (err) {
         PrintToFD(*files_[2], "failed to exec file: %s\n", err.Name());
         exit_code = -ec;
@@ -535,13 +539,13 @@ void Terminal::ExecuteLine() {
   files_[1] = original_stdout;
 }
 
-WithError<int> Terminal::ExecuteFile(fat::DirectoryEntry& file_entry,
-                                     char* command, char* first_arg) {
+WithError<int> Terminal::ExecuteFile(vfs::Vnode& file, char* command,
+                                     char* first_arg) {
   __asm__("cli");
   auto& task = task_manager->CurrentTask();
   __asm__("sti");
 
-  auto [app_load, err] = LoadApp(file_entry, task);
+  auto [app_load, err] = LoadApp(file, task);
   if (err) {
     return {0, err};
   }
@@ -582,6 +586,14 @@ WithError<int> Terminal::ExecuteFile(fat::DirectoryEntry& file_entry,
       CallApp(argc.value, argv, 3 << 3 | 3, app_load.entry,
               stack_frame_addr.value + stack_size - 8, &task.OSStackPointer());
 
+  for (const auto& m : task.FileMaps()) {
+    if (m.fd < task.Files().size() && task.Files()[m.fd]) {
+      if (auto err = SyncFileMapping(*task.Files()[m.fd], m, m.vaddr_begin,
+                                     m.vaddr_end)) {
+        Log(kError, "failed to write back a mapped file: %s\n", err.Name());
+      }
+    }
+  }
   task.Files().clear();
   task.FileMaps().clear();
 
@@ -11,9 +11,9 @@
 #include <memory>
 #include <optional>
 
-#include "fat.hpp"
 #include "layer.hpp"
 #include "task.hpp"
+#include "vfs.hpp"
 #include "window.hpp"
 
 struct AppLoadInfo {
@@ -21,7 +21,7 @@ struct AppLoadInfo {
   PageMapEntry* pml4;
 };
 
-extern std::map<fat::DirectoryEntry*, AppLoadInfo>* app_loads;
+extern std::map<vfs::Vnode*, AppLoadInfo>* app_loads;
 
 struct TerminalDescriptor {
   std::string command_line;
@@ -61,8 +61,7 @@ class Terminal {
   void Scroll1();
 
   void ExecuteLine();
-  WithError<int> ExecuteFile(fat::DirectoryEntry& file_entry, char* command,
-                             char* first_arg);
+  WithError<int> ExecuteFile(vfs::Vnode& file, char* command, char* first_arg);
   void Print(char32_t c);
 
   std::deque<std::array<char, kLineMax>> cmd_history_{};
@@ -0,0 +1,104 @@
+/**
+ * @file bench_blit.cpp
+ *
+ * Host-side benchmarks of the row kernels in blit.cpp.
+ *
+ * Usage: bench_blit.run
+ * Every kernel the CPU supports copies, fills, keyed-copies and blends rows
+ * of a 1024x768 and a 1920x1080 buffer, with and without non-temporal stores.
+ * Buffers larger than the caches show the cost of memory like a frame
+ * buffer does.
+ */
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "blit.hpp"
+
+namespace {
+
+class Stopwatch {
+ public:
+  Stopwatch() : start_{std::chrono::steady_clock::now()} {}
+  double Seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start_)
+        .count();
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+/** @brief Runs f on every row of the buffer until 0.3 seconds passed and
+ * prints the rate in GB/s of written pixels. */
+template <class F>
+void Run(const char* name, int width, int height, F f) {
+  long frames = 0;
+  Stopwatch sw;
+  do {
+    for (int y = 0; y < height; ++y) {
+      f(y);
+    }
+    blit::Fence();
+    ++frames;
+  } while (sw.Seconds() < 0.3);
+  printf("  %-14s %7.2f GB/s %8.1f frames/s\n", name,
+         4.0 * width * height * frames / sw.Seconds() / 1e9,
+         frames / sw.Seconds());
+}
+
+void RunAll(int width, int height) {
+  std::vector<uint32_t> src(width * height), dst(width * height);
+  for (size_t i = 0; i < src.size(); ++i) {
+    // a third of the pixels is the key, in runs like a cursor or glyphs
+    src[i] = (i / 7) % 3 == 0 ? 0x00ff00ffu : 0x00010101u * (i & 0xff);
+  }
+  // a shadow-like gradient of alpha, premultiplied black
+  std::vector<uint32_t> translucent(width * height);
+  for (size_t i = 0; i < translucent.size(); ++i) {
+    translucent[i] = (255 - (i % width) * 255 / width) << 24;
+  }
+  auto row = [width](auto& v, int y) { return &v[y * width]; };
+
+  for (auto isa : {blit::ISA::kScalar, blit::ISA::kSSE2, blit::ISA::kAVX2}) {
+    if (!blit::Supported(isa)) {
+      continue;
+    }
+    blit::Select(isa);
+    printf("%s %dx%d\n", blit::Name(isa), width, height);
+    Run("copy", width, height, [&](int y) {
+      blit::CopyRow(row(dst, y), row(src, y), width, false);
+    });
+    Run("copy-nt", width, height, [&](int y) {
+      blit::CopyRow(row(dst, y), row(src, y), width, true);
+    });
+    Run("fill", width, height, [&](int y) {
+      blit::FillRow(row(dst, y), 0x002d76edu, width, false);
+    });
+    Run("fill-nt", width, height, [&](int y) {
+      blit::FillRow(row(dst, y), 0x002d76edu, width, true);
+    });
+    Run("copy-keyed", width, height, [&](int y) {
+      blit::CopyKeyedRow(row(dst, y), row(src, y), width, 0x00ff00ffu);
+    });
+    Run("blend-opaque", width, height, [&](int y) {
+      blit::BlendRow(row(dst, y), row(src, y), width, 255, blit::kNoKey);
+    });
+    Run("blend-alpha", width, height, [&](int y) {
+      blit::BlendRow(row(dst, y), row(translucent, y), width, 255,
+                     blit::kNoKey);
+    });
+    Run("blend-layer", width, height, [&](int y) {
+      blit::BlendRow(row(dst, y), row(src, y), width, 160, blit::kNoKey);
+    });
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  RunAll(1024, 768);
+  RunAll(1920, 1080);
+  return 0;
+}
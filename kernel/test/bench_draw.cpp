@@ -0,0 +1,109 @@
+/**
+ * @file bench_draw.cpp
+ *
+ * Host-side benchmarks of the drawing primitives on an in-memory frame buffer.
+ *
+ * Usage: bench_draw.run
+ * Each case is run once through the span methods of the frame buffer writer
+ * and once through a writer which only has Write, as every pixel went before.
+ */
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "frame_buffer.hpp"
+#include "graphics.hpp"
+
+namespace {
+
+const int kWidth = 1024;
+const int kHeight = 768;
+
+class Stopwatch {
+ public:
+  Stopwatch() : start_{std::chrono::steady_clock::now()} {}
+  double Seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start_)
+        .count();
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+/** @brief PerPixelWriter forwards Write only, so that the span methods fall
+ * back to a virtual call per pixel. */
+class PerPixelWriter : public PixelWriter {
+ public:
+  PerPixelWriter(PixelWriter& writer) : writer_{writer} {}
+  virtual void Write(Vector2D<int> pos, const PixelColor& c) override {
+    writer_.Write(pos, c);
+  }
+  virtual int Width() const override { return writer_.Width(); }
+  virtual int Height() const override { return writer_.Height(); }
+
+ private:
+  PixelWriter& writer_;
+};
+
+template <class F>
+void Run(const char* name, const char* path, PixelWriter& writer,
+         long pixels_per_call, F f) {
+  long calls = 0;
+  Stopwatch sw;
+  do {
+    for (int i = 0; i < 16; ++i, ++calls) {
+      f(writer, calls);
+    }
+  } while (sw.Seconds() < 0.5);
+  printf("%-12s %-10s %10.1f Mpixels/s\n", name, path,
+         pixels_per_call * calls / sw.Seconds() / 1e6);
+}
+
+void RunAll(const char* path, PixelWriter& writer) {
+  const PixelColor c{45, 118, 237};
+  Run("fill", path, writer, 1L * kWidth * kHeight, [&](auto& w, long i) {
+    FillRectangle(w, {0, 0}, {kWidth, kHeight}, c);
+  });
+  Run("fill-small", path, writer, 8 * 16, [&](auto& w, long i) {
+    FillRectangle(w, {int(i * 8 % (kWidth - 8)), 100}, {8, 16}, c);
+  });
+  Run("outline", path, writer, 2 * 300 + 2 * 198, [&](auto& w, long i) {
+    DrawRectangle(w, {int(i % 500), 100}, {300, 200}, c);
+  });
+
+  std::vector<PixelColor> src(256 * 256);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = ToColor(i * 2654435761u);
+  }
+  Run("blit", path, writer, 256 * 256, [&](auto& w, long i) {
+    w.BlitRect({int(i % 700), 200}, {256, 256}, src.data(), 256);
+  });
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  for (auto format : {kPixelRGBResv8BitPerColor, kPixelBGRResv8BitPerColor}) {
+    FrameBufferConfig config{};
+    config.frame_buffer = nullptr;
+    config.horizontal_resolution = kWidth;
+    config.vertical_resolution = kHeight;
+    config.pixel_format = format;
+
+    FrameBuffer fb;
+    if (auto err = fb.Initialize(config)) {
+      fprintf(stderr, "failed to initialize the frame buffer: %s\n",
+              err.Name());
+      return 1;
+    }
+    printf("%s %dx%d\n",
+           format == kPixelRGBResv8BitPerColor ? "RGB" : "BGR", kWidth,
+           kHeight);
+    PerPixelWriter per_pixel{fb.Writer()};
+    RunAll("span", fb.Writer());
+    RunAll("per-pixel", per_pixel);
+  }
+  return 0;
+}
@@ -0,0 +1,209 @@
+/**
+ * @file bench_fat.cpp
+ *
+ * Host-side benchmarks of the FAT driver on a synthetic volume in memory.
+ *
+ * Usage: bench_fat.run [<image file>]
+ * Without an image file, a 256 MiB volume with 4 KiB clusters is built.
+ * Every case starts from the same volume and measures lookups, sequential
+ * reads, random reads and appends across directory and file sizes.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fat.hpp"
+#include "fat_image.hpp"
+
+namespace {
+
+std::vector<uint8_t> base_image;
+std::vector<uint8_t> image;
+
+/** @brief Mounts a fresh copy of the base volume, so that every case starts
+ * with an empty volume and cold caches.
+ */
+void Remount() {
+  if (!image.empty()) {
+    fat::Flush();
+  }
+  image = base_image;
+  fat::Initialize(image.data(), image.size());
+}
+
+/** @brief Flushes and mounts the current image again to drop the caches. */
+void DropCaches() {
+  fat::Flush();
+  fat::Initialize(image.data(), image.size());
+}
+
+class Stopwatch {
+ public:
+  Stopwatch() : start_{std::chrono::steady_clock::now()} {}
+  double Seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start_)
+        .count();
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+void PrintOps(const char* name, const std::string& param, size_t ops,
+              double sec) {
+  printf("%-12s %-24s %10zu ops %10.0f ops/s\n", name, param.c_str(), ops,
+         ops / sec);
+}
+
+void PrintBytes(const char* name, const std::string& param, size_t bytes,
+                double sec) {
+  printf("%-12s %-24s %10zu KiB %10.1f MiB/s\n", name, param.c_str(),
+         bytes / 1024, bytes / sec / 1024 / 1024);
+}
+
+fat::DirectoryEntry* MakeFile(const char* path, size_t size) {
+  auto entry = fat::CreateFile(path).value;
+  std::vector<uint8_t> data(1 << 20);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = i * 13;
+  }
+  fat::FileDescriptor fd{*entry};
+  for (size_t done = 0; done < size;) {
+    const size_t n = std::min(data.size(), size - done);
+    fd.Write(data.data(), n);
+    done += n;
+  }
+  return entry;
+}
+
+// Looks up every file of a directory of num_files files, cold and warm, and
+// the same number of names which do not exist.
+void BenchLookup(size_t num_files, bool long_names) {
+  Remount();
+  fat_image::MakeDirectory("/BENCH");
+  char path[64];
+  auto format = [&](const char* kind, size_t i) {
+    if (long_names) {
+      sprintf(path, "/BENCH/%s-benchmark-file-%06zu.data", kind, i);
+    } else {
+      sprintf(path, "/BENCH/%c%07zu.DAT", kind[0] - 'a' + 'A', i);
+    }
+  };
+  for (size_t i = 0; i < num_files; ++i) {
+    format("hit", i);
+    fat::CreateFile(path);
+  }
+  DropCaches();
+
+  const std::string param = std::to_string(num_files) +
+                            (long_names ? " long names" : " short names");
+  for (const char* label : {"lookup-cold", "lookup-warm"}) {
+    Stopwatch sw;
+    for (size_t i = 0; i < num_files; ++i) {
+      format("hit", i);
+      if (fat::FindFile(path).first == nullptr) {
+        printf("%s not found\n", path);
+        return;
+      }
+    }
+    PrintOps(label, param, num_files, sw.Seconds());
+  }
+
+  Stopwatch sw;
+  for (size_t i = 0; i < num_files; ++i) {
+    format("miss", i);
+    fat::FindFile(path);
+  }
+  PrintOps("lookup-miss", param, num_files, sw.Seconds());
+}
+
+void BenchSequentialRead(size_t file_size, size_t chunk) {
+  Remount();
+  auto entry = MakeFile("/SEQ.DAT", file_size);
+  DropCaches();
+  entry = fat::FindFile("/SEQ.DAT").first;
+
+  std::vector<uint8_t> buf(chunk);
+  fat::FileDescriptor fd{*entry};
+  size_t total = 0;
+  Stopwatch sw;
+  while (size_t n = fd.Read(buf.data(), buf.size())) {
+    total += n;
+  }
+  PrintBytes("seq-read", std::to_string(file_size >> 10) + " KiB file, " +
+                             std::to_string(chunk >> 10) + " KiB reads",
+             total, sw.Seconds());
+}
+
+void BenchRandomRead(size_t file_size, size_t chunk, size_t num_reads) {
+  Remount();
+  auto entry = MakeFile("/RAND.DAT", file_size);
+  DropCaches();
+  entry = fat::FindFile("/RAND.DAT").first;
+
+  std::mt19937_64 rng{1};
+  std::vector<uint8_t> buf(chunk);
+  fat::FileDescriptor fd{*entry};
+  Stopwatch sw;
+  for (size_t i = 0; i < num_reads; ++i) {
+    fd.Load(buf.data(), buf.size(), rng() % (file_size - chunk));
+  }
+  PrintOps("random-read", std::to_string(file_size >> 10) + " KiB file, " +
+                              std::to_string(chunk) + " B reads",
+           num_reads, sw.Seconds());
+}
+
+void BenchAppend(size_t file_size, size_t chunk) {
+  Remount();
+  auto entry = fat::CreateFile("/APPEND.DAT").value;
+  std::vector<uint8_t> buf(chunk, 0x5a);
+  fat::FileDescriptor fd{*entry};
+  size_t total = 0;
+  Stopwatch sw;
+  while (total < file_size) {
+    const size_t n = fd.Write(buf.data(), buf.size());
+    if (n == 0) {
+      printf("volume full\n");
+      break;
+    }
+    total += n;
+  }
+  fat::Flush();
+  PrintBytes("append", std::to_string(file_size >> 10) + " KiB file, " +
+                           std::to_string(chunk) + " B writes",
+             total, sw.Seconds());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc >= 2) {
+    if (!fat_image::LoadVolume(argv[1], base_image)) {
+      fprintf(stderr, "failed to read %s\n", argv[1]);
+      return 1;
+    }
+  } else {
+    base_image = fat_image::MakeVolume(256 * 2048, 8);
+  }
+
+  for (size_t num_files : {64, 1024, 8192}) {
+    BenchLookup(num_files, false);
+    BenchLookup(num_files, true);
+  }
+  for (size_t file_size : {64 << 10, 1 << 20, 32 << 20}) {
+    BenchSequentialRead(file_size, 4096);
+  }
+  BenchSequentialRead(32 << 20, 64 << 10);
+  for (size_t file_size : {1 << 20, 32 << 20}) {
+    BenchRandomRead(file_size, 512, 20000);
+    BenchRandomRead(file_size, 4096, 20000);
+  }
+  for (size_t chunk : {512, 4096, 64 << 10}) {
+    BenchAppend(32 << 20, chunk);
+  }
+  return 0;
+}
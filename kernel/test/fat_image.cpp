@@ -0,0 +1,121 @@
+#include "fat_image.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace {
+const size_t kFSInfoSector = 1;
+const size_t kBackupBootSector = 6;
+}  // namespace
+
+namespace fat_image {
+
+std::vector<uint8_t> MakeVolume(size_t num_sectors,
+                                uint8_t sectors_per_cluster) {
+  // one FAT entry for every cluster the volume could hold, rounded up
+  const size_t entries = num_sectors / sectors_per_cluster + 2;
+  const size_t fat_sectors =
+      (entries * sizeof(uint32_t) + kBytesPerSector - 1) / kBytesPerSector;
+
+  std::vector<uint8_t> image(num_sectors * kBytesPerSector);
+  auto bpb = reinterpret_cast<fat::BPB*>(image.data());
+  bpb->jump_boot[0] = 0xeb;
+  bpb->jump_boot[1] = 0x58;
+  bpb->jump_boot[2] = 0x90;
+  memcpy(bpb->oem_name, "MIKANTST", 8);
+  bpb->bytes_per_sector = kBytesPerSector;
+  bpb->sectors_per_cluster = sectors_per_cluster;
+  bpb->reserved_sector_count = kReservedSectors;
+  bpb->num_fats = 2;
+  bpb->media = 0xf8;
+  bpb->total_sectors_32 = num_sectors;
+  bpb->fat_size_32 = fat_sectors;
+  bpb->root_cluster = 2;
+  bpb->fs_info = kFSInfoSector;
+  bpb->backup_boot_sector = kBackupBootSector;
+  bpb->boot_signature = 0x29;
+  memcpy(bpb->volume_label, "NO NAME    ", 11);
+  memcpy(bpb->fs_type, "FAT32   ", 8);
+  image[510] = 0x55;
+  image[511] = 0xaa;
+  memcpy(&image[kBackupBootSector * kBytesPerSector], image.data(),
+         kBytesPerSector);
+
+  auto fs_info = reinterpret_cast<fat::FSInfo*>(
+      &image[kFSInfoSector * kBytesPerSector]);
+  fs_info->lead_signature = 0x41615252;
+  fs_info->struct_signature = 0x61417272;
+  fs_info->free_count = 0xffffffff;
+  fs_info->next_free = 0xffffffff;
+  fs_info->trail_signature = 0xaa550000;
+
+  for (size_t i = 0; i < bpb->num_fats; ++i) {
+    auto fat = reinterpret_cast<uint32_t*>(
+        &image[(kReservedSectors + i * fat_sectors) * kBytesPerSector]);
+    fat[0] = 0x0ffffff8;
+    fat[1] = 0x0fffffff;
+    fat[2] = 0x0fffffff;  // the root directory
+  }
+  return image;
+}
+
+bool LoadVolume(const char* path, std::vector<uint8_t>& image) {
+  FILE* fp = fopen(path, "rb");
+  if (fp == nullptr) {
+    return false;
+  }
+  fseek(fp, 0, SEEK_END);
+  image.resize(ftell(fp));
+  fseek(fp, 0, SEEK_SET);
+  const bool ok = fread(image.data(), 1, image.size(), fp) == image.size();
+  fclose(fp);
+  return ok;
+}
+
+uint8_t* ClusterInImage(std::vector<uint8_t>& image, unsigned long cluster) {
+  auto bpb = reinterpret_cast<fat::BPB*>(image.data());
+  const size_t data_start =
+      bpb->reserved_sector_count + bpb->num_fats * bpb->fat_size_32;
+  const size_t sector = data_start + (cluster - 2) * bpb->sectors_per_cluster;
+  return &image[sector * bpb->bytes_per_sector];
+}
+
+fat::DirectoryEntry* MakeDirectory(const char* path) {
+  auto [entry, err] = fat::CreateFile(path);
+  if (err) {
+    return nullptr;
+  }
+  const auto cluster = fat::AllocateClusterChain(1);
+  if (cluster == 0) {
+    return nullptr;
+  }
+
+  auto dir = fat::GetSectorByCluster<fat::DirectoryEntry>(cluster);
+  memset(dir, 0, fat::bytes_per_cluster);
+  memset(dir[0].name, 0x20, 11);
+  dir[0].name[0] = '.';
+  dir[0].attr = fat::Attribute::kDirectory;
+  dir[0].first_cluster_low = cluster & 0xffff;
+  dir[0].first_cluster_high = cluster >> 16;
+  memset(dir[1].name, 0x20, 11);
+  dir[1].name[0] = dir[1].name[1] = '.';
+  dir[1].attr = fat::Attribute::kDirectory;
+  // ".." of a subdirectory of the root points to cluster 0
+  if (const char* slash = strrchr(path, '/'); slash && slash != path) {
+    const std::string parent_path(path, slash - path);
+    if (auto parent = fat::FindFile(parent_path.c_str()).first) {
+      dir[1].first_cluster_low = parent->first_cluster_low;
+      dir[1].first_cluster_high = parent->first_cluster_high;
+    }
+  }
+  fat::MarkDirty(dir);
+
+  entry->attr = fat::Attribute::kDirectory;
+  entry->first_cluster_low = cluster & 0xffff;
+  entry->first_cluster_high = cluster >> 16;
+  fat::MarkDirty(entry);
+  return entry;
+}
+
+}  // namespace fat_image
@@ -0,0 +1,47 @@
+/**
+ * @file fat_image.hpp
+ *
+ * Synthetic FAT32 volumes for the host-side tests and benchmarks.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "fat.hpp"
+
+namespace fat_image {
+
+const size_t kBytesPerSector = 512;
+const size_t kReservedSectors = 32;
+
+/** @brief Makes an empty FAT32 volume with two FATs, an FSInfo sector and a
+ * root directory of one cluster at cluster 2.
+ *
+ * @param num_sectors Size of the volume in 512-byte sectors
+ * @param sectors_per_cluster Sectors per cluster, a power of 2
+ */
+std::vector<uint8_t> MakeVolume(size_t num_sectors,
+                                uint8_t sectors_per_cluster);
+
+/** @brief Reads a volume image from a file, such as one made by
+ * "mkfs.fat -F 32 -C <file> <KiB>".
+ *
+ * @return false if the file cannot be read
+ */
+bool LoadVolume(const char* path, std::vector<uint8_t>& image);
+
+/** @brief Returns the address of the first sector of the cluster in the
+ * image.
+ */
+uint8_t* ClusterInImage(std::vector<uint8_t>& image, unsigned long cluster);
+
+/** @brief Creates an empty directory with "." and ".." entries.
+ *
+ * @param path Path of the new directory, whose parent has to exist
+ * @return The entry of the directory, or nullptr on failure
+ */
+fat::DirectoryEntry* MakeDirectory(const char* path);
+
+}  // namespace fat_image
@@ -0,0 +1,130 @@
+#include <CppUTest/CommandLineTestRunner.h>
+
+#include <vector>
+
+#include "blit.hpp"
+
+namespace {
+const blit::ISA kISAs[] = {blit::ISA::kScalar, blit::ISA::kSSE2,
+                           blit::ISA::kAVX2};
+const uint32_t kKey = 0x00123456u;
+
+/** @brief Returns pixels with the key, in any reserved byte, at every third
+ * one and in a run in the middle. */
+std::vector<uint32_t> MakeSource(int n) {
+  std::vector<uint32_t> src(n);
+  for (int i = 0; i < n; ++i) {
+    src[i] = i % 3 == 0 || (n / 3 <= i && i < n / 2)
+                 ? kKey | (uint32_t(i) << 24)
+                 : 0x00010101u * i;
+  }
+  return src;
+}
+}  // namespace
+
+TEST_GROUP(Blit) {
+  TEST_TEARDOWN() { blit::Initialize(); }
+};
+
+// every length and alignment around the vector widths against the scalar
+// kernels, without touching the pixels around the row
+TEST(Blit, KernelsMatchScalar) {
+  for (auto isa : kISAs) {
+    if (!blit::Supported(isa)) {
+      continue;
+    }
+    for (int n = 0; n <= 40; ++n) {
+      for (int offset = 0; offset < 8; ++offset) {
+        const auto src = MakeSource(n + 8);
+        for (bool non_temporal : {false, true}) {
+          std::vector<uint32_t> expected(n + 16, 0xdeadbeefu), actual;
+
+          blit::Select(blit::ISA::kScalar);
+          actual = expected;
+          blit::CopyRow(&expected[offset], &src[offset], n, false);
+          blit::Select(isa);
+          blit::CopyRow(&actual[offset], &src[offset], n, non_temporal);
+          blit::Fence();
+          CHECK_TRUE(expected == actual);
+
+          blit::Select(blit::ISA::kScalar);
+          blit::FillRow(&expected[offset], 0x00abcdefu, n, false);
+          blit::Select(isa);
+          blit::FillRow(&actual[offset], 0x00abcdefu, n, non_temporal);
+          blit::Fence();
+          CHECK_TRUE(expected == actual);
+        }
+
+        std::vector<uint32_t> expected(n + 16, 0xdeadbeefu), actual;
+        actual = expected;
+        blit::Select(blit::ISA::kScalar);
+        blit::CopyKeyedRow(&expected[offset], &src[offset], n, kKey);
+        blit::Select(isa);
+        blit::CopyKeyedRow(&actual[offset], &src[offset], n, kKey);
+        CHECK_TRUE(expected == actual);
+      }
+    }
+  }
+}
+
+TEST(Blit, InitializeSelectsSupported) {
+  blit::Initialize();
+  CHECK_TRUE(blit::Selected() != blit::ISA::kScalar);
+  CHECK_TRUE(blit::Supported(blit::Selected()));
+}
+
+namespace {
+/** @brief Returns the color premultiplied by alpha, with 255 - alpha in the
+ * reserved byte, as blit::BlendRow takes it. */
+uint32_t Premultiplied(uint32_t color, uint32_t alpha) {
+  uint32_t pixel = (255 - alpha) << 24;
+  for (int k = 0; k < 3; ++k) {
+    pixel |= (((color >> (8 * k)) & 0xff) * alpha / 255) << (8 * k);
+  }
+  return pixel;
+}
+}  // namespace
+
+TEST(Blit, BlendValues) {
+  blit::Select(blit::ISA::kScalar);
+  uint32_t dst[4] = {0x00000000u, 0x00ffffffu, 0x00204060u, 0x00204060u};
+  const uint32_t src[4] = {Premultiplied(0x00ffffffu, 128),
+                           Premultiplied(0x00000000u, 128),
+                           Premultiplied(0x00ff0000u, 0), kKey};
+  blit::BlendRow(dst, src, 4, 255, kKey);
+  CHECK_EQUAL(0x00808080u, dst[0]);
+  CHECK_EQUAL(0x007f7f7fu, dst[1]);
+  CHECK_EQUAL(0x00204060u, dst[2]);
+  CHECK_EQUAL(0x00204060u, dst[3]);
+
+  // half of an opaque layer over black
+  uint32_t dst2[1] = {0};
+  const uint32_t src2[1] = {0x00ff8000u};
+  blit::BlendRow(dst2, src2, 1, 128, blit::kNoKey);
+  CHECK_EQUAL(0x00804000u, dst2[0]);
+}
+
+TEST(Blit, BlendMatchesScalar) {
+  for (auto isa : kISAs) {
+    if (!blit::Supported(isa)) {
+      continue;
+    }
+    for (int n = 0; n <= 24; ++n) {
+      std::vector<uint32_t> src(n), base(n);
+      for (int i = 0; i < n; ++i) {
+        // opaque, clear and translucent pixels, mixed and in runs
+        const uint32_t alpha = i < 8 ? 255 : i < 12 ? 0 : (i * 37) & 0xff;
+        src[i] = i % 5 == 4 ? kKey : Premultiplied(0x00030507u * i, alpha);
+        base[i] = 0x00fedcbau - 0x00010203u * i;
+      }
+      for (int opacity : {255, 200, 1, 0}) {
+        auto expected = base, actual = base;
+        blit::Select(blit::ISA::kScalar);
+        blit::BlendRow(expected.data(), src.data(), n, opacity, kKey);
+        blit::Select(isa);
+        blit::BlendRow(actual.data(), src.data(), n, opacity, kKey);
+        CHECK_TRUE(expected == actual);
+      }
+    }
+  }
+}
@@ -0,0 +1,606 @@
+#include <CppUTest/CommandLineTestRunner.h>
+#include <CppUTest/MemoryLeakWarningPlugin.h>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "fat.hpp"
+#include "fat_image.hpp"
+
+namespace {
+const size_t kBytesPerSector = fat_image::kBytesPerSector;
+
+std::vector<uint8_t> MakePattern(size_t len, uint8_t seed) {
+  std::vector<uint8_t> data(len);
+  for (size_t i = 0; i < len; ++i) {
+    data[i] = seed + i * 7 + i / 251;
+  }
+  return data;
+}
+
+std::vector<uint8_t> ReadAll(fat::DirectoryEntry& entry) {
+  std::vector<uint8_t> data(entry.file_size);
+  fat::FileDescriptor fd{entry};
+  CHECK_EQUAL(data.size(), fd.Read(data.data(), data.size()));
+  return data;
+}
+}  // namespace
+
+TEST_GROUP(FATWrite) {
+  std::vector<uint8_t> image;
+  fat::DirectoryEntry* entry;
+
+  TEST_SETUP() {
+    // the FAT driver keeps its caches until the next Initialize
+    IGNORE_ALL_LEAKS_IN_TEST();
+    // 2 MiB with one sector per cluster, so that small writes already span
+    // several clusters
+    image = fat_image::MakeVolume(4096, 1);
+    fat::Initialize(image.data(), image.size());
+    entry = fat::CreateFile("TEST.BIN").value;
+  }
+
+  TEST_TEARDOWN() {
+    // nothing may be left to write to the image, which is freed next
+    fat::Flush();
+  }
+};
+
+TEST(FATWrite, WriteSpanningClusters) {
+  const auto data = MakePattern(1500, 1);
+  fat::FileDescriptor fd{*entry};
+
+  CHECK_EQUAL(1000, fd.Write(&data[0], 1000));
+  CHECK_EQUAL(500, fd.Write(&data[1000], 500));
+  CHECK_EQUAL(1500, entry->file_size);
+  CHECK_TRUE(ReadAll(*entry) == data);
+
+  // the clusters were allocated as one contiguous run
+  const auto first = entry->FirstCluster();
+  CHECK_EQUAL(first + 1, fat::NextCluster(first));
+  CHECK_EQUAL(first + 2, fat::NextCluster(first + 1));
+  CHECK_EQUAL(fat::kEndOfClusterchain, fat::NextCluster(first + 2));
+}
+
+TEST(FATWrite, WriteThroughReachesVolume) {
+  // large enough to be written to the device directly
+  const auto data = MakePattern(64 * kBytesPerSector + 100, 2);
+  fat::FileDescriptor fd{*entry};
+
+  CHECK_EQUAL(data.size(), fd.Write(data.data(), data.size()));
+  CHECK_TRUE(ReadAll(*entry) == data);
+
+  CHECK_FALSE(fat::Flush());
+  const auto on_disk = fat_image::ClusterInImage(image, entry->FirstCluster());
+  CHECK_EQUAL(0, memcmp(on_disk, data.data(), data.size()));
+}
+
+namespace {
+// A RAM disk which, like a DMA device, cannot reach some memory. It counts
+// the writes of more than one block, which only WriteThrough issues on a
+// volume with one sector per cluster.
+class UnreachableBufferDisk : public BlockDevice {
+ public:
+  explicit UnreachableBufferDisk(std::vector<uint8_t>& image)
+      : disk_{image.data(), image.size() / kBytesPerSector} {}
+  Error Read(uint64_t lba, void* buf, size_t num_blocks) override {
+    return disk_.Read(lba, buf, num_blocks);
+  }
+  Error Write(uint64_t lba, const void* buf, size_t num_blocks) override {
+    multi_block_writes += num_blocks > 1;
+    return disk_.Write(lba, buf, num_blocks);
+  }
+  size_t BlockSize() const override { return disk_.BlockSize(); }
+  uint64_t NumBlocks() const override { return disk_.NumBlocks(); }
+  bool CanTransfer(const void* buf, size_t bytes) const override {
+    auto p = reinterpret_cast<const uint8_t*>(buf);
+    return p + bytes <= unreachable.data() ||
+           p >= unreachable.data() + unreachable.size();
+  }
+
+  std::vector<uint8_t> unreachable;
+  int multi_block_writes = 0;
+
+ private:
+  RAMDisk disk_;
+};
+}  // namespace
+
+TEST(FATWrite, WriteThroughOnlyFromReachableMemory) {
+  UnreachableBufferDisk disk{image};
+  fat::Initialize(disk);
+  entry = fat::CreateFile("TEST.BIN").value;
+  disk.unreachable = MakePattern(64 * kBytesPerSector, 4);
+  const auto& data = disk.unreachable;
+  fat::FileDescriptor fd{*entry};
+
+  // the clusters go through the cache instead
+  CHECK_EQUAL(data.size(), fd.Write(data.data(), data.size()));
+  CHECK_EQUAL(0, disk.multi_block_writes);
+  CHECK_TRUE(ReadAll(*entry) == data);
+  CHECK_FALSE(fat::Flush());
+  const auto on_disk = fat_image::ClusterInImage(image, entry->FirstCluster());
+  CHECK_EQUAL(0, memcmp(on_disk, data.data(), data.size()));
+  // the teardown flushes after disk is gone
+  fat::Initialize(image.data(), image.size());
+}
+
+TEST(FATWrite, WriteAtOffset) {
+  const auto data = MakePattern(2000, 3);
+  fat::FileDescriptor fd{*entry};
+  fd.Write(data.data(), data.size());
+
+  const auto patch = MakePattern(700, 4);
+  CHECK_EQUAL(700, fd.WriteAt(patch.data(), patch.size(), 300));
+
+  auto expected = data;
+  memcpy(&expected[300], patch.data(), patch.size());
+  CHECK_EQUAL(2000, entry->file_size);
+  CHECK_TRUE(ReadAll(*entry) == expected);
+}
+
+TEST(FATWrite, WritePastEndFillsZeros) {
+  const auto data = MakePattern(100, 5);
+  fat::FileDescriptor fd{*entry};
+  fd.Write(data.data(), data.size());
+  CHECK_EQUAL(100, fd.WriteAt(data.data(), data.size(), 1200));
+
+  std::vector<uint8_t> expected(1300);
+  memcpy(&expected[0], data.data(), data.size());
+  memcpy(&expected[1200], data.data(), data.size());
+  CHECK_EQUAL(1300, entry->file_size);
+  CHECK_TRUE(ReadAll(*entry) == expected);
+}
+
+TEST(FATWrite, TruncateFreesClusters) {
+  const auto free_before = fat::CountFreeClusters();
+  const auto data = MakePattern(10 * kBytesPerSector, 6);
+  fat::FileDescriptor fd{*entry};
+  fd.Write(data.data(), data.size());
+  CHECK_EQUAL(free_before - 10, fat::CountFreeClusters());
+
+  CHECK_FALSE(fd.Truncate(1000));
+  CHECK_EQUAL(1000, entry->file_size);
+  CHECK_EQUAL(free_before - 2, fat::CountFreeClusters());
+  CHECK_EQUAL(fat::kEndOfClusterchain,
+              fat::NextCluster(fat::NextCluster(entry->FirstCluster())));
+  CHECK_TRUE(ReadAll(*entry) ==
+             std::vector<uint8_t>(data.begin(), data.begin() + 1000));
+
+  CHECK_FALSE(fd.Truncate(0));
+  CHECK_EQUAL(0, entry->file_size);
+  CHECK_EQUAL(0, entry->FirstCluster());
+  CHECK_EQUAL(free_before, fat::CountFreeClusters());
+}
+
+TEST(FATWrite, TruncateGrowsWithZeros) {
+  const auto data = MakePattern(1000, 7);
+  fat::FileDescriptor fd{*entry};
+  fd.Write(data.data(), data.size());
+
+  // shrinking and growing again must not expose the old bytes
+  CHECK_FALSE(fd.Truncate(600));
+  CHECK_FALSE(fd.Truncate(1500));
+
+  std::vector<uint8_t> expected(1500);
+  memcpy(&expected[0], data.data(), 600);
+  CHECK_EQUAL(1500, entry->file_size);
+  CHECK_TRUE(ReadAll(*entry) == expected);
+}
+
+TEST(FATWrite, ReadFollowsAppendAtClusterBoundary) {
+  const auto data = MakePattern(2 * kBytesPerSector, 8);
+  fat::FileDescriptor writer{*entry}, reader{*entry};
+  writer.Write(data.data(), kBytesPerSector);
+
+  std::vector<uint8_t> buf(data.size());
+  CHECK_EQUAL(kBytesPerSector, reader.Read(buf.data(), buf.size()));
+  CHECK_EQUAL(0, reader.Read(buf.data(), buf.size()));
+
+  writer.Write(&data[kBytesPerSector], kBytesPerSector);
+  CHECK_EQUAL(kBytesPerSector,
+              reader.Read(&buf[kBytesPerSector], kBytesPerSector));
+  CHECK_TRUE(buf == data);
+}
+
+TEST(FATWrite, LoadAtOffset) {
+  const auto data = MakePattern(5 * kBytesPerSector, 9);
+  fat::FileDescriptor fd{*entry};
+  fd.Write(data.data(), data.size());
+
+  std::vector<uint8_t> buf(1000);
+  CHECK_EQUAL(1000, fd.Load(buf.data(), buf.size(), 1300));
+  CHECK_EQUAL(0, memcmp(buf.data(), &data[1300], buf.size()));
+  // a load past the end is cut at the end of the file
+  CHECK_EQUAL(100, fd.Load(buf.data(), buf.size(), data.size() - 100));
+  CHECK_EQUAL(0, fd.Load(buf.data(), buf.size(), data.size()));
+}
+
+TEST(FATWrite, LoadReadaheadOnlyForStreams) {
+  const auto data = MakePattern(64 * kBytesPerSector, 11);
+  fat::FileDescriptor fd{*entry};
+  fd.Write(data.data(), data.size());
+  CHECK_FALSE(fat::Flush());
+
+  // loads spanning two clusters at scattered offsets prefetch nothing
+  std::vector<uint8_t> buf(2 * kBytesPerSector);
+  const auto before = fat::CacheStat().readahead;
+  for (size_t i = 0; i < 32; ++i) {
+    const size_t offset = (i * 37 % 60) * kBytesPerSector + 100;
+    CHECK_EQUAL(buf.size(), fd.Load(buf.data(), buf.size(), offset));
+    CHECK_EQUAL(0, memcmp(buf.data(), &data[offset], buf.size()));
+  }
+  CHECK_EQUAL(before, fat::CacheStat().readahead);
+
+  // loads continuing one another do
+  for (size_t offset = 0; offset < 8 * buf.size(); offset += buf.size()) {
+    fd.Load(buf.data(), buf.size(), offset);
+  }
+  CHECK_TRUE(fat::CacheStat().readahead > before);
+}
+
+TEST(FATWrite, ExtendCluster) {
+  const auto first = fat::AllocateClusterChain(2);
+  const auto free_before = fat::CountFreeClusters();
+
+  // any cluster of the chain can be passed
+  const auto last = fat::ExtendCluster(first, 3);
+  CHECK_EQUAL(free_before - 3, fat::CountFreeClusters());
+  CHECK_EQUAL(fat::kEndOfClusterchain, fat::NextCluster(last));
+
+  size_t length = 0;
+  for (auto c = first; c != fat::kEndOfClusterchain; c = fat::NextCluster(c)) {
+    ++length;
+  }
+  CHECK_EQUAL(5, length);
+}
+
+TEST(FATWrite, AllocateOnFragmentedVolume) {
+  // interleave the clusters of two files, fill the rest of the volume and
+  // free one of the files, which leaves no two adjacent free clusters
+  auto other = fat::CreateFile("OTHER.BIN").value;
+  fat::FileDescriptor fd{*entry}, other_fd{*other};
+  const auto data = MakePattern(kBytesPerSector, 13);
+  for (int i = 0; i < 100; ++i) {
+    fd.Write(data.data(), data.size());
+    other_fd.Write(data.data(), data.size());
+  }
+  CHECK_TRUE(fat::AllocateClusterChain(fat::CountFreeClusters()) != 0);
+  CHECK_FALSE(fd.Truncate(0));
+  CHECK_FALSE(fat::Flush());
+  CHECK_EQUAL(100, fat::CountFreeClusters());
+
+  const auto first = fat::AllocateClusterChain(40);
+  size_t length = 0;
+  for (auto c = first; c != fat::kEndOfClusterchain; c = fat::NextCluster(c)) {
+    ++length;
+  }
+  CHECK_EQUAL(40, length);
+  CHECK_EQUAL(60, fat::CountFreeClusters());
+}
+
+TEST(FATWrite, AllocateAfterPartialRunSearch) {
+  // a volume larger than one run search, whose clusters up to 70002 are used
+  // except every 1000th
+  auto large = fat_image::MakeVolume(100000, 1);
+  auto bpb = reinterpret_cast<fat::BPB*>(large.data());
+  for (size_t i = 0; i < bpb->num_fats; ++i) {
+    auto fat = reinterpret_cast<uint32_t*>(
+        &large[(bpb->reserved_sector_count + i * bpb->fat_size_32) *
+               kBytesPerSector]);
+    for (unsigned long c = 3; c < 70003; ++c) {
+      fat[c] = c % 1000 == 0 ? 0 : fat::kEndOfClusterchain;
+    }
+  }
+  fat::Initialize(large.data(), large.size());
+
+  // no run is found among the holes the search looks at, so the chain takes
+  // them one by one without searching again
+  auto c = fat::AllocateClusterChain(66);
+  for (unsigned long hole = 1000; hole <= 66000; hole += 1000) {
+    CHECK_EQUAL(hole, c);
+    c = fat::NextCluster(c);
+  }
+
+  // the next search starts past those holes and finds the free tail
+  const auto first = fat::AllocateClusterChain(16);
+  CHECK_EQUAL(70003, first);
+  for (c = first; fat::NextCluster(c) != fat::kEndOfClusterchain;
+       c = fat::NextCluster(c)) {
+    CHECK_EQUAL(c + 1, fat::NextCluster(c));
+  }
+  CHECK_EQUAL(first + 15, c);
+
+  // the teardown flushes to the volume of the setup
+  fat::Initialize(image.data(), image.size());
+}
+
+TEST(FATWrite, PersistsAcrossMount) {
+  const auto data = MakePattern(3000, 10);
+  fat::FileDescriptor fd{*entry};
+  fd.Write(data.data(), data.size());
+  CHECK_FALSE(fat::Flush());
+
+  fat::Initialize(image.data(), image.size());
+  auto [found, post_slash] = fat::FindFile("/TEST.BIN");
+  CHECK_TRUE(found != nullptr);
+  CHECK_TRUE(ReadAll(*found) == data);
+}
+
+TEST_GROUP(FATLookup) {
+  std::vector<uint8_t> image;
+
+  TEST_SETUP() {
+    // the FAT driver keeps its caches until the next Initialize
+    IGNORE_ALL_LEAKS_IN_TEST();
+    image = fat_image::MakeVolume(4096, 1);
+    fat::Initialize(image.data(), image.size());
+  }
+
+  TEST_TEARDOWN() {
+    // nothing may be left to write to the image, which is freed next
+    fat::Flush();
+  }
+};
+
+TEST(FATLookup, FindShortName) {
+  auto created = fat::CreateFile("HELLO.TXT").value;
+  CHECK_TRUE(created != nullptr);
+
+  CHECK_TRUE(fat::FindFile("HELLO.TXT").first == created);
+  CHECK_TRUE(fat::FindFile("/hello.txt").first == created);
+  CHECK_TRUE(fat::FindFile("HELLO.TX").first == nullptr);
+  CHECK_TRUE(fat::FindFile("HELLO.TXT.BAK").first == nullptr);
+}
+
+TEST(FATLookup, FindLongName) {
+  auto created = fat::CreateFile("A Long File Name.markdown").value;
+  CHECK_TRUE(created != nullptr);
+
+  CHECK_TRUE(fat::FindFile("A Long File Name.markdown").first == created);
+  CHECK_TRUE(fat::FindFile("a long file name.MARKDOWN").first == created);
+  // the short alias finds the same entry
+  char alias[13];
+  fat::FormatName(*created, alias);
+  STRCMP_EQUAL("ALONGF~1.MAR", alias);
+  CHECK_TRUE(fat::FindFile(alias).first == created);
+}
+
+TEST(FATLookup, ListLongNames) {
+  fat::CreateFile("first-long-name.txt");
+  fat::CreateFile("SHORT.TXT");
+  fat::CreateFile("second-long-name.txt");
+
+  fat::DirectoryReader reader{fat::boot_volume_image->root_cluster};
+  char name[fat::kMaxNameBytes];
+  CHECK_TRUE(reader.Next(name) != nullptr);
+  STRCMP_EQUAL("first-long-name.txt", name);
+  CHECK_TRUE(reader.Next(name) != nullptr);
+  STRCMP_EQUAL("SHORT.TXT", name);
+  CHECK_TRUE(reader.Next(name) != nullptr);
+  STRCMP_EQUAL("second-long-name.txt", name);
+  CHECK_TRUE(reader.Next(name) == nullptr);
+}
+
+TEST(FATLookup, FindInSubdirectory) {
+  auto dir = fat_image::MakeDirectory("/DIR");
+  CHECK_TRUE(dir != nullptr);
+  auto created = fat::CreateFile("/DIR/INNER.TXT").value;
+  CHECK_TRUE(created != nullptr);
+
+  CHECK_TRUE(fat::FindFile("/DIR/INNER.TXT").first == created);
+  CHECK_TRUE(fat::FindFile("INNER.TXT", dir->FirstCluster()).first ==
+             created);
+  CHECK_TRUE(fat::FindFile("/INNER.TXT").first == nullptr);
+
+  // a trailing slash is reported
+  auto [found, post_slash] = fat::FindFile("/DIR/");
+  CHECK_TRUE(found == dir);
+  CHECK_TRUE(post_slash);
+}
+
+TEST(FATLookup, CreateExtendsDirectory) {
+  // one cluster holds 16 entries, so the root directory has to grow
+  char name[16];
+  for (int i = 0; i < 40; ++i) {
+    sprintf(name, "F%02d.TXT", i);
+    CHECK_TRUE(fat::CreateFile(name).value != nullptr);
+  }
+  for (int i = 0; i < 40; ++i) {
+    sprintf(name, "F%02d.TXT", i);
+    CHECK_TRUE(fat::FindFile(name).first != nullptr);
+  }
+  CHECK_TRUE(fat::NextCluster(fat::boot_volume_image->root_cluster) !=
+             fat::kEndOfClusterchain);
+}
+
+TEST(FATLookup, EntriesSurviveEviction) {
+  CHECK_TRUE(fat_image::MakeDirectory("/DIR") != nullptr);
+  auto kept = fat::CreateFile("/DIR/KEPT.TXT").value;
+  fat::FileDescriptor kept_fd{*kept};
+  fat::CreateFile("/DIR/OTHER.TXT");
+  fat::FileSystem fs;
+  auto other = fs.Root().Lookup("DIR")->Lookup("OTHER.TXT");
+  CHECK_TRUE(other != nullptr);
+
+  // Writing more clusters than the cache holds evicts the clean cluster of
+  // /DIR, which only the open file descriptor keeps in memory.
+  auto big = fat::CreateFile("BIG.BIN").value;
+  fat::FileDescriptor big_fd{*big};
+  fat::Flush();
+  const auto chunk = MakePattern(kBytesPerSector, 3);
+  for (int i = 0; i < 1500; ++i) {
+    CHECK_EQUAL(chunk.size(), big_fd.Write(chunk.data(), chunk.size()));
+  }
+
+  CHECK_EQUAL(3, kept_fd.Write("abc", 3));
+  CHECK_EQUAL(3, fat::FindFile("/DIR/KEPT.TXT").first->file_size);
+  CHECK_TRUE(fs.Root().Lookup("DIR")->Lookup("other.txt") == other);
+  CHECK_EQUAL(0, other->Size());
+}
+
+namespace {
+// Discards every write after the journal header is written with a
+// transaction, as if the power failed at that moment. The header write itself
+// is applied if commit is true.
+class CrashingDisk : public BlockDevice {
+ public:
+  CrashingDisk(std::vector<uint8_t>& image, bool commit)
+      : disk_{image.data(), image.size() / kBytesPerSector}, commit_{commit} {}
+  Error Read(uint64_t lba, void* buf, size_t num_blocks) override {
+    return disk_.Read(lba, buf, num_blocks);
+  }
+  Error Write(uint64_t lba, const void* buf, size_t num_blocks) override {
+    if (crashed_) {
+      return MAKE_ERROR(Error::kSuccess);
+    }
+    // the header is the first sector after the backup boot sectors 6-8, and
+    // the number of blocks follows the magic and the sequence number
+    uint32_t num_journaled;
+    memcpy(&num_journaled, &reinterpret_cast<const uint8_t*>(buf)[16], 4);
+    if (lba == 9 && num_journaled != 0) {
+      crashed_ = true;
+      if (!commit_) {
+        return MAKE_ERROR(Error::kSuccess);
+      }
+    }
+    return disk_.Write(lba, buf, num_blocks);
+  }
+  size_t BlockSize() const override { return disk_.BlockSize(); }
+  uint64_t NumBlocks() const override { return disk_.NumBlocks(); }
+  bool Crashed() const { return crashed_; }
+
+ private:
+  RAMDisk disk_;
+  bool commit_;
+  bool crashed_ = false;
+};
+
+const uint32_t* FATInImage(std::vector<uint8_t>& image, int fat_index) {
+  auto bpb = reinterpret_cast<fat::BPB*>(image.data());
+  return reinterpret_cast<const uint32_t*>(
+      &image[(bpb->reserved_sector_count + fat_index * bpb->fat_size_32) *
+             kBytesPerSector]);
+}
+}  // namespace
+
+TEST_GROUP(FATConsistency) {
+  std::vector<uint8_t> image;
+
+  TEST_SETUP() {
+    // the FAT driver keeps its caches until the next Initialize
+    IGNORE_ALL_LEAKS_IN_TEST();
+    image = fat_image::MakeVolume(4096, 1);
+    fat::Initialize(image.data(), image.size());
+  }
+
+  TEST_TEARDOWN() {
+    // nothing may be left to write to the image, which is freed next
+    fat::Flush();
+  }
+};
+
+TEST(FATConsistency, SameVolumeNeedsMatchingBPB) {
+  auto other = fat_image::MakeVolume(4096, 1);
+  RAMDisk disk{other.data(), other.size() / kBytesPerSector};
+  CHECK_TRUE(fat::IsSameVolume(disk, image.data()));
+
+  // a copy of the volume with another serial number is another volume
+  reinterpret_cast<fat::BPB*>(other.data())->volume_id ^= 1;
+  CHECK_FALSE(fat::IsSameVolume(disk, image.data()));
+}
+
+TEST(FATConsistency, FATCopiesMirrored) {
+  auto entry = fat::CreateFile("MIRROR.BIN").value;
+  const auto data = MakePattern(20 * kBytesPerSector, 11);
+  fat::FileDescriptor fd{*entry};
+  fd.Write(data.data(), data.size());
+  CHECK_FALSE(fat::Flush());
+
+  auto bpb = reinterpret_cast<fat::BPB*>(image.data());
+  CHECK_EQUAL(0, memcmp(FATInImage(image, 0), FATInImage(image, 1),
+                        bpb->fat_size_32 * kBytesPerSector));
+  CHECK_EQUAL(entry->FirstCluster() + 1,
+              FATInImage(image, 1)[entry->FirstCluster()]);
+}
+
+TEST(FATConsistency, FreedClustersReusedAfterFlush) {
+  auto entry = fat::CreateFile("OLD.BIN").value;
+  const auto data = MakePattern(4 * kBytesPerSector, 12);
+  fat::FileDescriptor fd{*entry};
+  fd.Write(data.data(), data.size());
+  CHECK_FALSE(fat::Flush());
+  const auto first = entry->FirstCluster();
+
+  // the volume still assigns the freed clusters to the file until the next
+  // Flush, so growing the file again cannot take them
+  CHECK_FALSE(fd.Truncate(kBytesPerSector));
+  CHECK_FALSE(fd.Truncate(2 * kBytesPerSector));
+  CHECK_TRUE(fat::NextCluster(first) != first + 1);
+
+  CHECK_FALSE(fd.Truncate(kBytesPerSector));
+  CHECK_FALSE(fat::Flush());
+  CHECK_FALSE(fd.Truncate(2 * kBytesPerSector));
+  CHECK_EQUAL(first + 1, fat::NextCluster(first));
+}
+
+TEST(FATConsistency, FormatJournal) {
+  CHECK_EQUAL(0, fat::GetJournalStat().sectors);
+  CHECK_FALSE(fat::FormatJournal());
+  // sectors 9-31 of the reserved area
+  CHECK_EQUAL(23, fat::GetJournalStat().sectors);
+
+  auto entry = fat::CreateFile("J.TXT").value;
+  fat::FileDescriptor fd{*entry};
+  fd.Write("journal", 7);
+  CHECK_FALSE(fat::Flush());
+  CHECK_EQUAL(1, fat::GetJournalStat().commits);
+
+  fat::Initialize(image.data(), image.size());
+  CHECK_EQUAL(23, fat::GetJournalStat().sectors);
+  CHECK_EQUAL(0, fat::GetJournalStat().replays);
+  CHECK_TRUE(fat::FindFile("J.TXT").first != nullptr);
+}
+
+TEST(FATConsistency, ReplayCommittedTransaction) {
+  CHECK_FALSE(fat::FormatJournal());
+  CrashingDisk disk{image, true};
+  fat::Initialize(disk);
+
+  const auto data = MakePattern(3 * kBytesPerSector, 13);
+  auto entry = fat::CreateFile("CRASH.BIN").value;
+  fat::FileDescriptor fd{*entry};
+  fd.Write(data.data(), data.size());
+  fat::Flush();
+  CHECK_TRUE(disk.Crashed());
+
+  // the directory entry has not reached the empty root directory
+  CHECK_EQUAL(0, fat_image::ClusterInImage(image, 2)[0]);
+  fat::Initialize(image.data(), image.size());
+  CHECK_EQUAL(1, fat::GetJournalStat().replays);
+  auto found = fat::FindFile("CRASH.BIN").first;
+  CHECK_TRUE(found != nullptr);
+  CHECK_TRUE(ReadAll(*found) == data);
+  CHECK_EQUAL(0, memcmp(FATInImage(image, 0), FATInImage(image, 1),
+                        reinterpret_cast<fat::BPB*>(image.data())->fat_size_32 *
+                            kBytesPerSector));
+}
+
+TEST(FATConsistency, DiscardUncommittedTransaction) {
+  CHECK_FALSE(fat::FormatJournal());
+  const auto free_before = fat::CountFreeClusters();
+  CrashingDisk disk{image, false};
+  fat::Initialize(disk);
+
+  auto entry = fat::CreateFile("LOST.BIN").value;
+  fat::FileDescriptor fd{*entry};
+  fd.Write("lost", 4);
+  fat::Flush();
+  CHECK_TRUE(disk.Crashed());
+
+  fat::Initialize(image.data(), image.size());
+  CHECK_EQUAL(0, fat::GetJournalStat().replays);
+  CHECK_TRUE(fat::FindFile("LOST.BIN").first == nullptr);
+  CHECK_EQUAL(free_before, fat::CountFreeClusters());
+}
@@ -0,0 +1,97 @@
+#include <CppUTest/CommandLineTestRunner.h>
+
+#include <vector>
+
+#include "frame_buffer.hpp"
+
+namespace {
+FrameBufferConfig MakeConfig(int width, int height, PixelFormat format) {
+  FrameBufferConfig config{};
+  config.frame_buffer = nullptr;
+  config.horizontal_resolution = width;
+  config.vertical_resolution = height;
+  config.pixel_format = format;
+  return config;
+}
+
+bool SameColor(const PixelColor& a, const PixelColor& b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+}  // namespace
+
+TEST_GROUP(FrameBuffer) {
+};
+
+TEST(FrameBuffer, AtDecodesNativeFormat) {
+  for (auto format : {kPixelRGBResv8BitPerColor, kPixelBGRResv8BitPerColor}) {
+    FrameBuffer fb;
+    CHECK_FALSE(fb.Initialize(MakeConfig(8, 4, format)));
+    const PixelColor c{0x12, 0x34, 0x56};
+    fb.Writer().Write({3, 2}, c);
+    CHECK_TRUE(SameColor(c, fb.At({3, 2})));
+    CHECK_TRUE(SameColor(PixelColor{0, 0, 0}, fb.At({2, 2})));
+  }
+}
+
+TEST(FrameBuffer, CopyKeyedSkipsKey) {
+  const PixelColor key{1, 2, 3}, fg{200, 100, 50}, bg{9, 9, 9};
+  for (auto format : {kPixelRGBResv8BitPerColor, kPixelBGRResv8BitPerColor}) {
+    FrameBuffer src, dst;
+    CHECK_FALSE(src.Initialize(MakeConfig(6, 3, format)));
+    CHECK_FALSE(dst.Initialize(MakeConfig(10, 10, format)));
+    FillRectangle(src.Writer(), {0, 0}, {6, 3}, key);
+    FillRectangle(src.Writer(), {1, 1}, {2, 1}, fg);
+    src.Writer().Write({5, 1}, fg);
+    FillRectangle(dst.Writer(), {0, 0}, {10, 10}, bg);
+
+    // clipped at the right edge of dst
+    CHECK_FALSE(dst.CopyKeyed({6, 4}, src, {{0, 0}, {6, 3}}, key));
+    for (int y = 0; y < 10; ++y) {
+      for (int x = 0; x < 10; ++x) {
+        const bool fg_pixel = y == 5 && (x == 7 || x == 8);
+        CHECK_TRUE(SameColor(fg_pixel ? fg : bg, dst.At({x, y})));
+      }
+    }
+  }
+}
+
+TEST(FrameBuffer, SpanMethodsClip) {
+  const PixelColor bg{0, 0, 0}, fg{10, 20, 30};
+  FrameBuffer fb;
+  CHECK_FALSE(fb.Initialize(MakeConfig(8, 8, kPixelBGRResv8BitPerColor)));
+  auto& writer = fb.Writer();
+  writer.FillRect({-2, 6}, {4, 5}, fg);
+  writer.FillSpan({6, 0}, 100, fg);
+
+  std::vector<PixelColor> src(3 * 2, fg);
+  writer.BlitRect({7, 3}, {3, 2}, src.data(), 3);
+  for (int y = 0; y < 8; ++y) {
+    for (int x = 0; x < 8; ++x) {
+      const bool fg_pixel = (x < 2 && y >= 6) || (x >= 6 && y == 0) ||
+                            (x == 7 && (y == 3 || y == 4));
+      CHECK_TRUE(SameColor(fg_pixel ? fg : bg, fb.At({x, y})));
+    }
+  }
+}
+
+TEST(FrameBuffer, CopyBlended) {
+  const PixelColor white{255, 255, 255}, black{0, 0, 0}, key{1, 2, 3};
+  FrameBuffer src, dst;
+  CHECK_FALSE(src.Initialize(MakeConfig(4, 1, kPixelBGRResv8BitPerColor)));
+  CHECK_FALSE(dst.Initialize(MakeConfig(4, 1, kPixelBGRResv8BitPerColor)));
+  FillRectangle(dst.Writer(), {0, 0}, {4, 1}, black);
+  src.Writer().Write({0, 0}, white);
+  src.FillAlpha({1, 0}, {1, 1}, white, 128);
+  src.FillAlpha({2, 0}, {1, 1}, white, 0);
+  src.Writer().Write({3, 0}, key);
+
+  CHECK_FALSE(dst.CopyBlended({0, 0}, src, {{0, 0}, {4, 1}}, 255, key));
+  CHECK_TRUE(SameColor(white, dst.At({0, 0})));
+  CHECK_TRUE(SameColor(PixelColor{128, 128, 128}, dst.At({1, 0})));
+  CHECK_TRUE(SameColor(black, dst.At({2, 0})));
+  CHECK_TRUE(SameColor(black, dst.At({3, 0})));
+
+  // the opaque pixel at half opacity over the grey of the last one
+  CHECK_FALSE(dst.CopyBlended({1, 0}, src, {{0, 0}, {1, 1}}, 128, key));
+  CHECK_TRUE(SameColor(PixelColor{192, 192, 192}, dst.At({1, 0})));
+}
@@ -0,0 +1,50 @@
+#include <CppUTest/CommandLineTestRunner.h>
+
+#include "task.hpp"
+
+// The tasks are only compared by address, so they need not be constructed.
+TEST_GROUP(Mutex) {
+  Mutex mutex;
+  alignas(Task) char storage[3][sizeof(Task)];
+  Task* t1 = reinterpret_cast<Task*>(storage[0]);
+  Task* t2 = reinterpret_cast<Task*>(storage[1]);
+  Task* t3 = reinterpret_cast<Task*>(storage[2]);
+};
+
+TEST(Mutex, Recursive) {
+  CHECK_TRUE(mutex.Acquire(t1));
+  CHECK_TRUE(mutex.Acquire(t1));
+  CHECK_FALSE(mutex.Acquire(t2));
+  POINTERS_EQUAL(nullptr, mutex.Release());
+  POINTERS_EQUAL(t2, mutex.Release());
+  CHECK_TRUE(mutex.Acquire(t2));
+  POINTERS_EQUAL(nullptr, mutex.Release());
+}
+
+TEST(Mutex, WakesWaitersInOrder) {
+  CHECK_TRUE(mutex.Acquire(t1));
+  CHECK_FALSE(mutex.Acquire(t2));
+  CHECK_FALSE(mutex.Acquire(t3));
+  // a spurious wakeup does not queue the task twice
+  CHECK_FALSE(mutex.Acquire(t2));
+  POINTERS_EQUAL(t2, mutex.Release());
+  CHECK_TRUE(mutex.Acquire(t2));
+  POINTERS_EQUAL(t3, mutex.Release());
+  CHECK_TRUE(mutex.Acquire(t3));
+  POINTERS_EQUAL(nullptr, mutex.Release());
+}
+
+TEST(Mutex, WakeupByMessageLeavesQueue) {
+  CHECK_TRUE(mutex.Acquire(t1));
+  CHECK_FALSE(mutex.Acquire(t2));
+  CHECK_FALSE(mutex.Acquire(t3));
+  // t1 unlocks and wakes t2, but a message wakes t3 first, which takes the
+  // free mutex while still queued
+  POINTERS_EQUAL(t2, mutex.Release());
+  CHECK_TRUE(mutex.Acquire(t3));
+  CHECK_FALSE(mutex.Acquire(t2));
+  // t3 must wake t2, not itself
+  POINTERS_EQUAL(t2, mutex.Release());
+  CHECK_TRUE(mutex.Acquire(t2));
+  POINTERS_EQUAL(nullptr, mutex.Release());
+}
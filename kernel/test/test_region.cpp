@@ -0,0 +1,115 @@
+#include <CppUTest/CommandLineTestRunner.h>
+
+#include <cstdlib>
+#include <vector>
+
+#include "region.hpp"
+
+namespace {
+bool InRegion(const Region& region, Vector2D<int> p) {
+  for (const auto& r : region.Rects()) {
+    if (Contains(r, {p, {1, 1}})) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool NoOverlap(const Region& region) {
+  const auto& rects = region.Rects();
+  for (size_t i = 0; i < rects.size(); ++i) {
+    for (size_t j = i + 1; j < rects.size(); ++j) {
+      if (Overlaps(rects[i], rects[j])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+}  // namespace
+
+TEST_GROUP(Region) {
+  Region region;
+};
+
+TEST(Region, EmptyRectIgnored) {
+  region.Add({{10, 10}, {0, 5}});
+  region.Add({{10, 10}, {5, -1}});
+  CHECK_TRUE(region.Empty());
+}
+
+TEST(Region, ContainedRectDropped) {
+  region.Add({{0, 0}, {100, 100}});
+  region.Add({{10, 10}, {20, 20}});
+  CHECK_EQUAL(1, region.Rects().size());
+  CHECK_EQUAL(10000, region.Area());
+}
+
+TEST(Region, SmallMoveMerged) {
+  // a window dragged by a few pixels damages the old and the new area
+  region.Add({{100, 100}, {200, 150}});
+  region.Add({{103, 102}, {200, 150}});
+  CHECK_EQUAL(1, region.Rects().size());
+  CHECK_EQUAL(203 * 152, region.Area());
+}
+
+TEST(Region, DistantRectsKeptApart) {
+  region.Add({{0, 0}, {10, 10}});
+  region.Add({{500, 500}, {10, 10}});
+  CHECK_EQUAL(2, region.Rects().size());
+  CHECK_EQUAL(200, region.Area());
+}
+
+TEST(Region, OverlapSubtracted) {
+  // an L shape whose bounding box would waste much
+  region.Add({{0, 0}, {100, 10}});
+  region.Add({{0, 0}, {10, 100}});
+  CHECK_TRUE(NoOverlap(region));
+  CHECK_EQUAL(100 * 10 + 10 * 90, region.Area());
+}
+
+TEST(Region, CappedAndCovering) {
+  std::srand(1);
+  std::vector<Rectangle<int>> added;
+  for (int i = 0; i < 200; ++i) {
+    Rectangle<int> r{{std::rand() % 1000, std::rand() % 700},
+                     {1 + std::rand() % 120, 1 + std::rand() % 120}};
+    added.push_back(r);
+    region.Add(r);
+    CHECK_TRUE(region.Rects().size() <= Region::kMaxRects);
+    CHECK_TRUE(NoOverlap(region));
+  }
+  for (const auto& r : added) {
+    CHECK_TRUE(InRegion(region, r.pos));
+    CHECK_TRUE(InRegion(region, r.pos + r.size - Vector2D<int>{1, 1}));
+  }
+}
+
+TEST(Region, Clear) {
+  region.Add({{0, 0}, {10, 10}});
+  region.Clear();
+  CHECK_TRUE(region.Empty());
+  CHECK_EQUAL(0, region.Area());
+}
+
+TEST(Region, SubtractRect) {
+  const Rectangle<int> r{{0, 0}, {100, 80}};
+  const Rectangle<int> q{{20, 30}, {50, 200}};
+  std::vector<Rectangle<int>> out;
+  SubtractRect(r, q, out);
+  long area = 0;
+  for (size_t i = 0; i < out.size(); ++i) {
+    CHECK_TRUE(Contains(r, out[i]));
+    CHECK_FALSE(Overlaps(out[i], q));
+    for (size_t j = i + 1; j < out.size(); ++j) {
+      CHECK_FALSE(Overlaps(out[i], out[j]));
+    }
+    area += RectArea(out[i]);
+  }
+  CHECK_EQUAL(100 * 80 - 50 * 50, area);
+
+  out.clear();
+  SubtractRect(r, {{200, 0}, {10, 10}}, out);
+  CHECK_EQUAL(1, out.size());
+  CHECK_EQUAL(100 * 80, RectArea(out[0]));
+}
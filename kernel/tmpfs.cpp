@@ -0,0 +1,170 @@
+#include "tmpfs.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace tmpfs {
+
+class Vnode::DirectoryIterator : public vfs::DirectoryIterator {
+ public:
+  explicit DirectoryIterator(const Vnode& dir) : dir_{dir} {}
+
+  vfs::Vnode* Next(char* name) override {
+    if (index_ >= dir_.entries_.size()) {
+      return nullptr;
+    }
+    auto& entry = dir_.entries_[index_++];
+    strcpy(name, entry.name.c_str());
+    return entry.vnode.get();
+  }
+
+ private:
+  const Vnode& dir_;
+  // an index rather than an iterator, which stays valid as entries are added
+  size_t index_{0};
+};
+
+Vnode::Vnode(vfs::FileType type) : type_{type} {}
+
+vfs::Vnode* Vnode::Lookup(const char* name) {
+  auto it = index_.find(name);
+  return it == index_.end() ? nullptr : entries_[it->second].vnode.get();
+}
+
+WithError<vfs::Vnode*> Vnode::Create(const char* name) {
+  return AddEntry(name, vfs::FileType::kRegular);
+}
+
+WithError<vfs::Vnode*> Vnode::MakeDirectory(const char* name) {
+  return AddEntry(name, vfs::FileType::kDirectory);
+}
+
+Error Vnode::Truncate(size_t size) {
+  if (type_ != vfs::FileType::kRegular) {
+    return MAKE_ERROR(Error::kIsDirectory);
+  }
+  if (size < size_) {
+    const size_t num_pages = (size + kPageBytes - 1) / kPageBytes;
+    for (size_t i = num_pages; i < pages_.size(); ++i) {
+      num_pages_ -= pages_[i] ? 1 : 0;
+    }
+    pages_.resize(std::min(pages_.size(), num_pages));
+    // the rest of the last page has to read as zeros if the file grows again
+    if (size % kPageBytes && num_pages <= pages_.size() &&
+        pages_[num_pages - 1]) {
+      memset(&pages_[num_pages - 1][size % kPageBytes], 0,
+             kPageBytes - size % kPageBytes);
+    }
+  }
+  // a grown part is a hole
+  size_ = size;
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+std::unique_ptr<vfs::DirectoryIterator> Vnode::ReadDir() {
+  if (type_ != vfs::FileType::kDirectory) {
+    return nullptr;
+  }
+  return std::make_unique<DirectoryIterator>(*this);
+}
+
+size_t Vnode::Read(void* buf, size_t len, size_t offset) const {
+  if (offset >= size_) {
+    return 0;
+  }
+  len = std::min(len, size_ - offset);
+
+  auto dest = reinterpret_cast<uint8_t*>(buf);
+  size_t done = 0;
+  while (done < len) {
+    const size_t page = (offset + done) / kPageBytes;
+    const size_t page_off = (offset + done) % kPageBytes;
+    const size_t n = std::min(len - done, kPageBytes - page_off);
+    if (page < pages_.size() && pages_[page]) {
+      memcpy(&dest[done], &pages_[page][page_off], n);
+    } else {
+      memset(&dest[done], 0, n);
+    }
+    done += n;
+  }
+  return len;
+}
+
+size_t Vnode::Write(const void* buf, size_t len, size_t offset) {
+  if (type_ != vfs::FileType::kRegular) {
+    return 0;
+  }
+
+  const size_t end = offset + len;
+  const size_t end_page = (end + kPageBytes - 1) / kPageBytes;
+  if (pages_.size() < end_page) {
+    pages_.resize(end_page);
+  }
+
+  auto src = reinterpret_cast<const uint8_t*>(buf);
+  size_t done = 0;
+  while (done < len) {
+    const size_t page = (offset + done) / kPageBytes;
+    const size_t page_off = (offset + done) % kPageBytes;
+    const size_t n = std::min(len - done, kPageBytes - page_off);
+    if (!pages_[page]) {
+      // value-initialized, so that the rest of the page reads as zeros
+      pages_[page].reset(new uint8_t[kPageBytes]());
+      ++num_pages_;
+    }
+    memcpy(&pages_[page][page_off], &src[done], n);
+    done += n;
+  }
+  size_ = std::max(size_, end);
+  return len;
+}
+
+std::unique_ptr<::FileDescriptor> Vnode::OpenFile() {
+  return std::make_unique<FileDescriptor>(*this);
+}
+
+WithError<vfs::Vnode*> Vnode::AddEntry(const char* name, vfs::FileType type) {
+  if (type_ != vfs::FileType::kDirectory) {
+    return {nullptr, MAKE_ERROR(Error::kNotDirectory)};
+  }
+  if (name[0] == '\0' || strlen(name) >= vfs::kMaxNameBytes) {
+    return {nullptr, MAKE_ERROR(Error::kInvalidFormat)};
+  }
+
+  auto [it, inserted] = index_.emplace(name, entries_.size());
+  if (!inserted) {
+    auto vnode = entries_[it->second].vnode.get();
+    if (vnode->Type() != type) {
+      return {nullptr, MAKE_ERROR(type == vfs::FileType::kDirectory
+                                      ? Error::kNotDirectory
+                                      : Error::kIsDirectory)};
+    }
+    return {vnode, MAKE_ERROR(Error::kSuccess)};
+  }
+  entries_.push_back(Entry{name, std::make_unique<Vnode>(type)});
+  return {entries_.back().vnode.get(), MAKE_ERROR(Error::kSuccess)};
+}
+
+FileDescriptor::FileDescriptor(Vnode& vnode) : vnode_{vnode} {}
+
+size_t FileDescriptor::Read(void* buf, size_t len) {
+  const size_t n = vnode_.Read(buf, len, rd_off_);
+  rd_off_ += n;
+  return n;
+}
+
+size_t FileDescriptor::Write(const void* buf, size_t len) {
+  const size_t n = vnode_.Write(buf, len, wr_off_);
+  wr_off_ += n;
+  return n;
+}
+
+size_t FileDescriptor::Load(void* buf, size_t len, size_t offset) {
+  return vnode_.Read(buf, len, offset);
+}
+
+size_t FileDescriptor::WriteAt(const void* buf, size_t len, size_t offset) {
+  return vnode_.Write(buf, len, offset);
+}
+
+}  // namespace tmpfs
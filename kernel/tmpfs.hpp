@@ -0,0 +1,94 @@
+/**
+ * @file tmpfs.hpp
+ *
+ * A file system which keeps files in memory only.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "vfs.hpp"
+
+namespace tmpfs {
+
+/** @brief Vnode is a file or directory of a tmpfs.
+ *
+ * File contents are kept in pages of kPageBytes bytes. Pages which have never
+ * been written are not allocated and read as zeros, so files may be sparse,
+ * and appending to a file touches only its last pages. A directory finds
+ * entries through a hash table and lists them in creation order.
+ */
+class Vnode : public vfs::Vnode {
+ public:
+  static const size_t kPageBytes = 4096;
+
+  explicit Vnode(vfs::FileType type);
+  vfs::FileType Type() const override { return type_; }
+  size_t Size() const override { return size_; }
+  vfs::Vnode* Lookup(const char* name) override;
+  WithError<vfs::Vnode*> Create(const char* name) override;
+  WithError<vfs::Vnode*> MakeDirectory(const char* name) override;
+  Error Truncate(size_t size) override;
+  std::unique_ptr<vfs::DirectoryIterator> ReadDir() override;
+
+  /** @brief Copies up to len bytes from the offset of the file. */
+  size_t Read(void* buf, size_t len, size_t offset) const;
+  /** @brief Writes len bytes at the offset, extending the file if needed.
+   * Skipped ranges become holes.
+   */
+  size_t Write(const void* buf, size_t len, size_t offset);
+  /** @brief Returns the number of pages allocated for the file. */
+  size_t NumPages() const { return num_pages_; }
+
+ protected:
+  std::unique_ptr<::FileDescriptor> OpenFile() override;
+
+ private:
+  struct Entry {
+    std::string name;
+    std::unique_ptr<Vnode> vnode;
+  };
+  class DirectoryIterator;
+
+  vfs::FileType type_;
+  size_t size_{0};
+  // pages_[i] holds bytes [i * kPageBytes, (i + 1) * kPageBytes), nullptr for
+  // a hole
+  std::vector<std::unique_ptr<uint8_t[]>> pages_{};
+  size_t num_pages_{0};
+  // entries in creation order, and the index of each entry by name
+  std::vector<Entry> entries_{};
+  std::unordered_map<std::string, size_t> index_{};
+
+  WithError<vfs::Vnode*> AddEntry(const char* name, vfs::FileType type);
+};
+
+class FileDescriptor : public ::FileDescriptor {
+ public:
+  explicit FileDescriptor(Vnode& vnode);
+  size_t Read(void* buf, size_t len) override;
+  size_t Write(const void* buf, size_t len) override;
+  size_t Size() const override { return vnode_.Size(); }
+  size_t Load(void* buf, size_t len, size_t offset) override;
+  size_t WriteAt(const void* buf, size_t len, size_t offset) override;
+
+ private:
+  Vnode& vnode_;
+  size_t rd_off_ = 0;
+  size_t wr_off_ = 0;
+};
+
+class FileSystem : public vfs::FileSystem {
+ public:
+  vfs::Vnode& Root() override { return root_; }
+
+ private:
+  Vnode root_{vfs::FileType::kDirectory};
+};
+
+}  // namespace tmpfs
@@ -0,0 +1,196 @@
+#include "vfs.hpp"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+struct MountPoint {
+  std::string path;  // without leading and trailing slashes, "" for the root
+  std::unique_ptr<vfs::FileSystem> fs;
+};
+
+// at most a handful of entries, so a linear search is fine
+std::vector<MountPoint> mounts;
+
+/** @brief Removes leading, trailing and repeated slashes. */
+std::string NormalizePath(const char* path) {
+  std::string normalized;
+  for (const char* p = path; *p; ++p) {
+    if (*p != '/') {
+      normalized.push_back(*p);
+    } else if (!normalized.empty() && normalized.back() != '/') {
+      normalized.push_back('/');
+    }
+  }
+  if (!normalized.empty() && normalized.back() == '/') {
+    normalized.pop_back();
+  }
+  return normalized;
+}
+
+/** @brief Returns the mount point whose path is the longest prefix of the
+ * normalized path, and the rest of the path.
+ */
+std::pair<MountPoint*, const char*> FindMountPoint(const std::string& path) {
+  MountPoint* found = nullptr;
+  for (auto& m : mounts) {
+    const size_t len = m.path.size();
+    const bool is_prefix =
+        len == 0 || (path.compare(0, len, m.path) == 0 &&
+                     (path.size() == len || path[len] == '/'));
+    if (is_prefix && (found == nullptr || found->path.size() < len)) {
+      found = &m;
+    }
+  }
+  if (found == nullptr) {
+    return {nullptr, nullptr};
+  }
+
+  const char* rest = path.c_str() + found->path.size();
+  if (*rest == '/') {
+    ++rest;
+  }
+  return {found, rest};
+}
+
+/** @brief Resolves the directory which contains the last element of the
+ * path.
+ *
+ * @return The directory and the last element of the path
+ */
+WithError<std::pair<vfs::Vnode*, const char*>> ResolveParent(
+    const char* path) {
+  const size_t path_len = strlen(path);
+  if (path_len == 0 || path[path_len - 1] == '/') {
+    return {{nullptr, nullptr}, MAKE_ERROR(Error::kIsDirectory)};
+  }
+
+  const char* name = path;
+  std::string parent_path;
+  if (const char* slash = strrchr(path, '/')) {
+    name = slash + 1;
+    parent_path.assign(path, slash - path);
+  }
+
+  auto [parent, err] = vfs::Resolve(parent_path.c_str());
+  if (err) {
+    return {{nullptr, nullptr}, err};
+  } else if (parent->Type() != vfs::FileType::kDirectory) {
+    return {{nullptr, nullptr}, MAKE_ERROR(Error::kNotDirectory)};
+  }
+  return {{parent, name}, MAKE_ERROR(Error::kSuccess)};
+}
+}  // namespace
+
+namespace vfs {
+
+WithError<Vnode*> Vnode::Create(const char* name) {
+  return {nullptr, MAKE_ERROR(Error::kNotImplemented)};
+}
+
+WithError<Vnode*> Vnode::MakeDirectory(const char* name) {
+  return {nullptr, MAKE_ERROR(Error::kNotImplemented)};
+}
+
+Error Vnode::Truncate(size_t size) {
+  return MAKE_ERROR(Error::kNotImplemented);
+}
+
+FileStat Vnode::Stat() const {
+  FileStat stat{};
+  stat.type = Type();
+  stat.size = Size();
+  return stat;
+}
+
+std::unique_ptr<::FileDescriptor> Vnode::Open() {
+  std::unique_ptr<::FileDescriptor> fd;
+  if (Type() == FileType::kDirectory) {
+    fd = std::make_unique<DirectoryDescriptor>(*this);
+  } else {
+    fd = OpenFile();
+  }
+  if (fd) {
+    fd->node_ = this;
+  }
+  return fd;
+}
+
+DirectoryDescriptor::DirectoryDescriptor(Vnode& dir) : dir_{dir} {}
+
+Vnode* DirectoryDescriptor::PeekEntry(const char*& name) {
+  if (peeked_ == nullptr) {
+    if (!it_) {
+      it_ = dir_.ReadDir();
+    }
+    peeked_ = it_ ? it_->Next(peeked_name_) : nullptr;
+  }
+  name = peeked_name_;
+  return peeked_;
+}
+
+Error Mount(const char* path, std::unique_ptr<FileSystem> fs) {
+  auto normalized = NormalizePath(path);
+  for (auto& m : mounts) {
+    if (m.path == normalized) {
+      return MAKE_ERROR(Error::kAlreadyAllocated);
+    }
+  }
+  mounts.push_back(MountPoint{std::move(normalized), std::move(fs)});
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+WithError<Vnode*> Resolve(const char* path) {
+  const auto normalized = NormalizePath(path);
+  auto [mount, rest] = FindMountPoint(normalized);
+  if (mount == nullptr) {
+    return {nullptr, MAKE_ERROR(Error::kNoSuchEntry)};
+  }
+
+  Vnode* node = &mount->fs->Root();
+  char name[kMaxNameBytes];
+  while (*rest) {
+    const char* slash = strchr(rest, '/');
+    const size_t len = slash ? slash - rest : strlen(rest);
+    if (len >= kMaxNameBytes) {
+      return {nullptr, MAKE_ERROR(Error::kNoSuchEntry)};
+    }
+    memcpy(name, rest, len);
+    name[len] = '\0';
+    rest += slash ? len + 1 : len;
+
+    if (node->Type() != FileType::kDirectory) {
+      return {nullptr, MAKE_ERROR(Error::kNotDirectory)};
+    }
+    node = node->Lookup(name);
+    if (node == nullptr) {
+      return {nullptr, MAKE_ERROR(Error::kNoSuchEntry)};
+    }
+  }
+
+  const size_t path_len = strlen(path);
+  if (path_len > 0 && path[path_len - 1] == '/' &&
+      node->Type() != FileType::kDirectory) {
+    return {nullptr, MAKE_ERROR(Error::kNotDirectory)};
+  }
+  return {node, MAKE_ERROR(Error::kSuccess)};
+}
+
+WithError<Vnode*> Create(const char* path) {
+  auto [parent_name, err] = ResolveParent(path);
+  if (err) {
+    return {nullptr, err};
+  }
+  return parent_name.first->Create(parent_name.second);
+}
+
+WithError<Vnode*> MakeDirectory(const char* path) {
+  auto [parent_name, err] = ResolveParent(path);
+  if (err) {
+    return {nullptr, err};
+  }
+  return parent_name.first->MakeDirectory(parent_name.second);
+}
+
+}  // namespace vfs
@@ -0,0 +1,162 @@
+/**
+ * @file vfs.hpp
+ *
+ * Virtual file system layer. File systems are mounted at directories of a
+ * single tree and paths are resolved through the mount table, so that callers
+ * need not know which file system holds a file.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "error.hpp"
+#include "file.hpp"
+
+namespace vfs {
+
+enum class FileType {
+  kRegular,
+  kDirectory,
+  kDevice,
+};
+
+// maximum length of a name in bytes, including the terminating null character
+const size_t kMaxNameBytes = 255 * 3 + 1;
+
+/** @brief FileStat holds the attributes of a file. */
+struct FileStat {
+  FileType type;
+  size_t size;
+  uint8_t attr;  // FAT attribute bits, 0 on other file systems
+  // FAT encoded dates and times, 0 if the file system does not record them
+  uint16_t create_date, create_time;
+  uint16_t write_date, write_time;
+  uint16_t access_date;
+};
+
+class Vnode;
+
+/** @brief DirectoryIterator walks the entries of a directory in order. */
+class DirectoryIterator {
+ public:
+  virtual ~DirectoryIterator() = default;
+  /** @brief Returns the next entry.
+   *
+   * @param name Buffer of kMaxNameBytes bytes which receives the entry name
+   * @return The entry, or nullptr at the end of the directory
+   */
+  virtual Vnode* Next(char* name) = 0;
+};
+
+/** @brief Vnode is a file or directory of a mounted file system.
+ *
+ * Each file system caches its vnodes and keeps them alive while it is
+ * mounted, so there is at most one vnode per file and callers may keep
+ * pointers to vnodes.
+ */
+class Vnode {
+ public:
+  virtual ~Vnode() = default;
+  virtual FileType Type() const = 0;
+  /** @brief Returns the file size in bytes, 0 for a directory. */
+  virtual size_t Size() const = 0;
+  /** @brief Returns the attributes of the file. The default has the type and
+   * the size only.
+   */
+  virtual FileStat Stat() const;
+
+  /** @brief Looks up an entry of this directory.
+   *
+   * @param name Name of the entry, not containing '/'
+   * @return The entry, or nullptr if there is none or this is not a directory
+   */
+  virtual Vnode* Lookup(const char* name) = 0;
+  /** @brief Creates an empty regular file in this directory. */
+  virtual WithError<Vnode*> Create(const char* name);
+  /** @brief Creates a subdirectory of this directory. */
+  virtual WithError<Vnode*> MakeDirectory(const char* name);
+  /** @brief Changes the size of this regular file, filling a grown part with
+   * zeros.
+   */
+  virtual Error Truncate(size_t size);
+  /** @brief Returns an iterator over the entries of this directory, or
+   * nullptr if this is not a directory.
+   */
+  virtual std::unique_ptr<DirectoryIterator> ReadDir() = 0;
+
+  /** @brief Opens the file. A directory opens as a DirectoryDescriptor. */
+  std::unique_ptr<::FileDescriptor> Open();
+
+ protected:
+  /** @brief Opens a file which is not a directory. */
+  virtual std::unique_ptr<::FileDescriptor> OpenFile() = 0;
+};
+
+/** @brief DirectoryDescriptor is an open directory. It has no byte content,
+ * but keeps a position in the list of entries.
+ */
+class DirectoryDescriptor : public ::FileDescriptor {
+ public:
+  explicit DirectoryDescriptor(Vnode& dir);
+  size_t Read(void* buf, size_t len) override { return 0; }
+  size_t Write(const void* buf, size_t len) override { return 0; }
+  size_t Size() const override { return 0; }
+  size_t Load(void* buf, size_t len, size_t offset) override { return 0; }
+
+  Vnode& Directory() const { return dir_; }
+
+  /** @brief Returns the entry at the current position without moving past
+   * it, so that a caller which has no room for the entry can leave it for
+   * the next call.
+   *
+   * @param name Receives the name of the entry, valid until NextEntry
+   * @return The entry, or nullptr at the end of the directory
+   */
+  Vnode* PeekEntry(const char*& name);
+  /** @brief Moves past the entry returned by PeekEntry. */
+  void NextEntry() { peeked_ = nullptr; }
+
+ private:
+  Vnode& dir_;
+  std::unique_ptr<DirectoryIterator> it_{};
+  Vnode* peeked_ = nullptr;
+  char peeked_name_[kMaxNameBytes];
+};
+
+class FileSystem {
+ public:
+  virtual ~FileSystem() = default;
+  virtual Vnode& Root() = 0;
+};
+
+/** @brief Mounts the file system at the path.
+ *
+ * The path need not exist in the parent file system; a mount point hides the
+ * parent's entry of the same name, if any. "/" mounts the root file system.
+ */
+Error Mount(const char* path, std::unique_ptr<FileSystem> fs);
+
+/** @brief Resolves a path to a vnode.
+ *
+ * Paths are absolute whether or not they start with '/'. Empty elements are
+ * ignored, but a trailing slash requires the last element to be a directory.
+ *
+ * @return The vnode. kNoSuchEntry if an element does not exist, kNotDirectory
+ * if an element other than the last one, or the last one followed by a
+ * slash, is not a directory.
+ */
+WithError<Vnode*> Resolve(const char* path);
+
+/** @brief Creates an empty regular file at the path. The parent directory has
+ * to exist.
+ */
+WithError<Vnode*> Create(const char* path);
+
+/** @brief Creates a directory at the path. The parent directory has to
+ * exist.
+ */
+WithError<Vnode*> MakeDirectory(const char* path);
+
+}  // namespace vfs
@@ -0,0 +1,365 @@
+#include "virtio/blk.hpp"
+
+#include <algorithm>
+#include <array>
+
+#include "interrupt.hpp"
+#include "logger.hpp"
+#include "paging.hpp"
+#include "task.hpp"
+
+namespace {
+// feature bits of virtio-blk (virtio 1.0, section 5.2.3)
+const unsigned int kFeatureSizeMax = 1;
+const unsigned int kFeatureReadOnly = 5;
+const unsigned int kFeatureFlush = 9;
+const unsigned int kFeatureMultiQueue = 12;
+
+// offsets in the device config space
+const unsigned int kConfigCapacity = 0;
+const unsigned int kConfigSizeMax = 8;
+const unsigned int kConfigNumQueues = 34;
+
+const size_t kMaxQueues = 4;
+const uint32_t kDefaultMaxTransferBytes = 128 * 1024;
+// requests Transfer submits at once
+const size_t kMaxBatch = 32;
+
+bool InterruptsEnabled() {
+  uint64_t rflags;
+  __asm__ volatile("pushfq\n\tpop %0" : "=r"(rflags));
+  return rflags & 0x200;  // IF
+}
+}  // namespace
+
+namespace virtio::blk {
+
+Device* device;
+
+Device::Device(pci::Device& dev, uint16_t io_base) : transport_{dev, io_base} {}
+
+Error Device::Initialize() {
+  transport_.Reset();
+  transport_.AddStatus(status::kAcknowledge);
+  transport_.AddStatus(status::kDriver);
+
+  const uint32_t wanted = (1u << kFeatureSizeMax) | (1u << kFeatureReadOnly) |
+                          (1u << kFeatureFlush) | (1u << kFeatureMultiQueue) |
+                          (1u << kFeatureRingEventIdx);
+  const uint32_t features = transport_.DeviceFeatures() & wanted;
+  transport_.SetGuestFeatures(features);
+  auto has = [features](unsigned int bit) { return (features >> bit) & 1; };
+
+  if (auto err = transport_.EnableMSIX(InterruptVector::kVirtioBlk)) {
+    Log(kWarn, "virtio-blk: MSI-X unavailable (%s), polling\n", err.Name());
+  } else {
+    use_interrupt_ = true;
+  }
+
+  capacity_ = transport_.ReadConfig64(kConfigCapacity);
+  read_only_ = has(kFeatureReadOnly);
+  has_flush_ = has(kFeatureFlush);
+  max_transfer_bytes_ = kDefaultMaxTransferBytes;
+  if (has(kFeatureSizeMax)) {
+    const uint32_t size_max = transport_.ReadConfig32(kConfigSizeMax) & ~511u;
+    if (size_max > 0) {
+      max_transfer_bytes_ = std::min(max_transfer_bytes_, size_max);
+    }
+  }
+
+  size_t num_queues = 1;
+  if (has(kFeatureMultiQueue)) {
+    num_queues = std::clamp<size_t>(
+        transport_.ReadConfig16(kConfigNumQueues), 1, kMaxQueues);
+  }
+
+  max_depth_ = kMaxBatch;
+  for (size_t i = 0; i < num_queues; ++i) {
+    const uint16_t size = transport_.QueueSize(i);
+    if (size == 0) {
+      break;
+    }
+
+    auto q = std::make_unique<Queue>();
+    if (auto err = q->vq.Initialize(size, has(kFeatureRingEventIdx))) {
+      transport_.SetStatus(status::kFailed);
+      return err;
+    }
+    q->inflight.resize(size, nullptr);
+    if (auto err = transport_.SetupQueue(i, q->vq.RingAddress())) {
+      transport_.SetStatus(status::kFailed);
+      return err;
+    }
+    // a request takes up to 3 descriptors
+    max_depth_ = std::min<size_t>(max_depth_, size / 3);
+    queues_.push_back(std::move(q));
+  }
+  if (queues_.empty()) {
+    transport_.SetStatus(status::kFailed);
+    return MAKE_ERROR(Error::kInvalidFormat);
+  }
+
+  transport_.AddStatus(status::kDriverOK);
+  Log(kInfo, "virtio-blk: %lu sectors, %lu queue(s), depth %lu%s\n",
+      capacity_, queues_.size(), max_depth_, read_only_ ? ", read-only" : "");
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error Device::Read(uint64_t lba, void* buf, size_t num_blocks) {
+  return Transfer(kRequestIn, lba, reinterpret_cast<uint8_t*>(buf), num_blocks,
+                  max_transfer_bytes_ / 512, max_depth_);
+}
+
+Error Device::ReadInRequests(uint64_t lba, void* buf, size_t num_blocks,
+                             size_t request_blocks, size_t depth) {
+  return Transfer(kRequestIn, lba, reinterpret_cast<uint8_t*>(buf), num_blocks,
+                  request_blocks, depth);
+}
+
+Error Device::Write(uint64_t lba, const void* buf, size_t num_blocks) {
+  if (read_only_) {
+    return MAKE_ERROR(Error::kIOError);
+  }
+  return Transfer(kRequestOut, lba,
+                  reinterpret_cast<uint8_t*>(const_cast<void*>(buf)),
+                  num_blocks, max_transfer_bytes_ / 512, max_depth_);
+}
+
+bool Device::CanTransfer(const void* buf, size_t bytes) const {
+  return IsIdentityMapped(buf, bytes);
+}
+
+Error Device::Flush() {
+  if (!has_flush_) {
+    return MAKE_ERROR(Error::kSuccess);
+  }
+  auto req = MakeRequest(kRequestFlush, 0, nullptr, 0);
+  if (auto err = Submit(&req, 1)) {
+    return err;
+  }
+  return Wait(&req, 1);
+}
+
+Request Device::MakeRequest(uint32_t type, uint64_t sector, void* buf,
+                            uint32_t len) {
+  Request req{};
+  req.header.type = type;
+  req.header.sector = sector;
+  req.buf = buf;
+  req.len = len;
+  return req;
+}
+
+Error Device::Submit(Request* reqs, size_t n) {
+  if (n > max_depth_) {
+    return MAKE_ERROR(Error::kFull);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (reqs[i].len > 0 && !IsIdentityMapped(reqs[i].buf, reqs[i].len)) {
+      return MAKE_ERROR(Error::kNotIdentityMapped);
+    }
+  }
+
+  const bool intr = InterruptsEnabled();
+  __asm__("cli");
+  const size_t qi = CurrentQueue();
+  auto& q = *queues_[qi];
+
+  // Other tasks sharing the queue may hold the descriptors we need. Reap
+  // their completions until there is room.
+  while (q.vq.NumFree() < 3 * n) {
+    ProcessCompletions();
+    if (q.vq.NumFree() >= 3 * n) {
+      break;
+    }
+    if (intr) {
+      __asm__("sti\n\thlt\n\tcli");
+    }
+  }
+
+  Task* waiter = nullptr;
+  if (intr && use_interrupt_ && task_manager) {
+    waiter = &task_manager->CurrentTask();
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    auto& req = reqs[i];
+    req.status = 0xff;
+    req.done = false;
+    req.waiter = waiter;
+
+    const int head = q.vq.AllocChain(req.len > 0 ? 3 : 2);
+    req.head = head;
+    q.inflight[head] = &req;
+
+    auto& hdr_desc = q.vq.Desc(head);
+    hdr_desc.addr = reinterpret_cast<uint64_t>(&req.header);
+    hdr_desc.len = sizeof(req.header);
+
+    uint16_t status_index = hdr_desc.next;
+    if (req.len > 0) {
+      auto& data_desc = q.vq.Desc(hdr_desc.next);
+      data_desc.addr = reinterpret_cast<uint64_t>(req.buf);
+      data_desc.len = req.len;
+      if (req.header.type == kRequestIn) {
+        data_desc.flags |= kDescFlagWrite;
+      }
+      status_index = data_desc.next;
+    }
+
+    auto& status_desc = q.vq.Desc(status_index);
+    status_desc.addr = reinterpret_cast<uint64_t>(&req.status);
+    status_desc.len = 1;
+    status_desc.flags = kDescFlagWrite;
+
+    q.vq.Push(head);
+  }
+
+  if (q.vq.Publish()) {
+    transport_.Notify(qi);
+    ++stat_.notifications;
+  }
+  stat_.requests += n;
+
+  if (intr) {
+    __asm__("sti");
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error Device::Wait(Request* reqs, size_t n) {
+  const bool intr = InterruptsEnabled();
+  __asm__("cli");
+  auto& q = *queues_[CurrentQueue()];
+
+  // Requests submitted with interrupts disabled have no waiter to wake.
+  const bool can_sleep =
+      intr && std::all_of(reqs, reqs + n, [](auto& r) {
+        return r.waiter != nullptr && r.waiter == &task_manager->CurrentTask();
+      });
+  auto all_done = [reqs, n] {
+    return std::all_of(reqs, reqs + n, [](auto& r) { return r.done; });
+  };
+  while (true) {
+    // Coalesce: interrupt only after everything outstanding on the queue
+    // has completed, then reap what completed before used_event was set.
+    q.vq.SetUsedEvent(q.vq.NumInflight());
+    ProcessCompletions();
+    if (all_done()) {
+      break;
+    }
+    if (can_sleep) {
+      task_manager->CurrentTask().Sleep();
+    } else if (intr) {
+      __asm__("sti\n\tpause\n\tcli");
+    }
+  }
+
+  if (intr) {
+    __asm__("sti");
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    if (reqs[i].status != kStatusOK) {
+      return MAKE_ERROR(Error::kIOError);
+    }
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+void Device::HandleInterrupt() {
+  ++stat_.interrupts;
+  ProcessCompletions();
+}
+
+size_t Device::CurrentQueue() const {
+  if (!task_manager || queues_.size() == 1) {
+    return 0;
+  }
+  return task_manager->CurrentTask().ID() % queues_.size();
+}
+
+void Device::ProcessCompletions() {
+  for (auto& q : queues_) {
+    while (q->vq.HasUsed()) {
+      const auto elem = q->vq.PopUsed();
+      Request* req = q->inflight[elem.id];
+      q->inflight[elem.id] = nullptr;
+      if (req == nullptr) {
+        continue;
+      }
+      req->done = true;
+      if (req->waiter) {
+        task_manager->Wakeup(req->waiter);
+      }
+    }
+  }
+}
+
+Error Device::Transfer(uint32_t type, uint64_t lba, uint8_t* buf,
+                       size_t num_blocks, size_t request_blocks,
+                       size_t depth) {
+  if (lba + num_blocks > capacity_) {
+    return MAKE_ERROR(Error::kIndexOutOfRange);
+  }
+
+  const size_t blocks_per_req =
+      std::clamp<size_t>(request_blocks, 1, max_transfer_bytes_ / 512);
+  const size_t batch =
+      std::clamp<size_t>(depth, 1, std::min(max_depth_, kMaxBatch));
+  std::array<Request, kMaxBatch> reqs;
+
+  while (num_blocks > 0) {
+    size_t n = 0;
+    while (n < batch && num_blocks > 0) {
+      const size_t count = std::min(num_blocks, blocks_per_req);
+      reqs[n++] = MakeRequest(type, lba, buf, count * 512);
+      lba += count;
+      buf += count * 512;
+      num_blocks -= count;
+    }
+    if (auto err = Submit(reqs.data(), n)) {
+      return err;
+    }
+    if (auto err = Wait(reqs.data(), n)) {
+      return err;
+    }
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+void Initialize() {
+  pci::Device* blk_dev = nullptr;
+  for (int i = 0; i < pci::num_device; ++i) {
+    auto& dev = pci::devices[i];
+    if (pci::ReadVendorId(dev) == kVendorID &&
+        pci::ReadDeviceId(dev.bus, dev.device, dev.function) ==
+            kTransitionalDeviceID) {
+      blk_dev = &dev;
+      break;
+    }
+  }
+  if (blk_dev == nullptr) {
+    return;
+  }
+
+  // enable I/O space access and bus mastering
+  pci::WriteConfReg(*blk_dev, 0x04, pci::ReadConfReg(*blk_dev, 0x04) | 0x5u);
+
+  const auto bar = pci::ReadBar(*blk_dev, 0);
+  if (bar.error || (bar.value & 1u) == 0) {
+    Log(kError, "virtio-blk: BAR0 is not an I/O BAR\n");
+    return;
+  }
+
+  auto dev = new Device{*blk_dev, static_cast<uint16_t>(bar.value & ~0x3u)};
+  if (auto err = dev->Initialize()) {
+    Log(kError, "virtio-blk: failed to initialize: %s at %s:%d\n", err.Name(),
+        err.File(), err.Line());
+    delete dev;
+    return;
+  }
+  device = dev;
+}
+
+}  // namespace virtio::blk
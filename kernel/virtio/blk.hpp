@@ -0,0 +1,135 @@
+/**
+ * @file virtio/blk.hpp
+ *
+ * virtio-blk driver.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "block.hpp"
+#include "virtio/virtio.hpp"
+
+class Task;
+
+namespace virtio::blk {
+
+const uint16_t kTransitionalDeviceID = 0x1001;
+
+struct RequestHeader {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+} __attribute__((packed));
+
+const uint32_t kRequestIn = 0;
+const uint32_t kRequestOut = 1;
+const uint32_t kRequestFlush = 4;
+
+const uint8_t kStatusOK = 0;
+
+/** @brief Request is one asynchronous virtio-blk request. It must stay alive
+ * until Device::Wait returns for it.
+ */
+struct Request {
+  RequestHeader header;
+  void* buf;
+  uint32_t len;  // bytes, a multiple of 512
+
+  // filled in by the driver
+  volatile uint8_t status;
+  volatile bool done;
+  Task* waiter;
+  uint16_t head;
+};
+
+struct DeviceStat {
+  unsigned long requests, notifications, interrupts;
+};
+
+/** @brief Device is a virtio-blk disk.
+ *
+ * Each task submits to the queue (task ID % number of queues), so tasks do
+ * not contend for descriptors when the device offers VIRTIO_BLK_F_MQ.
+ * Completions are handled in the interrupt handler, which wakes the waiting
+ * task. Read and Write split a transfer into requests and keep up to
+ * MaxDepth of them in flight.
+ */
+class Device : public BlockDevice {
+ public:
+  Device(pci::Device& dev, uint16_t io_base);
+  Error Initialize();
+
+  Error Read(uint64_t lba, void* buf, size_t num_blocks) override;
+  /** @brief Reads like Read, but in requests of request_blocks blocks with
+   * up to depth of them in flight, which Read chooses by itself. Both are
+   * limited to what the device accepts. For measuring their effect.
+   */
+  Error ReadInRequests(uint64_t lba, void* buf, size_t num_blocks,
+                       size_t request_blocks, size_t depth);
+  Error Write(uint64_t lba, const void* buf, size_t num_blocks) override;
+  size_t BlockSize() const override { return 512; }
+  uint64_t NumBlocks() const override { return capacity_; }
+  bool CanTransfer(const void* buf, size_t bytes) const override;
+  Error Flush() override;
+
+  static Request MakeRequest(uint32_t type, uint64_t sector, void* buf,
+                             uint32_t len);
+  /** @brief Submits the requests to the queue of the current task with a
+   * single notification. n must not exceed MaxDepth(), and the buffers have
+   * to be identity mapped as the device reads their physical addresses.
+   */
+  Error Submit(Request* reqs, size_t n);
+  /** @brief Waits until all of the requests complete.
+   *
+   * The interrupt is deferred until the last outstanding request of the
+   * queue completes. The task sleeps meanwhile, unless interrupts are
+   * disabled on entry in which case the queue is polled.
+   */
+  Error Wait(Request* reqs, size_t n);
+  /** @brief Returns the maximum number of requests in flight per queue. */
+  size_t MaxDepth() const { return max_depth_; }
+  size_t NumQueues() const { return queues_.size(); }
+  bool ReadOnly() const { return read_only_; }
+  DeviceStat Stat() const { return stat_; }
+
+  /** @brief Reaps completed requests of all queues. Called by the interrupt
+   * handler.
+   */
+  void HandleInterrupt();
+
+ private:
+  struct Queue {
+    Virtqueue vq;
+    // indexed by the head descriptor of a request
+    std::vector<Request*> inflight;
+  };
+
+  LegacyTransport transport_;
+  std::vector<std::unique_ptr<Queue>> queues_{};
+  uint64_t capacity_{0};
+  uint32_t max_transfer_bytes_{0};
+  size_t max_depth_{0};
+  bool read_only_{false};
+  bool has_flush_{false};
+  bool use_interrupt_{false};
+  DeviceStat stat_{};
+
+  size_t CurrentQueue() const;
+  // must be called with interrupts disabled
+  void ProcessCompletions();
+  Error Transfer(uint32_t type, uint64_t lba, uint8_t* buf, size_t num_blocks,
+                 size_t request_blocks, size_t depth);
+};
+
+extern Device* device;
+
+/** @brief Finds a transitional virtio-blk device and initializes it. device
+ * stays nullptr when there is none.
+ */
+void Initialize();
+
+}  // namespace virtio::blk
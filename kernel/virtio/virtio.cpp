@@ -0,0 +1,230 @@
+#include "virtio/virtio.hpp"
+
+#include <cstring>
+
+#include "asmfunc.h"
+#include "memory_manager.hpp"
+
+namespace {
+// register offsets of the legacy virtio header in the I/O BAR
+const uint16_t kRegDeviceFeatures = 0x00;
+const uint16_t kRegGuestFeatures = 0x04;
+const uint16_t kRegQueueAddress = 0x08;
+const uint16_t kRegQueueSize = 0x0c;
+const uint16_t kRegQueueSelect = 0x0e;
+const uint16_t kRegQueueNotify = 0x10;
+const uint16_t kRegDeviceStatus = 0x12;
+const uint16_t kRegISRStatus = 0x13;
+// only present while MSI-X is enabled
+const uint16_t kRegConfigVector = 0x14;
+const uint16_t kRegQueueVector = 0x16;
+
+const uint64_t kQueueAlign = 4096;
+
+void MemoryBarrier() { __asm__ volatile("mfence" ::: "memory"); }
+void CompilerBarrier() { __asm__ volatile("" ::: "memory"); }
+}  // namespace
+
+namespace virtio {
+
+LegacyTransport::LegacyTransport(pci::Device& dev, uint16_t io_base)
+    : dev_{dev}, io_base_{io_base} {}
+
+void LegacyTransport::Reset() {
+  IoOut8(io_base_ + kRegDeviceStatus, 0);
+  // the device is reset when the status reads back as 0
+  while (IoIn8(io_base_ + kRegDeviceStatus) != 0)
+    ;
+}
+
+uint8_t LegacyTransport::Status() const {
+  return IoIn8(io_base_ + kRegDeviceStatus);
+}
+
+void LegacyTransport::SetStatus(uint8_t status) {
+  IoOut8(io_base_ + kRegDeviceStatus, status);
+}
+
+uint32_t LegacyTransport::DeviceFeatures() const {
+  return IoIn32(io_base_ + kRegDeviceFeatures);
+}
+
+void LegacyTransport::SetGuestFeatures(uint32_t features) {
+  IoOut32(io_base_ + kRegGuestFeatures, features);
+}
+
+Error LegacyTransport::EnableMSIX(uint8_t vector) {
+  const uint8_t bsp_local_apic_id =
+      *reinterpret_cast<const uint32_t*>(0xfee00020) >> 24;
+  if (auto err = pci::ConfigureMSIFixedDestination(
+          dev_, bsp_local_apic_id, pci::MSITriggerMode::kEdge,
+          pci::MSIDeliveryMode::kFixed, vector, 0)) {
+    return err;
+  }
+  msix_enabled_ = true;
+
+  IoOut16(io_base_ + kRegConfigVector, kNoVector);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+uint16_t LegacyTransport::QueueSize(uint16_t queue_index) {
+  IoOut16(io_base_ + kRegQueueSelect, queue_index);
+  return IoIn16(io_base_ + kRegQueueSize);
+}
+
+Error LegacyTransport::SetupQueue(uint16_t queue_index, uint64_t ring_addr) {
+  if (ring_addr % kQueueAlign != 0) {
+    return MAKE_ERROR(Error::kInvalidFormat);
+  }
+
+  IoOut16(io_base_ + kRegQueueSelect, queue_index);
+  if (msix_enabled_) {
+    IoOut16(io_base_ + kRegQueueVector, 0);
+    // the device answers kNoVector if it could not allocate the vector
+    if (IoIn16(io_base_ + kRegQueueVector) == kNoVector) {
+      return MAKE_ERROR(Error::kNoPCIMSI);
+    }
+  }
+  IoOut32(io_base_ + kRegQueueAddress, ring_addr / kQueueAlign);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+void LegacyTransport::Notify(uint16_t queue_index) {
+  IoOut16(io_base_ + kRegQueueNotify, queue_index);
+}
+
+uint8_t LegacyTransport::ReadISR() { return IoIn8(io_base_ + kRegISRStatus); }
+
+uint8_t LegacyTransport::ReadConfig8(unsigned int offset) const {
+  return IoIn8(ConfigBase() + offset);
+}
+
+uint16_t LegacyTransport::ReadConfig16(unsigned int offset) const {
+  return IoIn16(ConfigBase() + offset);
+}
+
+uint32_t LegacyTransport::ReadConfig32(unsigned int offset) const {
+  return IoIn32(ConfigBase() + offset);
+}
+
+uint64_t LegacyTransport::ReadConfig64(unsigned int offset) const {
+  return ReadConfig32(offset) |
+         static_cast<uint64_t>(ReadConfig32(offset + 4)) << 32;
+}
+
+Error Virtqueue::Initialize(uint16_t size, bool event_idx) {
+  if (size == 0 || (size & (size - 1)) != 0) {
+    return MAKE_ERROR(Error::kInvalidFormat);
+  }
+
+  // legacy layout: descriptors and the available ring, then the used ring
+  // on the next 4 KiB boundary
+  const size_t avail_end = 16 * size + 6 + 2 * size;
+  const size_t used_offset = (avail_end + kQueueAlign - 1) & ~(kQueueAlign - 1);
+  const size_t total_bytes = used_offset + 6 + 8 * size;
+  const size_t num_frames = (total_bytes + kBytesPerFrame - 1) / kBytesPerFrame;
+
+  const auto frame = memory_manager->Allocate(num_frames);
+  if (frame.error) {
+    return frame.error;
+  }
+  auto ring = reinterpret_cast<uint8_t*>(frame.value.Frame());
+  memset(ring, 0, num_frames * kBytesPerFrame);
+
+  size_ = size;
+  event_idx_ = event_idx;
+  desc_ = reinterpret_cast<VirtqDesc*>(ring);
+  avail_ = reinterpret_cast<Avail*>(ring + 16 * size);
+  used_ = reinterpret_cast<Used*>(ring + used_offset);
+
+  for (uint16_t i = 0; i < size; ++i) {
+    desc_[i].next = i + 1;
+  }
+  free_head_ = 0;
+  num_free_ = size;
+  avail_idx_ = published_idx_ = last_used_ = 0;
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+int Virtqueue::AllocChain(int n) {
+  if (n <= 0 || n > num_free_) {
+    return -1;
+  }
+
+  const uint16_t head = free_head_;
+  uint16_t i = head;
+  for (int k = 0; k < n - 1; ++k) {
+    desc_[i].flags = kDescFlagNext;
+    i = desc_[i].next;
+  }
+  desc_[i].flags = 0;
+  free_head_ = desc_[i].next;
+  num_free_ -= n;
+  return head;
+}
+
+void Virtqueue::Push(uint16_t head) {
+  avail_->ring[avail_idx_ % size_] = head;
+  ++avail_idx_;
+}
+
+bool Virtqueue::Publish() {
+  if (avail_idx_ == published_idx_) {
+    return false;
+  }
+
+  // descriptors and ring entries must be visible before the index
+  CompilerBarrier();
+  avail_->idx = avail_idx_;
+  // and the index before we look at what the device asked for
+  MemoryBarrier();
+
+  const uint16_t old_idx = published_idx_;
+  const uint16_t new_idx = avail_idx_;
+  published_idx_ = avail_idx_;
+
+  if (!event_idx_) {
+    return (used_->flags & 1) == 0;  // VIRTQ_USED_F_NO_NOTIFY
+  }
+  // avail_event lives right after the used ring
+  const uint16_t avail_event =
+      *reinterpret_cast<volatile uint16_t*>(&used_->ring[size_]);
+  return static_cast<uint16_t>(new_idx - avail_event - 1) <
+         static_cast<uint16_t>(new_idx - old_idx);
+}
+
+bool Virtqueue::HasUsed() const {
+  return last_used_ != used_->idx;
+}
+
+VirtqUsedElem Virtqueue::PopUsed() {
+  CompilerBarrier();
+  VirtqUsedElem elem;
+  elem.id = used_->ring[last_used_ % size_].id;
+  elem.len = used_->ring[last_used_ % size_].len;
+  ++last_used_;
+
+  // return the chain to the free list
+  uint16_t i = elem.id;
+  int n = 1;
+  while (desc_[i].flags & kDescFlagNext) {
+    i = desc_[i].next;
+    ++n;
+  }
+  desc_[i].next = free_head_;
+  free_head_ = elem.id;
+  num_free_ += n;
+  return elem;
+}
+
+void Virtqueue::SetUsedEvent(uint16_t n) {
+  if (!event_idx_ || n == 0) {
+    return;
+  }
+  // used_event lives right after the available ring
+  auto used_event = reinterpret_cast<volatile uint16_t*>(&avail_->ring[size_]);
+  *used_event = last_used_ + n - 1;
+  MemoryBarrier();
+}
+
+}  // namespace virtio
@@ -0,0 +1,158 @@
+/**
+ * @file virtio/virtio.hpp
+ *
+ * Legacy virtio PCI transport and split virtqueues.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+#include "pci.hpp"
+
+namespace virtio {
+
+const uint16_t kVendorID = 0x1af4;
+
+namespace status {
+const uint8_t kAcknowledge = 1;
+const uint8_t kDriver = 2;
+const uint8_t kDriverOK = 4;
+const uint8_t kFailed = 128;
+}  // namespace status
+
+const unsigned int kFeatureRingEventIdx = 29;
+
+const uint16_t kNoVector = 0xffff;
+
+/** @brief LegacyTransport accesses the registers of a transitional virtio
+ * device through its I/O BAR (virtio 1.0, section 4.1.4.8).
+ */
+class LegacyTransport {
+ public:
+  LegacyTransport(pci::Device& dev, uint16_t io_base);
+
+  void Reset();
+  uint8_t Status() const;
+  void SetStatus(uint8_t status);
+  void AddStatus(uint8_t bits) { SetStatus(Status() | bits); }
+
+  uint32_t DeviceFeatures() const;
+  void SetGuestFeatures(uint32_t features);
+
+  /** @brief Routes the device interrupts to MSI-X vector 0 on the local
+   * APIC of the bootstrap processor. The device config space moves by
+   * 4 bytes once MSI-X is enabled.
+   */
+  Error EnableMSIX(uint8_t vector);
+  bool MSIXEnabled() const { return msix_enabled_; }
+
+  /** @brief Returns the size of the queue, 0 if it does not exist. */
+  uint16_t QueueSize(uint16_t queue_index);
+  /** @brief Sets the ring address of the queue, which has to be 4 KiB
+   * aligned, and binds it to MSI-X vector 0 if MSI-X is enabled.
+   */
+  Error SetupQueue(uint16_t queue_index, uint64_t ring_addr);
+  void Notify(uint16_t queue_index);
+  /** @brief Reads and clears the ISR status register. */
+  uint8_t ReadISR();
+
+  uint8_t ReadConfig8(unsigned int offset) const;
+  uint16_t ReadConfig16(unsigned int offset) const;
+  uint32_t ReadConfig32(unsigned int offset) const;
+  uint64_t ReadConfig64(unsigned int offset) const;
+
+ private:
+  pci::Device& dev_;
+  uint16_t io_base_;
+  bool msix_enabled_{false};
+
+  uint16_t ConfigBase() const { return io_base_ + (msix_enabled_ ? 0x18 : 0x14); }
+};
+
+struct VirtqDesc {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} __attribute__((packed));
+
+const uint16_t kDescFlagNext = 1;
+const uint16_t kDescFlagWrite = 2;
+
+struct VirtqUsedElem {
+  uint32_t id;
+  uint32_t len;
+} __attribute__((packed));
+
+/** @brief Virtqueue is a split virtqueue in the legacy memory layout.
+ *
+ * Descriptors are handed out as chains from a free list. Chains added by
+ * Push become visible to the device only when Publish is called, so that a
+ * batch of requests costs a single index update and at most one
+ * notification. None of the methods disables interrupts; callers sharing a
+ * queue with an interrupt handler have to do that.
+ */
+class Virtqueue {
+ public:
+  Error Initialize(uint16_t size, bool event_idx);
+
+  uint16_t Size() const { return size_; }
+  uint64_t RingAddress() const { return reinterpret_cast<uint64_t>(desc_); }
+  uint16_t NumFree() const { return num_free_; }
+  /** @brief Returns the number of chains the device has not completed. */
+  uint16_t NumInflight() const { return avail_idx_ - last_used_; }
+
+  /** @brief Takes n descriptors from the free list and links them.
+   *
+   * @return Index of the head descriptor, or -1 if there are not enough
+   * free descriptors.
+   */
+  int AllocChain(int n);
+  VirtqDesc& Desc(uint16_t index) { return desc_[index]; }
+  /** @brief Appends the chain to the available ring without publishing. */
+  void Push(uint16_t head);
+  /** @brief Makes pushed chains visible to the device.
+   *
+   * @return true if the device has to be notified.
+   */
+  bool Publish();
+
+  bool HasUsed() const;
+  /** @brief Pops a used element and returns its chain to the free list. */
+  VirtqUsedElem PopUsed();
+  /** @brief Asks the device to interrupt after the n-th chain from now has
+   * been used (n >= 1). Only effective with VIRTIO_RING_F_EVENT_IDX.
+   */
+  void SetUsedEvent(uint16_t n);
+
+ private:
+  struct Avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+  } __attribute__((packed));
+
+  struct Used {
+    uint16_t flags;
+    uint16_t idx;
+    VirtqUsedElem ring[];
+  } __attribute__((packed));
+
+  uint16_t size_{0};
+  bool event_idx_{false};
+  VirtqDesc* desc_{nullptr};
+  volatile Avail* avail_{nullptr};
+  volatile Used* used_{nullptr};
+
+  uint16_t free_head_{0};
+  uint16_t num_free_{0};
+  // index of the next avail entry, published or not
+  uint16_t avail_idx_{0};
+  // avail->idx at the last Publish
+  uint16_t published_idx_{0};
+  uint16_t last_used_{0};
+};
+
+}  // namespace virtio
@@ -34,11 +34,6 @@ const char close_button[kCloseButtonHeight][kCloseButtonWidth + 1] = {
 
 Window::Window(int width, int height, PixelFormat shadow_format)
     : width_{width}, height_{height} {
-  data_.resize(height);
-  for (int y = 0; y < height; ++y) {
-    data_[y].resize(width);
-  }
-
   FrameBufferConfig config{};
   config.frame_buffer = nullptr;
   config.horizontal_resolution = width;
@@ -52,41 +47,46 @@ Window::Window(int width, int height, PixelFormat shadow_format)
 }
 
 void Window::DrawTo(FrameBuffer& dst, Vector2D<int> pos,
-                    const Rectangle<int>& area) {
+                    const Rectangle<int>& area, uint8_t opacity) {
+  Rectangle<int> window_area{pos, Size()};
+  Rectangle<int> intersection = area & window_area;
+  if (opacity != 255 || has_alpha_) {
+    dst.CopyBlended(intersection.pos, shadow_buffer_,
+                    {intersection.pos - pos, intersection.size}, opacity,
+                    transparent_color_);
+    return;
+  }
+
   if (!transparent_color_) {
-    Rectangle<int> window_area{pos, Size()};
-    Rectangle<int> intersection = area & window_area;
     dst.Copy(intersection.pos, shadow_buffer_,
              {intersection.pos - pos, intersection.size});
     return;
   }
 
-  const auto tc = transparent_color_.value();
-  auto& writer = dst.Writer();
-  for (int y = std::max(0, 0 - pos.y);
-       y < std::min(Height(), writer.Height() - pos.y); ++y) {
-    for (int x = std::max(0, 0 - pos.x);
-         x < std::min(Width(), writer.Width() - pos.x); ++x) {
-      const auto c = At(Vector2D<int>{x, y});
-      if (c != tc) {
-        writer.Write(pos + Vector2D<int>{x, y}, c);
-      }
-    }
-  }
+  dst.CopyKeyed(intersection.pos, shadow_buffer_,
+                {intersection.pos - pos, intersection.size},
+                transparent_color_.value());
 }
 
 void Window::SetTransparentColor(std::optional<PixelColor> c) {
   transparent_color_ = c;
 }
 
+void Window::FillAlpha(Vector2D<int> pos, Vector2D<int> size,
+                       const PixelColor& c, uint8_t alpha) {
+  if (alpha != 255) {
+    has_alpha_ = true;
+  }
+  shadow_buffer_.FillAlpha(pos, size, c, alpha);
+}
+
 Window::WindowWriter* Window::Writer() { return &writer_; }
 
-const PixelColor& Window::At(Vector2D<int> pos) const {
-  return data_[pos.y][pos.x];
+PixelColor Window::At(Vector2D<int> pos) const {
+  return shadow_buffer_.At(pos);
 }
 
 void Window::Write(Vector2D<int> pos, PixelColor c) {
-  data_[pos.y][pos.x] = c;
   shadow_buffer_.Writer().Write(pos, c);
 }
 
@@ -7,7 +7,6 @@ Provides a Window class that represents a display area.
 
 #include <optional>
 #include <string>
-#include <vector>
 
 #include "frame_buffer.hpp"
 #include "graphics.hpp"
@@ -39,6 +38,18 @@ class Window {
     virtual int Width() const override { return window_.Width(); }
     /* @brief Returns the height of the associated Window in pixels. */
     virtual int Height() const override { return window_.Height(); }
+    virtual void FillSpan(Vector2D<int> pos, int len,
+                          const PixelColor& c) override {
+      window_.shadow_buffer_.Writer().FillSpan(pos, len, c);
+    }
+    virtual void FillRect(Vector2D<int> pos, Vector2D<int> size,
+                          const PixelColor& c) override {
+      window_.shadow_buffer_.Writer().FillRect(pos, size, c);
+    }
+    virtual void BlitRect(Vector2D<int> pos, Vector2D<int> size,
+                          const PixelColor* src, int src_pitch) override {
+      window_.shadow_buffer_.Writer().BlitRect(pos, size, src, src_pitch);
+    }
 
    private:
     Window& window_;
@@ -57,15 +68,28 @@ class Window {
    * @param dst where to draw to
    * @param pos The window position relative to the upper left of dst
    * @param area The area to be drawn with respect to the upper left of dst
+   * @param opacity How much the window covers dst, 255 for fully
    */
-  void DrawTo(FrameBuffer& dst, Vector2D<int> pos, const Rectangle<int>& area);
+  void DrawTo(FrameBuffer& dst, Vector2D<int> pos, const Rectangle<int>& area,
+              uint8_t opacity = 255);
   /* @brief Sets the transparent color. */
   void SetTransparentColor(std::optional<PixelColor> c);
+  /** @brief Returns true if DrawTo with opacity 255 overwrites every pixel
+   * of the window area, that is, neither a transparent color nor a pixel with
+   * alpha is set. */
+  bool IsOpaque() const { return !transparent_color_ && !has_alpha_; }
+  /** @brief Returns true if the window has pixels with alpha, which are
+   * blended with the pixels below. */
+  bool HasAlpha() const { return has_alpha_; }
+  /** @brief Fills the rectangle with a color of the given alpha, which the
+   * layers below show through when the window is drawn. */
+  void FillAlpha(Vector2D<int> pos, Vector2D<int> size, const PixelColor& c,
+                 uint8_t alpha);
   /** @brief Gets the WindowWriter associated with this instance. */
   WindowWriter* Writer();
 
   /* @brief Returns the pixel at the specified position. */
-  const PixelColor& At(Vector2D<int> pos) const;
+  PixelColor At(Vector2D<int> pos) const;
   /** @brief Write the pixel at the specified position. */
   void Write(Vector2D<int> pos, PixelColor c);
 
@@ -91,10 +115,11 @@ class Window {
 
  private:
   int width_, height_;
-  std::vector<std::vector<PixelColor>> data_{};
   WindowWriter writer_{*this};
   std::optional<PixelColor> transparent_color_{std::nullopt};
+  bool has_alpha_{false};
 
+  // the only copy of the pixels, in the pixel format of the screen
   FrameBuffer shadow_buffer_{};
 };
 
@@ -117,6 +142,22 @@ class ToplevelWindow : public Window {
     virtual int Height() const override {
       return window_.Height() - kTopLeftMargin.y - kBottomRightMargin.y;
     }
+    virtual void FillRect(Vector2D<int> pos, Vector2D<int> size,
+                          const PixelColor& c) override {
+      Vector2D<int> skip{0, 0};
+      if (Clip(pos, size, skip)) {
+        window_.Writer()->FillRect(pos + kTopLeftMargin, size, c);
+      }
+    }
+    virtual void BlitRect(Vector2D<int> pos, Vector2D<int> size,
+                          const PixelColor* src, int src_pitch) override {
+      Vector2D<int> skip{0, 0};
+      if (Clip(pos, size, skip)) {
+        window_.Writer()->BlitRect(pos + kTopLeftMargin, size,
+                                   src + src_pitch * skip.y + skip.x,
+                                   src_pitch);
+      }
+    }
 
    private:
     ToplevelWindow& window_;